@@ -1,7 +1,23 @@
 #include <gtest/gtest.h>
 
+#include <cmath>
+#include <cstring>
+#include <memory_resource>
+#include <random>
+#include <thread>
+
 #include "image.h"
 #include "9patch.h"
+#include "NinePatchBindings.h"
+#include "NinePatchCache.h"
+#include "NinePatchLayout.h"
+#include "NinePatchMesh.h"
+#include "NinePatchMinimizer.h"
+#include "NinePatchRegion.h"
+#include "NinePatchRenderer.h"
+#include "NinePatchRescaler.h"
+#include "NinePatchSimd.h"
+#include "NinePatchStageHistograms.h"
 
 #ifdef GTEST_API_
 
@@ -65,6 +81,11 @@ static uint8_t* kLayoutBoundsWrongEdge3x3[] = {
     (uint8_t*)WHITE WHITE WHITE,
 };
 
+static uint8_t* kLeftBorderOpticalBounds3x3[] = {
+    (uint8_t*)WHITE WHITE WHITE, (uint8_t*)RED WHITE WHITE,
+    (uint8_t*)WHITE WHITE WHITE,
+};
+
 static uint8_t* kLayoutBoundsNotEdgeAligned5x5[] = {
     (uint8_t*)WHITE WHITE WHITE WHITE WHITE,
     (uint8_t*)WHITE WHITE WHITE WHITE WHITE,
@@ -238,6 +259,14 @@ TEST(NinePatchTest, LayoutBoundsAreOnWrongEdge) {
   EXPECT_FALSE(err.empty());
 }
 
+TEST(NinePatchTest, LayoutBoundsOnLeftEdgeReportError) {
+  std::string err;
+  EXPECT_EQ(nullptr,
+            NinePatch::Create(kLeftBorderOpticalBounds3x3, 3, 3, &err));
+  EXPECT_EQ("found unexpected optical bounds (red pixel) on left border at y=1",
+            err);
+}
+
 TEST(NinePatchTest, LayoutBoundsMustTouchEdges) {
   std::string err;
   EXPECT_EQ(nullptr,
@@ -322,6 +351,21 @@ TEST(NinePatchTest, OutlineFromOffCenterImage) {
   EXPECT_EQ(0.0f, nine_patch->outline_radius);
 }
 
+TEST(NinePatchTest, TightOutlineFromOffCenterImage) {
+  for (bool single_pass : {false, true}) {
+    NinePatchOptions options;
+    options.tight_outline = true;
+    options.single_pass = single_pass;
+    std::string err;
+    std::unique_ptr<NinePatch> nine_patch = NinePatch::Create(
+        kOutlineOffsetTranslucent12x10, 12, 10, options, &err);
+    ASSERT_NE(nullptr, nine_patch);
+    EXPECT_EQ(Bounds(5, 3, 3, 3), nine_patch->outline);
+    EXPECT_EQ(0x000000b3u, nine_patch->outline_alpha);
+    EXPECT_EQ(0.0f, nine_patch->outline_radius);
+  }
+}
+
 TEST(NinePatchTest, OutlineRadius) {
   std::string err;
   std::unique_ptr<NinePatch> nine_patch =
@@ -331,6 +375,2176 @@ TEST(NinePatchTest, OutlineRadius) {
   EXPECT_EQ(3.4142f, nine_patch->outline_radius);
 }
 
+// Builds a 3-row image from the given top and bottom borders, with a
+// transparent middle row.
+static std::vector<std::vector<uint8_t>> MakeBorderImage(
+    const std::vector<const char*>& top,
+    const std::vector<const char*>& bottom) {
+  std::vector<std::vector<uint8_t>> image(3);
+  for (const char* pixel : top) {
+    image[0].insert(image[0].end(), pixel, pixel + 4);
+  }
+  image[1].resize(image[0].size(), 0x00);
+  for (const char* pixel : bottom) {
+    image[2].insert(image[2].end(), pixel, pixel + 4);
+  }
+  return image;
+}
+
+static void AppendRun(std::vector<const char*>* line, const char* pixel,
+                      int count) {
+  line->insert(line->end(), count, pixel);
+}
+
+TEST(NinePatchTest, SimdRunKernelsMatchScalar) {
+  const char* palette[] = {BLACK, RED, WHITE, TRANS, "\x12\x34\x56\x00",
+                           GR_50};
+  std::mt19937 rng(1234);
+  std::vector<uint8_t> pixels;
+  while (pixels.size() < 4 * 4096) {
+    const char* pixel = palette[rng() % 6];
+    const size_t run = 1 + rng() % 40;
+    for (size_t i = 0; i < run; i++) {
+      pixels.insert(pixels.end(), pixel, pixel + 4);
+    }
+  }
+  const int32_t length = static_cast<int32_t>(pixels.size() / 4);
+
+  const uint32_t predicates[][2] = {
+      {0xffffffffu, 0xff000000u},  // black
+      {0xffffffffu, 0xffff0000u},  // red
+      {0xffffffffu, 0xffffffffu},  // white
+      {0xff000000u, 0x00000000u},  // transparent
+  };
+  const simd::Kernels& scalar = simd::GetKernels(simd::Level::kScalar);
+  for (int level = 0; level <= static_cast<int>(simd::DetectLevel());
+       level++) {
+    const simd::Kernels& kernels =
+        simd::GetKernels(static_cast<simd::Level>(level));
+    for (const auto& predicate : predicates) {
+      for (int32_t start = 0; start < length; start += 1 + rng() % 7) {
+        ASSERT_EQ(scalar.find_run_end(pixels.data(), start, length,
+                                      predicate[0], predicate[1]),
+                  kernels.find_run_end(pixels.data(), start, length,
+                                       predicate[0], predicate[1]))
+            << "level " << level << " start " << start;
+      }
+    }
+  }
+}
+
+TEST(NinePatchTest, SimdAlphaKernelsMatchScalar) {
+  std::mt19937 rng(4321);
+  std::vector<uint8_t> pixels(4 * 2048);
+  for (size_t i = 0; i < pixels.size(); i++) {
+    pixels[i] = rng() % 4 == 0 ? 0 : rng() % 256;
+  }
+  const int32_t length = static_cast<int32_t>(pixels.size() / 4);
+
+  const simd::Kernels& scalar = simd::GetKernels(simd::Level::kScalar);
+  for (int level = 0; level <= static_cast<int>(simd::DetectLevel());
+       level++) {
+    const simd::Kernels& kernels =
+        simd::GetKernels(static_cast<simd::Level>(level));
+    for (int i = 0; i < 500; i++) {
+      const int32_t start = rng() % length;
+      const int32_t end = start + rng() % (length - start + 1);
+      const uint32_t alpha = 1 + rng() % 255;
+      ASSERT_EQ(scalar.max_alpha(pixels.data(), start, end),
+                kernels.max_alpha(pixels.data(), start, end))
+          << "level " << level << " [" << start << ", " << end << ")";
+      ASSERT_EQ(scalar.find_alpha(pixels.data(), start, end, alpha),
+                kernels.find_alpha(pixels.data(), start, end, alpha))
+          << "level " << level << " [" << start << ", " << end << ")";
+      ASSERT_EQ(scalar.find_last_alpha(pixels.data(), start, end, alpha),
+                kernels.find_last_alpha(pixels.data(), start, end, alpha))
+          << "level " << level << " [" << start << ", " << end << ")";
+    }
+  }
+}
+
+TEST(NinePatchTest, SimdWeightedAddMatchesScalar) {
+  std::mt19937 rng(4322);
+  std::vector<float> src(1027);
+  for (float& value : src) {
+    value = static_cast<float>(rng() % 65536) / 256.0f;
+  }
+
+  const simd::Kernels& scalar = simd::GetKernels(simd::Level::kScalar);
+  for (int level = 0; level <= static_cast<int>(simd::DetectLevel());
+       level++) {
+    const simd::Kernels& kernels =
+        simd::GetKernels(static_cast<simd::Level>(level));
+    std::vector<float> expected(src.size(), 1.5f);
+    std::vector<float> actual(src.size(), 1.5f);
+    for (int32_t count : {0, 3, 8, 16, 21, 1027}) {
+      scalar.weighted_add(expected.data(), src.data(), 0.3f, count);
+      kernels.weighted_add(actual.data(), src.data(), 0.3f, count);
+    }
+    EXPECT_EQ(expected, actual) << "level " << level;
+  }
+}
+
+TEST(NinePatchTest, SimdBorderScanMatchesScalar) {
+  std::vector<const char*> top;
+  AppendRun(&top, TRANS, 38);
+  AppendRun(&top, BLACK, 21);
+  AppendRun(&top, "\x12\x34\x56\x00", 3);
+  AppendRun(&top, BLACK, 18);
+  AppendRun(&top, TRANS, 41);
+
+  std::vector<const char*> bottom;
+  AppendRun(&bottom, TRANS, 1);
+  AppendRun(&bottom, RED, 5);
+  AppendRun(&bottom, TRANS, 5);
+  AppendRun(&bottom, BLACK, 50);
+  AppendRun(&bottom, TRANS, 54);
+  AppendRun(&bottom, RED, 5);
+  AppendRun(&bottom, TRANS, 1);
+
+  std::vector<std::vector<uint8_t>> image = MakeBorderImage(top, bottom);
+  uint8_t* rows[] = {image[0].data(), image[1].data(), image[2].data()};
+  const int32_t width = static_cast<int32_t>(top.size());
+
+  for (int level = 0; level <= static_cast<int>(simd::DetectLevel());
+       level++) {
+    simd::SetActiveLevel(static_cast<simd::Level>(level));
+    std::string err;
+    std::unique_ptr<NinePatch> nine_patch =
+        NinePatch::Create(rows, width, 3, &err);
+    ASSERT_NE(nullptr, nine_patch) << err;
+    ASSERT_EQ(2u, nine_patch->horizontal_stretch_regions.size());
+    EXPECT_EQ(Range(37, 58), nine_patch->horizontal_stretch_regions[0]);
+    EXPECT_EQ(Range(61, 79), nine_patch->horizontal_stretch_regions[1]);
+    EXPECT_EQ(Bounds(10, 0, 59, 0), nine_patch->padding);
+    EXPECT_EQ(Bounds(5, 0, 5, 0), nine_patch->layout_bounds);
+  }
+  simd::SetActiveLevel(simd::DetectLevel());
+}
+
+TEST(NinePatchTest, TallImageVerticalBorders) {
+  // A 3x100 image with long black runs on the left and right borders.
+  std::vector<std::vector<uint8_t>> image(100);
+  std::vector<uint8_t*> rows;
+  for (size_t y = 0; y < image.size(); y++) {
+    const bool stretch = y >= 10 && y < 70;
+    const bool padding = y >= 20 && y < 90;
+    const char* left = stretch ? BLACK : WHITE;
+    const char* right = padding ? BLACK : WHITE;
+    const char* middle = y == 0 || y == image.size() - 1 ? WHITE : GREEN;
+    image[y].insert(image[y].end(), left, left + 4);
+    image[y].insert(image[y].end(), middle, middle + 4);
+    image[y].insert(image[y].end(), right, right + 4);
+    rows.push_back(image[y].data());
+  }
+
+  std::string err;
+  std::unique_ptr<NinePatch> nine_patch =
+      NinePatch::Create(rows.data(), 3, 100, &err);
+  ASSERT_NE(nullptr, nine_patch) << err;
+  ASSERT_EQ(1u, nine_patch->vertical_stretch_regions.size());
+  EXPECT_EQ(Range(9, 69), nine_patch->vertical_stretch_regions.front());
+  EXPECT_EQ(Bounds(0, 19, 0, 9), nine_patch->padding);
+  EXPECT_EQ(Bounds(0, 0, 0, 0), nine_patch->outline);
+}
+
+// An RGBA_8888 image generated by MakeRandomNinePatch().
+struct TestImage {
+  int32_t width;
+  int32_t height;
+  std::vector<uint8_t> data;
+  std::vector<uint8_t*> rows;
+};
+
+// Generates a valid 9-patch with a transparent or white neutral border, random
+// stretch, padding and layout bound runs, and content made of solid blocks
+// with occasional noise, so that some regions have a color and others do not.
+static TestImage MakeRandomNinePatch(uint32_t seed, int32_t width,
+                                     int32_t height) {
+  std::mt19937 rng(seed);
+  TestImage image;
+  image.width = width;
+  image.height = height;
+  image.data.resize(width * height * 4);
+  for (int32_t y = 0; y < height; y++) {
+    image.rows.push_back(image.data.data() + y * width * 4);
+  }
+
+  const bool white_neutral = rng() % 2 == 0;
+  const char* neutral = white_neutral ? WHITE : TRANS;
+  auto set = [&](int32_t x, int32_t y, const char* pixel) {
+    memcpy(image.rows[y] + x * 4, pixel, 4);
+  };
+
+  // Content: vertical bands of solid colors, some with noise.
+  const char* palette[] = {RED, BLUE, GREEN, GR_50, TRANS, BLACK};
+  int32_t band_color = 0;
+  for (int32_t x = 1; x < width - 1; x++) {
+    if (rng() % 8 == 0) {
+      band_color = rng() % 6;
+    }
+    for (int32_t y = 1; y < height - 1; y++) {
+      set(x, y, rng() % 997 == 0 ? GR_20 : palette[band_color]);
+    }
+  }
+
+  // Borders: up to 4 black runs between neutral ones, which keeps the region
+  // count within limits; the bottom and right borders start and end with a
+  // red layout bound run.
+  auto fill_border = [&](int32_t length, bool layout_bounds, auto set_pixel) {
+    bool black = false;
+    int toggles = 0;
+    for (int32_t i = 0; i < length; i++) {
+      if (i == 0 || i == length - 1) {
+        set_pixel(i, neutral);
+        continue;
+      }
+      if (layout_bounds && (i <= 2 || i >= length - 3)) {
+        set_pixel(i, RED);
+        continue;
+      }
+      if (layout_bounds) {
+        // A single padding run.
+        black = i > length / 4 && i < length - length / 4;
+      } else if (toggles < 8 && rng() % (length / 6 + 1) == 0) {
+        black = !black;
+        toggles++;
+      }
+      set_pixel(i, black ? BLACK : neutral);
+    }
+  };
+  fill_border(width, false, [&](int32_t x, const char* p) { set(x, 0, p); });
+  fill_border(height, false, [&](int32_t y, const char* p) { set(0, y, p); });
+  fill_border(width, true,
+              [&](int32_t x, const char* p) { set(x, height - 1, p); });
+  fill_border(height, true,
+              [&](int32_t y, const char* p) { set(width - 1, y, p); });
+  return image;
+}
+
+static void ExpectSameNinePatch(const NinePatch& expected,
+                                const NinePatch& actual) {
+  EXPECT_EQ(expected.horizontal_stretch_regions,
+            actual.horizontal_stretch_regions);
+  EXPECT_EQ(expected.vertical_stretch_regions, actual.vertical_stretch_regions);
+  EXPECT_EQ(expected.padding, actual.padding);
+  EXPECT_EQ(expected.layout_bounds, actual.layout_bounds);
+  EXPECT_EQ(expected.region_colors, actual.region_colors);
+  EXPECT_EQ(expected.region_opacities, actual.region_opacities);
+  EXPECT_EQ(expected.outline, actual.outline);
+  EXPECT_EQ(expected.outline_radius, actual.outline_radius);
+  EXPECT_EQ(expected.outline_alpha, actual.outline_alpha);
+}
+
+TEST(NinePatchTest, SinglePassMatchesMultiPass) {
+  struct {
+    uint8_t** rows;
+    int32_t width;
+    int32_t height;
+  } images[] = {
+      {kMixedNeutralColor3x3, 3, 3},
+      {kTransparentNeutralColor3x3, 3, 3},
+      {kSingleStretch7x6, 7, 6},
+      {kMultipleStretch10x7, 10, 7},
+      {kPadding6x5, 6, 5},
+      {kLayoutBoundsWrongEdge3x3, 3, 3},
+      {kLayoutBoundsNotEdgeAligned5x5, 5, 5},
+      {kLayoutBounds5x5, 5, 5},
+      {kAsymmetricLayoutBounds5x5, 5, 5},
+      {kPaddingAndLayoutBounds5x5, 5, 5},
+      {kColorfulImage5x5, 5, 5},
+      {kOutlineOpaque10x10, 10, 10},
+      {kOutlineTranslucent10x10, 10, 10},
+      {kOutlineOffsetTranslucent12x10, 12, 10},
+      {kOutlineRadius5x5, 5, 5},
+      {kStretchAndPadding5x5, 5, 5},
+  };
+
+  NinePatchOptions single_pass;
+  single_pass.single_pass = true;
+  for (const auto& image : images) {
+    std::string expected_err;
+    std::string actual_err;
+    std::unique_ptr<NinePatch> expected =
+        NinePatch::Create(image.rows, image.width, image.height, &expected_err);
+    std::unique_ptr<NinePatch> actual = NinePatch::Create(
+        image.rows, image.width, image.height, single_pass, &actual_err);
+    EXPECT_EQ(expected_err, actual_err);
+    ASSERT_EQ(expected == nullptr, actual == nullptr);
+    if (expected != nullptr) {
+      ExpectSameNinePatch(*expected, *actual);
+    }
+  }
+
+  for (uint32_t seed = 0; seed < 20; seed++) {
+    TestImage image = MakeRandomNinePatch(seed, 50 + seed * 7, 40 + seed * 5);
+    std::string err;
+    std::unique_ptr<NinePatch> expected =
+        NinePatch::Create(image.rows.data(), image.width, image.height, &err);
+    ASSERT_NE(nullptr, expected) << "seed " << seed << ": " << err;
+    std::unique_ptr<NinePatch> actual = NinePatch::Create(
+        image.rows.data(), image.width, image.height, single_pass, &err);
+    ASSERT_NE(nullptr, actual) << "seed " << seed << ": " << err;
+    ExpectSameNinePatch(*expected, *actual);
+  }
+}
+
+// Feeds the rows of an image to a NinePatchBuilder one at a time.
+static std::unique_ptr<NinePatch> BuildNinePatch(
+    uint8_t** rows, int32_t width, int32_t height,
+    const NinePatchOptions& options, std::string* out_err) {
+  NinePatchBuilder builder(width, height, options);
+  for (int32_t y = 0; y < height; y++) {
+    if (!builder.AddRow(rows[y], out_err)) {
+      return {};
+    }
+  }
+  return builder.Finish(out_err);
+}
+
+TEST(NinePatchTest, BuilderMatchesCreate) {
+  struct {
+    uint8_t** rows;
+    int32_t width;
+    int32_t height;
+  } images[] = {
+      {k2x2, 2, 2},
+      {kMixedNeutralColor3x3, 3, 3},
+      {kTransparentNeutralColor3x3, 3, 3},
+      {kSingleStretch7x6, 7, 6},
+      {kMultipleStretch10x7, 10, 7},
+      {kPadding6x5, 6, 5},
+      {kLayoutBoundsWrongEdge3x3, 3, 3},
+      {kLayoutBoundsNotEdgeAligned5x5, 5, 5},
+      {kLayoutBounds5x5, 5, 5},
+      {kAsymmetricLayoutBounds5x5, 5, 5},
+      {kPaddingAndLayoutBounds5x5, 5, 5},
+      {kColorfulImage5x5, 5, 5},
+      {kOutlineOpaque10x10, 10, 10},
+      {kOutlineTranslucent10x10, 10, 10},
+      {kOutlineOffsetTranslucent12x10, 12, 10},
+      {kOutlineRadius5x5, 5, 5},
+      {kStretchAndPadding5x5, 5, 5},
+  };
+
+  for (const auto& image : images) {
+    std::string expected_err;
+    std::string actual_err;
+    std::unique_ptr<NinePatch> expected =
+        NinePatch::Create(image.rows, image.width, image.height, &expected_err);
+    std::unique_ptr<NinePatch> actual =
+        BuildNinePatch(image.rows, image.width, image.height,
+                       NinePatchOptions(), &actual_err);
+    EXPECT_EQ(expected_err, actual_err);
+    ASSERT_EQ(expected == nullptr, actual == nullptr);
+    if (expected != nullptr) {
+      ExpectSameNinePatch(*expected, *actual);
+    }
+  }
+
+  for (uint32_t seed = 600; seed < 620; seed++) {
+    TestImage image = MakeRandomNinePatch(seed, 30 + seed % 17, 25 + seed % 23);
+
+    // Clear some content rows at the top and bottom, so the outline does not
+    // span the whole height.
+    std::mt19937 rng(seed);
+    const int32_t clear_top = rng() % (image.height / 2);
+    const int32_t clear_bottom = rng() % (image.height / 2);
+    for (int32_t y = 1; y < image.height - 1; y++) {
+      if (y <= clear_top || y >= image.height - 1 - clear_bottom) {
+        memset(image.rows[y] + 4, 0, (image.width - 2) * 4);
+      }
+    }
+
+    std::string err;
+    std::unique_ptr<NinePatch> expected =
+        NinePatch::Create(image.rows.data(), image.width, image.height, &err);
+    ASSERT_NE(nullptr, expected) << "seed " << seed << ": " << err;
+    std::unique_ptr<NinePatch> actual =
+        BuildNinePatch(image.rows.data(), image.width, image.height,
+                       NinePatchOptions(), &err);
+    ASSERT_NE(nullptr, actual) << "seed " << seed << ": " << err;
+    ExpectSameNinePatch(*expected, *actual);
+  }
+}
+
+TEST(NinePatchTest, BuilderRequiresAllRows) {
+  NinePatchBuilder builder(7, 6);
+  std::string err;
+  ASSERT_TRUE(builder.AddRow(kSingleStretch7x6[0], &err));
+  ASSERT_TRUE(builder.AddRow(kSingleStretch7x6[1], &err));
+  EXPECT_EQ(nullptr, builder.Finish(&err));
+  EXPECT_FALSE(err.empty());
+}
+
+TEST(NinePatchTest, BuilderWithNoRowsFailsLikeCreate) {
+  for (int32_t height : {0, -1}) {
+    NinePatchBuilder builder(7, height);
+    std::string err;
+    EXPECT_EQ(nullptr, builder.Finish(&err));
+    std::string create_err;
+    EXPECT_EQ(nullptr, NinePatch::Create(kSingleStretch7x6, 7, height,
+                                         &create_err));
+    EXPECT_EQ(create_err, err);
+  }
+}
+
+TEST(NinePatchTest, AnalyzeRunsOutOfCallerArena) {
+  NinePatch nine_patch;
+  std::vector<uint8_t> arena(64 * 1024);
+  for (bool single_pass : {false, true}) {
+    for (uint32_t seed = 700; seed < 710; seed++) {
+      TestImage image = MakeRandomNinePatch(seed, 60, 50);
+      std::string err;
+      std::unique_ptr<NinePatch> expected = NinePatch::Create(
+          image.rows.data(), image.width, image.height, &err);
+      ASSERT_NE(nullptr, expected) << err;
+
+      // Running out of the arena throws rather than falling back to the heap.
+      std::pmr::monotonic_buffer_resource resource(
+          arena.data(), arena.size(), std::pmr::null_memory_resource());
+      NinePatchOptions options;
+      options.single_pass = single_pass;
+      options.memory_resource = &resource;
+      size_t bytes_used = 0;
+      ASSERT_TRUE(NinePatch::Analyze(image.rows.data(), image.width,
+                                     image.height, options, &nine_patch,
+                                     &bytes_used, &err))
+          << err;
+      ExpectSameNinePatch(*expected, nine_patch);
+      EXPECT_GT(bytes_used, 0u);
+      EXPECT_LT(bytes_used, arena.size());
+    }
+  }
+
+  // Once the vectors have grown, analyzing the same image again reuses them.
+  TestImage image = MakeRandomNinePatch(700, 60, 50);
+  std::string err;
+  ASSERT_TRUE(NinePatch::Analyze(image.rows.data(), image.width, image.height,
+                                 NinePatchOptions(), &nine_patch, nullptr,
+                                 &err));
+  const uint32_t* region_colors = nine_patch.region_colors.data();
+  const Range* stretch_regions = nine_patch.horizontal_stretch_regions.data();
+  ASSERT_TRUE(NinePatch::Analyze(image.rows.data(), image.width, image.height,
+                                 NinePatchOptions(), &nine_patch, nullptr,
+                                 &err));
+  EXPECT_EQ(region_colors, nine_patch.region_colors.data());
+  EXPECT_EQ(stretch_regions, nine_patch.horizontal_stretch_regions.data());
+}
+
+TEST(NinePatchTest, UpdateMatchesCreate) {
+  const char* palette[] = {RED, BLUE, GREEN, GR_50, TRANS, BLACK, WHITE};
+  for (uint32_t seed = 1100; seed < 1160; seed++) {
+    TestImage image = MakeRandomNinePatch(seed, 30 + seed % 20, 25 + seed % 15);
+    std::mt19937 rng(seed);
+    NinePatchOptions options;
+    options.tight_outline = seed % 4 == 0;
+    options.region_opacity = seed % 2 == 0;
+    std::string err;
+    std::unique_ptr<NinePatch> prev = NinePatch::Create(
+        image.rows.data(), image.width, image.height, options, &err);
+    ASSERT_NE(nullptr, prev) << "seed " << seed << ": " << err;
+
+    // Mostly small strokes inside the content. Some reach the borders.
+    const int32_t margin = seed % 3 == 0 ? 0 : 1;
+    const int32_t left = margin + rng() % (image.width - 2 * margin - 1);
+    const int32_t top = margin + rng() % (image.height - 2 * margin - 1);
+    const Rect dirty(left, top,
+                     std::min(left + 1 + (int32_t)(rng() % 8), image.width),
+                     std::min(top + 1 + (int32_t)(rng() % 8), image.height));
+    const char* color = palette[rng() % 7];
+    for (int32_t y = dirty.top; y < dirty.bottom; y++) {
+      for (int32_t x = dirty.left; x < dirty.right; x++) {
+        memcpy(image.rows[y] + x * 4, color, 4);
+      }
+    }
+
+    std::string expected_err;
+    std::unique_ptr<NinePatch> expected = NinePatch::Create(
+        image.rows.data(), image.width, image.height, options, &expected_err);
+    std::unique_ptr<NinePatch> actual = NinePatch::Update(
+        *prev, image.rows.data(), image.width, image.height, dirty, options,
+        &err);
+    ASSERT_EQ(expected != nullptr, actual != nullptr)
+        << "seed " << seed << ": " << expected_err;
+    if (expected != nullptr) {
+      ExpectSameNinePatch(*expected, *actual);
+    } else {
+      EXPECT_EQ(expected_err, err) << "seed " << seed;
+    }
+  }
+}
+
+TEST(NinePatchTest, UpdateRecomputesOutline) {
+  // Strokes on the center row and column and on the diagonal of the outline,
+  // then one that misses all the lines the outline is sampled from.
+  const Rect strokes[] = {Rect(2, 5, 3, 6), Rect(6, 8, 7, 9), Rect(7, 6, 8, 7),
+                          Rect(2, 2, 3, 3)};
+  for (const Rect& stroke : strokes) {
+    std::vector<std::vector<uint8_t>> pixels;
+    std::vector<uint8_t*> rows;
+    for (int32_t y = 0; y < 10; y++) {
+      pixels.emplace_back(kOutlineOffsetTranslucent12x10[y],
+                          kOutlineOffsetTranslucent12x10[y] + 12 * 4);
+    }
+    for (std::vector<uint8_t>& row : pixels) {
+      rows.push_back(row.data());
+    }
+
+    std::string err;
+    std::unique_ptr<NinePatch> prev =
+        NinePatch::Create(rows.data(), 12, 10, &err);
+    ASSERT_NE(nullptr, prev) << err;
+    memcpy(rows[stroke.top] + stroke.left * 4, GREEN, 4);
+
+    std::unique_ptr<NinePatch> expected =
+        NinePatch::Create(rows.data(), 12, 10, &err);
+    ASSERT_NE(nullptr, expected) << err;
+    std::unique_ptr<NinePatch> actual =
+        NinePatch::Update(*prev, rows.data(), 12, 10, stroke, &err);
+    ASSERT_NE(nullptr, actual) << err;
+    ExpectSameNinePatch(*expected, *actual);
+  }
+}
+
+TEST(NinePatchTest, UpdateWithEmptyRectCopies) {
+  TestImage image = MakeRandomNinePatch(1170, 30, 30);
+  std::string err;
+  std::unique_ptr<NinePatch> prev =
+      NinePatch::Create(image.rows.data(), image.width, image.height, &err);
+  ASSERT_NE(nullptr, prev) << err;
+  std::unique_ptr<NinePatch> actual =
+      NinePatch::Update(*prev, image.rows.data(), image.width, image.height,
+                        Rect(40, 5, 50, 10), &err);
+  ASSERT_NE(nullptr, actual) << err;
+  ExpectSameNinePatch(*prev, *actual);
+}
+
+TEST(NinePatchTest, ValidateReportsStructuredErrors) {
+  NinePatchStatus status = NinePatch::Validate(kSingleStretch7x6, 7, 6);
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ("", status.Message());
+
+  status = NinePatch::Validate(k2x2, 2, 2);
+  EXPECT_EQ(NinePatchErrorCode::kImageTooSmall, status.code);
+
+  status = NinePatch::Validate(kLeftBorderOpticalBounds3x3, 3, 3);
+  EXPECT_EQ(NinePatchErrorCode::kUnexpectedOpticalBounds, status.code);
+  EXPECT_EQ(NinePatchEdge::kLeft, status.edge);
+  EXPECT_EQ(1, status.position);
+
+  status = NinePatch::Validate(kLayoutBoundsNotEdgeAligned5x5, 5, 5);
+  EXPECT_EQ(NinePatchErrorCode::kLayoutBoundsNotAtEdge, status.code);
+  EXPECT_EQ(NinePatchEdge::kBottom, status.edge);
+  EXPECT_EQ(2, status.position);
+  EXPECT_EQ("layout bounds on bottom border must start at edge",
+            status.Message());
+}
+
+TEST(NinePatchTest, ValidateMatchesCreate) {
+  struct {
+    uint8_t** rows;
+    int32_t width;
+    int32_t height;
+  } images[] = {
+      {k2x2, 2, 2},
+      {kMixedNeutralColor3x3, 3, 3},
+      {kTransparentNeutralColor3x3, 3, 3},
+      {kSingleStretch7x6, 7, 6},
+      {kMultipleStretch10x7, 10, 7},
+      {kPadding6x5, 6, 5},
+      {kLayoutBoundsWrongEdge3x3, 3, 3},
+      {kLeftBorderOpticalBounds3x3, 3, 3},
+      {kLayoutBoundsNotEdgeAligned5x5, 5, 5},
+      {kLayoutBounds5x5, 5, 5},
+      {kAsymmetricLayoutBounds5x5, 5, 5},
+      {kPaddingAndLayoutBounds5x5, 5, 5},
+      {kColorfulImage5x5, 5, 5},
+      {kOutlineRadius5x5, 5, 5},
+      {kStretchAndPadding5x5, 5, 5},
+  };
+
+  for (const auto& image : images) {
+    std::string err;
+    std::unique_ptr<NinePatch> nine_patch =
+        NinePatch::Create(image.rows, image.width, image.height, &err);
+    const NinePatchStatus status =
+        NinePatch::Validate(image.rows, image.width, image.height);
+    EXPECT_EQ(nine_patch != nullptr, status.ok());
+    EXPECT_EQ(err, status.Message());
+  }
+
+  for (uint32_t seed = 800; seed < 810; seed++) {
+    TestImage image = MakeRandomNinePatch(seed, 40, 30);
+    EXPECT_TRUE(
+        NinePatch::Validate(image.rows.data(), image.width, image.height).ok());
+
+    // An invalid color on the right border.
+    memcpy(image.rows[7] + (image.width - 1) * 4, BLUE, 4);
+    const NinePatchStatus status =
+        NinePatch::Validate(image.rows.data(), image.width, image.height);
+    EXPECT_EQ(NinePatchErrorCode::kInvalidColor, status.code);
+    EXPECT_EQ(NinePatchEdge::kRight, status.edge);
+    EXPECT_EQ(7, status.position);
+  }
+}
+
+TEST(NinePatchTest, RegionColorsMatchAcrossSimdLevels) {
+  for (uint32_t seed = 100; seed < 110; seed++) {
+    TestImage image = MakeRandomNinePatch(seed, 90 + seed, 30);
+    std::string err;
+    simd::SetActiveLevel(simd::Level::kScalar);
+    std::unique_ptr<NinePatch> expected =
+        NinePatch::Create(image.rows.data(), image.width, image.height, &err);
+    ASSERT_NE(nullptr, expected) << "seed " << seed << ": " << err;
+
+    for (int level = 1; level <= static_cast<int>(simd::DetectLevel());
+         level++) {
+      simd::SetActiveLevel(static_cast<simd::Level>(level));
+      std::unique_ptr<NinePatch> actual = NinePatch::Create(
+          image.rows.data(), image.width, image.height, &err);
+      ASSERT_NE(nullptr, actual) << "seed " << seed << ": " << err;
+      EXPECT_EQ(expected->region_colors, actual->region_colors)
+          << "seed " << seed << " level " << level;
+    }
+  }
+  simd::SetActiveLevel(simd::DetectLevel());
+}
+
+TEST(NinePatchTest, TightOutlineIsBoundingBoxOfMaxAlpha) {
+  for (uint32_t seed = 900; seed < 920; seed++) {
+    TestImage image = MakeRandomNinePatch(seed, 40 + seed % 50, 35);
+    // Translucent content so that the largest alpha varies between images.
+    std::mt19937 rng(seed);
+    const uint8_t alpha_limit = 1 + rng() % 255;
+    for (int32_t y = 1; y < image.height - 1; y++) {
+      for (int32_t x = 1; x < image.width - 1; x++) {
+        uint8_t* alpha = image.rows[y] + x * 4 + 3;
+        *alpha = std::min(*alpha, alpha_limit);
+      }
+    }
+
+    uint32_t max_alpha = 0;
+    int32_t left = 0, top = 0, right = 0, bottom = 0;
+    for (int32_t y = 1; y < image.height - 1; y++) {
+      for (int32_t x = 1; x < image.width - 1; x++) {
+        const uint32_t alpha = image.rows[y][x * 4 + 3];
+        if (alpha > max_alpha) {
+          max_alpha = alpha;
+          left = right = x;
+          top = bottom = y;
+        } else if (alpha == max_alpha && alpha != 0) {
+          left = std::min(left, x);
+          right = std::max(right, x);
+          bottom = y;
+        }
+      }
+    }
+    const Bounds expected =
+        max_alpha == 0 ? Bounds()
+                       : Bounds(left - 1, top - 1, image.width - 2 - right,
+                                image.height - 2 - bottom);
+
+    for (int level = 0; level <= static_cast<int>(simd::DetectLevel());
+         level++) {
+      simd::SetActiveLevel(static_cast<simd::Level>(level));
+      for (bool single_pass : {false, true}) {
+        NinePatchOptions options;
+        options.tight_outline = true;
+        options.single_pass = single_pass;
+        std::string err;
+        std::unique_ptr<NinePatch> nine_patch = NinePatch::Create(
+            image.rows.data(), image.width, image.height, options, &err);
+        ASSERT_NE(nullptr, nine_patch) << "seed " << seed << ": " << err;
+        EXPECT_EQ(expected, nine_patch->outline)
+            << "seed " << seed << " level " << level;
+        EXPECT_EQ(max_alpha, nine_patch->outline_alpha) << "seed " << seed;
+      }
+    }
+  }
+  simd::SetActiveLevel(simd::DetectLevel());
+}
+
+// Reference implementation of the region colors: tests every pixel of one
+// region at a time.
+static std::vector<uint32_t> PerRegionColors(const TestImage& image,
+                                             const NinePatch& nine_patch) {
+  auto split = [](const std::vector<Range>& stretch_regions, int32_t length) {
+    std::vector<int32_t> bounds = {0};
+    for (const Range& range : stretch_regions) {
+      if (range.start != bounds.back()) bounds.push_back(range.start);
+      bounds.push_back(range.end);
+    }
+    if (bounds.back() != length) bounds.push_back(length);
+    return bounds;
+  };
+  const std::vector<int32_t> xs =
+      split(nine_patch.horizontal_stretch_regions, image.width - 2);
+  const std::vector<int32_t> ys =
+      split(nine_patch.vertical_stretch_regions, image.height - 2);
+
+  std::vector<uint32_t> colors;
+  for (size_t j = 0; j + 1 < ys.size(); j++) {
+    for (size_t i = 0; i + 1 < xs.size(); i++) {
+      const uint32_t expected =
+          NinePatch::PackRGBA(image.rows[ys[j] + 1] + (xs[i] + 1) * 4);
+      bool solid = true;
+      for (int32_t y = ys[j] + 1; y < ys[j + 1] + 1; y++) {
+        for (int32_t x = xs[i] + 1; x < xs[i + 1] + 1; x++) {
+          const uint32_t color = NinePatch::PackRGBA(image.rows[y] + x * 4);
+          if ((color >> 24) == 0 ? (expected >> 24) != 0 : color != expected) {
+            solid = false;
+          }
+        }
+      }
+      if (!solid) {
+        colors.push_back(android::Res_png_9patch::NO_COLOR);
+      } else if ((expected >> 24) == 0) {
+        colors.push_back(android::Res_png_9patch::TRANSPARENT_COLOR);
+      } else {
+        colors.push_back(expected);
+      }
+    }
+  }
+  return colors;
+}
+
+TEST(NinePatchTest, RowMajorRegionColorsMatchPerRegionScan) {
+  for (uint32_t seed = 200; seed < 220; seed++) {
+    TestImage image = MakeRandomNinePatch(seed, 40 + seed % 30, 60);
+    std::string err;
+    std::unique_ptr<NinePatch> nine_patch =
+        NinePatch::Create(image.rows.data(), image.width, image.height, &err);
+    ASSERT_NE(nullptr, nine_patch) << "seed " << seed << ": " << err;
+    EXPECT_EQ(PerRegionColors(image, *nine_patch), nine_patch->region_colors)
+        << "seed " << seed;
+  }
+}
+
+TEST(NinePatchTest, ParallelRegionColorsMatchSerial) {
+  for (uint32_t seed = 300; seed < 310; seed++) {
+    TestImage image = MakeRandomNinePatch(seed, 70, 50 + seed % 40);
+    std::string err;
+    std::unique_ptr<NinePatch> expected =
+        NinePatch::Create(image.rows.data(), image.width, image.height, &err);
+    ASSERT_NE(nullptr, expected) << "seed " << seed << ": " << err;
+
+    for (int32_t threads = 2; threads <= 7; threads++) {
+      NinePatchOptions options;
+      options.region_color_threads = threads;
+      options.parallel_min_pixels = 0;
+      std::unique_ptr<NinePatch> actual = NinePatch::Create(
+          image.rows.data(), image.width, image.height, options, &err);
+      ASSERT_NE(nullptr, actual) << "seed " << seed << ": " << err;
+      EXPECT_EQ(expected->region_colors, actual->region_colors)
+          << "seed " << seed << " threads " << threads;
+    }
+  }
+}
+
+// Reference implementation of the region opacities: tests the alpha of every
+// pixel of one region at a time.
+static std::vector<RegionOpacity> PerRegionOpacities(
+    const TestImage& image, const NinePatch& nine_patch) {
+  std::vector<int32_t> xs = {0};
+  for (const Range& range : nine_patch.horizontal_stretch_regions) {
+    if (range.start != xs.back()) xs.push_back(range.start);
+    xs.push_back(range.end);
+  }
+  if (xs.back() != image.width - 2) xs.push_back(image.width - 2);
+  std::vector<int32_t> ys = {0};
+  for (const Range& range : nine_patch.vertical_stretch_regions) {
+    if (range.start != ys.back()) ys.push_back(range.start);
+    ys.push_back(range.end);
+  }
+  if (ys.back() != image.height - 2) ys.push_back(image.height - 2);
+
+  std::vector<RegionOpacity> opacities;
+  for (size_t j = 0; j + 1 < ys.size(); j++) {
+    for (size_t i = 0; i + 1 < xs.size(); i++) {
+      bool opaque = true;
+      bool transparent = true;
+      for (int32_t y = ys[j] + 1; y < ys[j + 1] + 1; y++) {
+        for (int32_t x = xs[i] + 1; x < xs[i + 1] + 1; x++) {
+          const uint8_t alpha = image.rows[y][x * 4 + 3];
+          opaque = opaque && alpha == 0xff;
+          transparent = transparent && alpha == 0;
+        }
+      }
+      opacities.push_back(opaque        ? RegionOpacity::kOpaque
+                          : transparent ? RegionOpacity::kTransparent
+                                        : RegionOpacity::kTranslucent);
+    }
+  }
+  return opacities;
+}
+
+TEST(NinePatchTest, RegionOpacityMatchesPerRegionScan) {
+  for (uint32_t seed = 400; seed < 420; seed++) {
+    TestImage image = MakeRandomNinePatch(seed, 40 + seed % 30, 60);
+    std::string err;
+    std::unique_ptr<NinePatch> plain =
+        NinePatch::Create(image.rows.data(), image.width, image.height, &err);
+    ASSERT_NE(nullptr, plain) << "seed " << seed << ": " << err;
+    EXPECT_TRUE(plain->region_opacities.empty());
+
+    NinePatchOptions options;
+    options.region_opacity = true;
+    std::unique_ptr<NinePatch> expected = NinePatch::Create(
+        image.rows.data(), image.width, image.height, options, &err);
+    ASSERT_NE(nullptr, expected) << "seed " << seed << ": " << err;
+    EXPECT_EQ(plain->region_colors, expected->region_colors);
+    EXPECT_EQ(PerRegionOpacities(image, *expected),
+              expected->region_opacities)
+        << "seed " << seed;
+
+    size_t len;
+    std::unique_ptr<uint8_t[]> data = expected->SerializeRegionOpacities(&len);
+    ASSERT_EQ(expected->region_colors.size(), len);
+    for (size_t r = 0; r < len; r++) {
+      EXPECT_EQ(static_cast<uint8_t>(expected->region_opacities[r]), data[r]);
+    }
+
+    NinePatchOptions parallel = options;
+    parallel.region_color_threads = 3;
+    parallel.parallel_min_pixels = 0;
+    NinePatchOptions single_pass = options;
+    single_pass.single_pass = true;
+    for (const NinePatchOptions& other : {parallel, single_pass}) {
+      std::unique_ptr<NinePatch> actual = NinePatch::Create(
+          image.rows.data(), image.width, image.height, other, &err);
+      ASSERT_NE(nullptr, actual) << "seed " << seed << ": " << err;
+      ExpectSameNinePatch(*expected, *actual);
+    }
+    std::unique_ptr<NinePatch> built = BuildNinePatch(
+        image.rows.data(), image.width, image.height, options, &err);
+    ASSERT_NE(nullptr, built) << "seed " << seed << ": " << err;
+    ExpectSameNinePatch(*expected, *built);
+  }
+}
+
+TEST(NinePatchTest, StridedSubRectangleMatchesRowTable) {
+  for (uint32_t seed = 400; seed < 405; seed++) {
+    TestImage image = MakeRandomNinePatch(seed, 33 + seed % 10, 27);
+
+    // Place the 9-patch at (5, 3) in a larger atlas filled with noise.
+    const int32_t x = 5;
+    const int32_t y = 3;
+    const size_t stride = (image.width + 11) * 4 + 8;
+    std::vector<uint8_t> atlas(stride * (image.height + 7));
+    std::mt19937 rng(seed);
+    for (uint8_t& byte : atlas) {
+      byte = static_cast<uint8_t>(rng());
+    }
+    for (int32_t row = 0; row < image.height; row++) {
+      memcpy(atlas.data() + (y + row) * stride + x * 4, image.rows[row],
+             image.width * 4);
+    }
+
+    std::string err;
+    std::unique_ptr<NinePatch> expected =
+        NinePatch::Create(image.rows.data(), image.width, image.height, &err);
+    ASSERT_NE(nullptr, expected) << "seed " << seed << ": " << err;
+    std::unique_ptr<NinePatch> actual = NinePatch::Create(
+        atlas.data(), stride, x, y, image.width, image.height, &err);
+    ASSERT_NE(nullptr, actual) << "seed " << seed << ": " << err;
+    ExpectSameNinePatch(*expected, *actual);
+  }
+}
+
+// Converts every pixel of `image` with `convert`, which writes
+// `bytes_per_pixel` bytes for an RGBA_8888 pixel, and checks that analyzing the converted image
+// as `format` gives the same 9-patch as analyzing `image`.
+template <typename Convert>
+static void ExpectFormatMatchesRgba(TestImage& image, PixelFormat format,
+                                    int32_t bytes_per_pixel, Convert convert) {
+  std::vector<uint8_t> data(image.width * image.height * bytes_per_pixel);
+  std::vector<uint8_t*> rows;
+  for (int32_t y = 0; y < image.height; y++) {
+    rows.push_back(data.data() + y * image.width * bytes_per_pixel);
+    for (int32_t x = 0; x < image.width; x++) {
+      convert(image.rows[y] + x * 4, rows.back() + x * bytes_per_pixel);
+    }
+  }
+
+  std::string err;
+  std::unique_ptr<NinePatch> expected =
+      NinePatch::Create(image.rows.data(), image.width, image.height, &err);
+  ASSERT_NE(nullptr, expected) << err;
+
+  NinePatchOptions options;
+  options.pixel_format = format;
+  for (bool single_pass : {false, true}) {
+    options.single_pass = single_pass;
+    std::unique_ptr<NinePatch> actual = NinePatch::Create(
+        rows.data(), image.width, image.height, options, &err);
+    ASSERT_NE(nullptr, actual) << err;
+    ExpectSameNinePatch(*expected, *actual);
+
+    actual = NinePatch::Create(data.data(), image.width * bytes_per_pixel, 0,
+                               0, image.width, image.height, options, &err);
+    ASSERT_NE(nullptr, actual) << err;
+    ExpectSameNinePatch(*expected, *actual);
+  }
+}
+
+// Returns the total length of the stretch regions.
+static int32_t StretchLength(const std::vector<Range>& stretch_regions) {
+  int32_t length = 0;
+  for (const Range& range : stretch_regions) {
+    length += range.end - range.start;
+  }
+  return length;
+}
+
+// Maps each of the `dst_length` pixels of a line stretched from `length`
+// pixels to its source pixel, with nearest neighbor sampling. The stretchable
+// space is shared between the stretch regions in proportion to their lengths,
+// and must be a multiple of their total length.
+static std::vector<int32_t> MapStretchedLine(
+    const std::vector<Range>& stretch_regions, int32_t length,
+    int32_t dst_length) {
+  int32_t stretch_length = StretchLength(stretch_regions);
+  const int32_t stretch_space = dst_length - (length - stretch_length);
+  if (stretch_length == 0) {
+    stretch_length = 1;
+  }
+  EXPECT_EQ(0, stretch_space % stretch_length);
+
+  std::vector<int32_t> map;
+  int32_t src = 0;
+  for (const Range& range : stretch_regions) {
+    for (; src < range.start; src++) {
+      map.push_back(src);
+    }
+    const int32_t src_length = range.end - range.start;
+    const int32_t dst_region = stretch_space / stretch_length * src_length;
+    for (int32_t u = 0; u < dst_region; u++) {
+      map.push_back(range.start + (2 * u + 1) * src_length / (2 * dst_region));
+    }
+    src = range.end;
+  }
+  for (; src < length; src++) {
+    map.push_back(src);
+  }
+  return map;
+}
+
+// Renders the content of an RGBA_8888 9-patch stretched to `dst_width` x
+// `dst_height`, excluding the border.
+static std::vector<uint32_t> RenderStretched(uint8_t** rows, int32_t width,
+                                             int32_t height,
+                                             const NinePatch& nine_patch,
+                                             int32_t dst_width,
+                                             int32_t dst_height) {
+  const std::vector<int32_t> xs = MapStretchedLine(
+      nine_patch.horizontal_stretch_regions, width - 2, dst_width);
+  const std::vector<int32_t> ys = MapStretchedLine(
+      nine_patch.vertical_stretch_regions, height - 2, dst_height);
+
+  std::vector<uint32_t> pixels;
+  for (int32_t y : ys) {
+    for (int32_t x : xs) {
+      pixels.push_back(NinePatch::PackRGBA(rows[1 + y] + (1 + x) * 4));
+    }
+  }
+  return pixels;
+}
+
+// Expects `minimized` to render the same as `source` at a few sizes, whose
+// stretchable space is a multiple of the stretch regions of `source`.
+static void ExpectSameRendering(uint8_t** rows, int32_t width, int32_t height,
+                                const NinePatch& source, const Image& image,
+                                const NinePatch& minimized) {
+  const int32_t h_stretch = StretchLength(source.horizontal_stretch_regions);
+  const int32_t v_stretch = StretchLength(source.vertical_stretch_regions);
+  for (int32_t scale = 1; scale <= 3; scale++) {
+    const int32_t dst_width = width - 2 + (scale - 1) * h_stretch;
+    const int32_t dst_height = height - 2 + (scale - 1) * v_stretch;
+    EXPECT_EQ(RenderStretched(rows, width, height, source, dst_width,
+                              dst_height),
+              RenderStretched(image.rows.get(), image.width, image.height,
+                              minimized, dst_width, dst_height))
+        << "scale " << scale;
+  }
+}
+
+TEST(NinePatchMinimizerTest, CollapsesRepeatedLines) {
+  // Content columns: 2 fixed, a stretch region of two runs of 4, 1 fixed, a
+  // stretch region of two runs of 2, 2 fixed. Content rows: 1 fixed, a stretch
+  // region of 6 identical rows, 2 fixed.
+  const int32_t col_classes[] = {0, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 5, 5, 6, 6,
+                                 7, 8};
+  const int32_t row_classes[] = {0, 1, 1, 1, 1, 1, 1, 2, 3};
+  const int32_t width = 19;
+  const int32_t height = 11;
+  std::vector<uint8_t> data(width * height * 4, 0);
+  std::vector<uint8_t*> rows;
+  for (int32_t y = 0; y < height; y++) {
+    rows.push_back(data.data() + y * width * 4);
+  }
+  auto set = [&](int32_t x, int32_t y, const char* pixel) {
+    memcpy(rows[y] + x * 4, pixel, 4);
+  };
+  for (int32_t y = 1; y < height - 1; y++) {
+    for (int32_t x = 1; x < width - 1; x++) {
+      const uint8_t pixel[] = {(uint8_t)(col_classes[x - 1] * 20),
+                               (uint8_t)(row_classes[y - 1] * 40), 0x80,
+                               0xff};
+      memcpy(rows[y] + x * 4, pixel, 4);
+    }
+  }
+  for (int32_t x = 3; x < 11; x++) set(x, 0, BLACK);
+  for (int32_t x = 12; x < 16; x++) set(x, 0, BLACK);
+  for (int32_t y = 2; y < 8; y++) set(0, y, BLACK);
+  // Padding of 3 and 4 columns, 2 and 2 rows, and a top layout bound of 1.
+  for (int32_t x = 4; x < 14; x++) set(x, height - 1, BLACK);
+  set(width - 1, 1, RED);
+  for (int32_t y = 3; y < 8; y++) set(width - 1, y, BLACK);
+
+  std::string err;
+  std::unique_ptr<NinePatch> source =
+      NinePatch::Create(rows.data(), width, height, &err);
+  ASSERT_NE(nullptr, source) << err;
+
+  Image image;
+  std::unique_ptr<NinePatch> minimized = MinimizeNinePatch(
+      rows.data(), width, height, NinePatchOptions(), &image, &err);
+  ASSERT_NE(nullptr, minimized) << err;
+
+  // The columns are halved. Dividing the rows by 6 would leave no room for
+  // the padding, so they are divided by 3 instead.
+  EXPECT_EQ(13, image.width);
+  EXPECT_EQ(7, image.height);
+  EXPECT_EQ((std::vector<Range>{Range(2, 6), Range(7, 9)}),
+            minimized->horizontal_stretch_regions);
+  EXPECT_EQ(std::vector<Range>{Range(1, 3)},
+            minimized->vertical_stretch_regions);
+  EXPECT_EQ(source->padding, minimized->padding);
+  EXPECT_EQ(source->layout_bounds, minimized->layout_bounds);
+  EXPECT_EQ(source->region_colors, minimized->region_colors);
+  ExpectSameRendering(rows.data(), width, height, *source, image, *minimized);
+}
+
+TEST(NinePatchMinimizerTest, RandomImagesRenderTheSame) {
+  for (uint32_t seed = 1200; seed < 1230; seed++) {
+    TestImage image = MakeRandomNinePatch(seed, 30 + seed % 20, 20 + seed % 9);
+    std::string err;
+    std::unique_ptr<NinePatch> source = NinePatch::Create(
+        image.rows.data(), image.width, image.height, &err);
+    ASSERT_NE(nullptr, source) << "seed " << seed << ": " << err;
+
+    Image minimized_image;
+    std::unique_ptr<NinePatch> minimized =
+        MinimizeNinePatch(image.rows.data(), image.width, image.height,
+                          NinePatchOptions(), &minimized_image, &err);
+    ASSERT_NE(nullptr, minimized) << "seed " << seed << ": " << err;
+    EXPECT_LE(minimized_image.width, image.width);
+    EXPECT_LE(minimized_image.height, image.height);
+    EXPECT_EQ(source->padding, minimized->padding) << "seed " << seed;
+    EXPECT_EQ(source->layout_bounds, minimized->layout_bounds)
+        << "seed " << seed;
+    EXPECT_EQ(source->region_colors, minimized->region_colors)
+        << "seed " << seed;
+    ExpectSameRendering(image.rows.data(), image.width, image.height, *source,
+                        minimized_image, *minimized);
+  }
+}
+
+// Makes a 22x12 9-patch with red, blue and green column bands, of which the
+// blue one stretches, and 4px of horizontal and 2px of vertical padding.
+static TestImage MakeBandedNinePatch() {
+  TestImage image;
+  image.width = 22;
+  image.height = 12;
+  image.data.resize(image.width * image.height * 4);
+  for (int32_t y = 0; y < image.height; y++) {
+    image.rows.push_back(image.data.data() + y * image.width * 4);
+  }
+  auto set = [&](int32_t x, int32_t y, const char* pixel) {
+    memcpy(image.rows[y] + x * 4, pixel, 4);
+  };
+
+  for (int32_t x = 1; x <= 20; x++) {
+    const char* border = x >= 5 && x <= 16 ? BLACK : TRANS;
+    set(x, 0, border);
+    set(x, 11, border);
+    for (int32_t y = 1; y <= 10; y++) {
+      set(x, y, x <= 4 ? RED : (x <= 16 ? BLUE : GREEN));
+    }
+  }
+  for (int32_t y = 1; y <= 10; y++) {
+    const char* border = y >= 3 && y <= 8 ? BLACK : TRANS;
+    set(0, y, border);
+    set(21, y, border);
+  }
+  return image;
+}
+
+TEST(NinePatchRescalerTest, ScalesSegmentsAndKeepsColors) {
+  TestImage image = MakeBandedNinePatch();
+  std::string err;
+  std::unique_ptr<NinePatch> source =
+      NinePatch::Create(image.rows.data(), image.width, image.height, &err);
+  ASSERT_NE(nullptr, source) << err;
+
+  Image half_image;
+  std::unique_ptr<NinePatch> half =
+      RescaleNinePatch(image.rows.data(), image.width, image.height, *source,
+                       0.5f, &half_image, &err);
+  ASSERT_NE(nullptr, half) << err;
+  EXPECT_EQ(12, half_image.width);
+  EXPECT_EQ(7, half_image.height);
+  EXPECT_EQ(std::vector<Range>{Range(2, 8)}, half->horizontal_stretch_regions);
+  EXPECT_EQ(std::vector<Range>{Range(1, 4)}, half->vertical_stretch_regions);
+  EXPECT_EQ(Bounds(2, 1, 2, 1), half->padding);
+  EXPECT_EQ(source->region_colors, half->region_colors);
+
+  Image larger_image;
+  std::unique_ptr<NinePatch> larger =
+      RescaleNinePatch(image.rows.data(), image.width, image.height, *source,
+                       1.5f, &larger_image, &err);
+  ASSERT_NE(nullptr, larger) << err;
+  EXPECT_EQ(32, larger_image.width);
+  EXPECT_EQ(17, larger_image.height);
+  EXPECT_EQ(std::vector<Range>{Range(6, 24)},
+            larger->horizontal_stretch_regions);
+  EXPECT_EQ(Bounds(6, 3, 6, 3), larger->padding);
+  EXPECT_EQ(source->region_colors, larger->region_colors);
+
+  EXPECT_EQ(nullptr, RescaleNinePatch(image.rows.data(), image.width,
+                                      image.height, *source, 0.0f,
+                                      &larger_image, &err));
+}
+
+TEST(NinePatchRescalerTest, RandomImages) {
+  for (uint32_t seed = 1300; seed < 1320; seed++) {
+    TestImage image = MakeRandomNinePatch(seed, 40 + seed % 30, 30 + seed % 11);
+    std::string err;
+    std::unique_ptr<NinePatch> source = NinePatch::Create(
+        image.rows.data(), image.width, image.height, &err);
+    ASSERT_NE(nullptr, source) << "seed " << seed << ": " << err;
+
+    // Scaling by 1 keeps every pixel.
+    Image same_image;
+    std::unique_ptr<NinePatch> same =
+        RescaleNinePatch(image.rows.data(), image.width, image.height, *source,
+                         1.0f, &same_image, &err);
+    ASSERT_NE(nullptr, same) << "seed " << seed << ": " << err;
+    ASSERT_EQ(image.width, same_image.width);
+    ASSERT_EQ(image.height, same_image.height);
+    EXPECT_EQ(0, memcmp(image.data.data(), same_image.data.get(),
+                        image.data.size()))
+        << "seed " << seed;
+    ExpectSameNinePatch(*source, *same);
+
+    // Solid regions keep their color at other scales.
+    for (float scale : {0.5f, 0.75f, 1.5f}) {
+      Image scaled_image;
+      std::unique_ptr<NinePatch> scaled =
+          RescaleNinePatch(image.rows.data(), image.width, image.height,
+                           *source, scale, &scaled_image, &err);
+      ASSERT_NE(nullptr, scaled) << "seed " << seed << ": " << err;
+      ASSERT_EQ(source->region_colors.size(), scaled->region_colors.size());
+      for (size_t i = 0; i < source->region_colors.size(); i++) {
+        if (source->region_colors[i] != android::Res_png_9patch::NO_COLOR) {
+          EXPECT_EQ(source->region_colors[i], scaled->region_colors[i])
+              << "seed " << seed << " scale " << scale << " region " << i;
+        }
+      }
+    }
+  }
+}
+
+TEST(NinePatchRescalerTest, TapsStayWithinSegments) {
+  // A 2px stretch column and a red 25px fixed column, which a scale of 0.44
+  // maps to 1px and 11px. 11 * (25.0 / 11) rounds to above 25 in double
+  // precision, so the last target pixel must not be given a source pixel past
+  // the end of the row.
+  std::vector<std::vector<uint8_t>> pixels(5, std::vector<uint8_t>(29 * 4));
+  std::vector<uint8_t*> rows;
+  for (int32_t y = 0; y < 5; y++) {
+    for (int32_t x = 0; x < 29; x++) {
+      const char* pixel;
+      if (y == 0 || y == 4 || x == 0 || x == 28) {
+        const bool stretch =
+            (y == 0 && x >= 1 && x <= 2) || (x == 0 && y == 1);
+        pixel = stretch ? BLACK : TRANS;
+      } else {
+        pixel = x <= 2 ? BLUE : RED;
+      }
+      memcpy(pixels[y].data() + x * 4, pixel, 4);
+    }
+    rows.push_back(pixels[y].data());
+  }
+
+  std::string err;
+  std::unique_ptr<NinePatch> source =
+      NinePatch::Create(rows.data(), 29, 5, &err);
+  ASSERT_NE(nullptr, source) << err;
+
+  Image scaled_image;
+  std::unique_ptr<NinePatch> scaled = RescaleNinePatch(
+      rows.data(), 29, 5, *source, 0.44f, &scaled_image, &err);
+  ASSERT_NE(nullptr, scaled) << err;
+  EXPECT_EQ(14, scaled_image.width);
+  EXPECT_EQ(source->region_colors, scaled->region_colors);
+}
+
+// Returns the Res_png_9patch chunk of `nine_patch`, deserialized in device
+// byte order.
+static std::unique_ptr<uint8_t[]> MakeDeviceChunk(const NinePatch& nine_patch) {
+  size_t len;
+  std::unique_ptr<uint8_t[]> data = nine_patch.SerializeBase(&len);
+  android::Res_png_9patch::deserialize(data.get())->fileToDevice();
+  return data;
+}
+
+// Renders `rows`, without the border, onto a transparent `dst_width` x
+// `dst_height` image, and returns its packed pixels.
+static std::vector<uint32_t> RenderToPixels(const NinePatchRenderer& renderer,
+                                            uint8_t** rows, int32_t dst_width,
+                                            int32_t dst_height) {
+  std::vector<uint8_t> data(dst_width * dst_height * 4, 0);
+  std::vector<uint8_t*> dst_rows;
+  for (int32_t y = 0; y < dst_height; y++) {
+    dst_rows.push_back(data.data() + y * dst_width * 4);
+  }
+  renderer.Render(rows, dst_width, dst_height, dst_rows.data());
+
+  std::vector<uint32_t> pixels;
+  for (int32_t i = 0; i < dst_width * dst_height; i++) {
+    pixels.push_back(NinePatch::PackRGBA(data.data() + i * 4));
+  }
+  return pixels;
+}
+
+TEST(NinePatchRendererTest, MatchesNearestNeighborStretch) {
+  for (uint32_t seed = 1400; seed < 1410; seed++) {
+    TestImage image = MakeRandomNinePatch(seed, 40 + seed % 30, 30 + seed % 11);
+    std::string err;
+    std::unique_ptr<NinePatch> nine_patch = NinePatch::Create(
+        image.rows.data(), image.width, image.height, &err);
+    ASSERT_NE(nullptr, nine_patch) << "seed " << seed << ": " << err;
+
+    std::unique_ptr<uint8_t[]> chunk = MakeDeviceChunk(*nine_patch);
+    std::unique_ptr<NinePatchRenderer> renderer = NinePatchRenderer::Create(
+        *reinterpret_cast<android::Res_png_9patch*>(chunk.get()),
+        image.width - 2, image.height - 2, &err);
+    ASSERT_NE(nullptr, renderer) << "seed " << seed << ": " << err;
+
+    std::vector<uint8_t*> content;
+    for (int32_t y = 1; y < image.height - 1; y++) {
+      content.push_back(image.rows[y] + 4);
+    }
+    const int32_t h_stretch =
+        StretchLength(nine_patch->horizontal_stretch_regions);
+    const int32_t v_stretch =
+        StretchLength(nine_patch->vertical_stretch_regions);
+    for (int level = 0; level <= static_cast<int>(simd::DetectLevel());
+         level++) {
+      simd::SetActiveLevel(static_cast<simd::Level>(level));
+      for (int32_t scale = 1; scale <= 3; scale++) {
+        const int32_t dst_width = image.width - 2 + (scale - 1) * h_stretch;
+        const int32_t dst_height = image.height - 2 + (scale - 1) * v_stretch;
+        EXPECT_EQ(RenderStretched(image.rows.data(), image.width,
+                                  image.height, *nine_patch, dst_width,
+                                  dst_height),
+                  RenderToPixels(*renderer, content.data(), dst_width,
+                                 dst_height))
+            << "seed " << seed << " level " << level << " scale " << scale;
+      }
+    }
+  }
+  simd::SetActiveLevel(simd::DetectLevel());
+}
+
+TEST(NinePatchRendererTest, UsesColorHints) {
+  // One row: a transparent fixed column, a sampled stretch column, and a fixed
+  // column hinted as black whose source pixel is blue.
+  std::vector<uint8_t> data;
+  for (const char* pixel : {RED, WHITE, BLUE}) {
+    data.insert(data.end(), pixel, pixel + 4);
+  }
+  uint8_t* rows[] = {data.data()};
+
+  android::Res_png_9patch header;
+  header.numXDivs = 2;
+  header.numYDivs = 0;
+  header.numColors = 3;
+  const int32_t x_divs[] = {1, 2};
+  const uint32_t colors[] = {android::Res_png_9patch::TRANSPARENT_COLOR,
+                             android::Res_png_9patch::NO_COLOR, 0xff000000u};
+  std::vector<uint8_t> chunk(header.serializedSize());
+  android::Res_png_9patch::serialize(header, x_divs, nullptr, colors,
+                                     chunk.data());
+
+  std::string err;
+  std::unique_ptr<NinePatchRenderer> renderer = NinePatchRenderer::Create(
+      *reinterpret_cast<android::Res_png_9patch*>(chunk.data()), 3, 1, &err);
+  ASSERT_NE(nullptr, renderer) << err;
+
+  const uint32_t white = NinePatch::PackRGBA((const uint8_t*)WHITE);
+  EXPECT_EQ((std::vector<uint32_t>{0, white, white, white, 0xff000000u,
+                                   0, white, white, white, 0xff000000u}),
+            RenderToPixels(*renderer, rows, 5, 2));
+
+  // Without room for the fixed columns, they share the space and the stretch
+  // column is left out. Rounding half up gives the pixel to the first one.
+  EXPECT_EQ((std::vector<uint32_t>{0}), RenderToPixels(*renderer, rows, 1, 1));
+
+  EXPECT_EQ(nullptr, NinePatchRenderer::Create(
+                         *reinterpret_cast<android::Res_png_9patch*>(
+                             chunk.data()),
+                         1, 1, &err));
+}
+
+TEST(NinePatchMeshTest, LaysOutLattice) {
+  TestImage image = MakeBandedNinePatch();
+  std::string err;
+  std::unique_ptr<NinePatch> nine_patch =
+      NinePatch::Create(image.rows.data(), image.width, image.height, &err);
+  ASSERT_NE(nullptr, nine_patch) << err;
+  std::unique_ptr<uint8_t[]> chunk = MakeDeviceChunk(*nine_patch);
+
+  NinePatchMeshRequest request;
+  request.chunk = reinterpret_cast<android::Res_png_9patch*>(chunk.get());
+  request.width = 20;
+  request.height = 10;
+  request.dst.left = 10.0f;
+  request.dst.top = 20.0f;
+  request.dst.right = 50.0f;
+  request.dst.bottom = 50.0f;
+
+  int32_t vertex_capacity;
+  int32_t index_capacity;
+  GetNinePatchMeshCapacity(*request.chunk, &vertex_capacity, &index_capacity);
+  std::vector<float> x(vertex_capacity), y(vertex_capacity);
+  std::vector<float> u(vertex_capacity), v(vertex_capacity);
+  std::vector<uint32_t> indices(index_capacity);
+  NinePatchMeshBuffers buffers;
+  buffers.x = x.data();
+  buffers.y = y.data();
+  buffers.u = u.data();
+  buffers.v = v.data();
+  buffers.vertex_capacity = vertex_capacity;
+  buffers.indices = indices.data();
+  buffers.index_capacity = index_capacity;
+
+  NinePatchMeshRange range;
+  ASSERT_TRUE(BuildNinePatchMesh(request, &buffers, &range, &err)) << err;
+  ASSERT_EQ(16, range.vertex_count);
+  ASSERT_EQ(54, range.index_count);
+
+  // Columns: 4 fixed, 12 stretch, 4 fixed. Rows: 2 fixed, 6 stretch, 2 fixed.
+  const float xs[] = {10.0f, 14.0f, 46.0f, 50.0f};
+  const float us[] = {0.0f, 0.2f, 0.8f, 1.0f};
+  const float ys[] = {20.0f, 22.0f, 48.0f, 50.0f};
+  const float vs[] = {0.0f, 0.2f, 0.8f, 1.0f};
+  for (int32_t j = 0; j < 4; j++) {
+    for (int32_t i = 0; i < 4; i++) {
+      EXPECT_FLOAT_EQ(xs[i], x[j * 4 + i]);
+      EXPECT_FLOAT_EQ(us[i], u[j * 4 + i]);
+      EXPECT_FLOAT_EQ(ys[j], y[j * 4 + i]);
+      EXPECT_FLOAT_EQ(vs[j], v[j * 4 + i]);
+    }
+  }
+  EXPECT_EQ((std::vector<uint32_t>{0, 1, 4, 4, 1, 5}),
+            std::vector<uint32_t>(indices.begin(), indices.begin() + 6));
+}
+
+TEST(NinePatchMeshTest, BatchDropsTransparentAndEmptyPatches) {
+  // A black fixed column, a stretch column and a transparent fixed column.
+  android::Res_png_9patch header;
+  header.numXDivs = 2;
+  header.numYDivs = 0;
+  header.numColors = 3;
+  const int32_t x_divs[] = {1, 2};
+  const uint32_t colors[] = {0xff000000u, android::Res_png_9patch::NO_COLOR,
+                             android::Res_png_9patch::TRANSPARENT_COLOR};
+  std::vector<uint8_t> chunk(header.serializedSize());
+  android::Res_png_9patch::serialize(header, x_divs, nullptr, colors,
+                                     chunk.data());
+
+  NinePatchMeshRequest requests[2];
+  for (NinePatchMeshRequest& request : requests) {
+    request.chunk = reinterpret_cast<android::Res_png_9patch*>(chunk.data());
+    request.width = 3;
+    request.height = 1;
+    request.dst.bottom = 1.0f;
+  }
+  requests[0].dst.right = 10.0f;
+  // Too narrow for the fixed columns, which leaves out the stretch column.
+  // The black column gets the pixel, rounding half up.
+  requests[1].dst.right = 1.0f;
+
+  std::vector<float> x(16), y(16), u(16), v(16);
+  std::vector<uint32_t> indices(18);
+  NinePatchMeshBuffers buffers;
+  buffers.x = x.data();
+  buffers.y = y.data();
+  buffers.u = u.data();
+  buffers.v = v.data();
+  buffers.vertex_capacity = 16;
+  buffers.indices = indices.data();
+  buffers.index_capacity = 18;
+
+  NinePatchMeshRange ranges[2];
+  std::string err;
+  ASSERT_TRUE(BuildNinePatchMeshes(requests, 2, &buffers, ranges, &err))
+      << err;
+  EXPECT_EQ(0, ranges[0].first_vertex);
+  EXPECT_EQ(8, ranges[0].vertex_count);
+  EXPECT_EQ(12, ranges[0].index_count);
+  EXPECT_EQ(8, ranges[1].first_vertex);
+  EXPECT_EQ(12, ranges[1].first_index);
+  EXPECT_EQ(6, ranges[1].index_count);
+  EXPECT_EQ((std::vector<uint32_t>{0, 1, 4, 4, 1, 5, 1, 2, 5, 5, 2, 6,
+                                   8, 9, 12, 12, 9, 13}),
+            indices);
+  EXPECT_FLOAT_EQ(1.0f, x[9]);
+  EXPECT_FLOAT_EQ(1.0f, x[10]);
+
+  // No room for a third mesh.
+  NinePatchMeshRange range;
+  EXPECT_FALSE(BuildNinePatchMeshes(requests, 1, &buffers, &range, &err));
+  EXPECT_EQ(16, buffers.vertex_count);
+}
+
+// Returns the edges of the segments of an axis laid out over `dst_length`
+// pixels, rounding the running total of the shares with integer division.
+static std::vector<int32_t> ExpectedLayoutEdges(
+    const std::vector<Range>& stretch_regions, int32_t length,
+    int64_t dst_length) {
+  std::vector<std::pair<int32_t, bool>> segments;
+  int32_t next_start = 0;
+  for (const Range& range : stretch_regions) {
+    if (range.start != next_start) {
+      segments.emplace_back(range.start - next_start, false);
+    }
+    segments.emplace_back(range.end - range.start, true);
+    next_start = range.end;
+  }
+  if (next_start != length) {
+    segments.emplace_back(length - next_start, false);
+  }
+
+  const int64_t stretch_length = StretchLength(stretch_regions);
+  const int64_t fixed_length = length - stretch_length;
+  const bool stretches = stretch_length > 0 && dst_length >= fixed_length;
+  const int64_t space = stretches ? dst_length - fixed_length : dst_length;
+  const int64_t total = stretches ? stretch_length : fixed_length;
+  std::vector<int32_t> edges = {0};
+  int64_t fixed = 0;
+  int64_t shared = 0;
+  for (const auto& segment : segments) {
+    if (segment.second == stretches) {
+      shared += segment.first;
+    } else {
+      fixed += segment.first;
+    }
+    edges.push_back(static_cast<int32_t>(
+        (stretches ? fixed : 0) + (2 * space * shared + total) / (2 * total)));
+  }
+  return edges;
+}
+
+TEST(NinePatchLayoutTest, LaysOutPatchesAndBoxes) {
+  TestImage image = MakeBandedNinePatch();
+  std::string err;
+  std::unique_ptr<NinePatch> nine_patch =
+      NinePatch::Create(image.rows.data(), image.width, image.height, &err);
+  ASSERT_NE(nullptr, nine_patch) << err;
+  std::unique_ptr<uint8_t[]> chunk = MakeDeviceChunk(*nine_patch);
+  std::unique_ptr<NinePatchLayoutEngine> engine = NinePatchLayoutEngine::Create(
+      *reinterpret_cast<android::Res_png_9patch*>(chunk.get()), 20, 10,
+      Bounds(1, 0, 2, 3), &err);
+  ASSERT_NE(nullptr, engine) << err;
+
+  // Columns: 4 fixed, 12 stretch, 4 fixed. Rows: 2 fixed, 6 stretch, 2 fixed.
+  const int32_t widths[] = {25, 8, 6};
+  const int32_t heights[] = {13, 10, 3};
+  NinePatchLayouts layouts;
+  engine->Layout(widths, heights, 3, &layouts);
+  ASSERT_EQ(4, layouts.col_edge_count);
+  ASSERT_EQ(4, layouts.row_edge_count);
+  EXPECT_EQ(Rect(4, 2, 21, 11), layouts.GetPatchRect(0, 1, 1));
+  EXPECT_EQ(Rect(21, 11, 25, 13), layouts.GetPatchRect(0, 2, 2));
+  EXPECT_EQ(Rect(4, 2, 4, 8), layouts.GetPatchRect(1, 1, 1));
+  // Too small for the fixed segments, which share the space.
+  EXPECT_EQ(Rect(0, 0, 3, 2), layouts.GetPatchRect(2, 0, 0));
+  EXPECT_EQ(Rect(3, 2, 6, 3), layouts.GetPatchRect(2, 2, 2));
+
+  EXPECT_EQ(nine_patch->padding.left, layouts.content_left[0]);
+  EXPECT_EQ(25 - nine_patch->padding.right, layouts.content_right[0]);
+  EXPECT_EQ(13 - nine_patch->padding.bottom, layouts.content_bottom[0]);
+  EXPECT_EQ(1, layouts.optical_left[1]);
+  EXPECT_EQ(6, layouts.optical_right[1]);
+  EXPECT_EQ(7, layouts.optical_bottom[1]);
+}
+
+TEST(NinePatchLayoutTest, FixedPointMatchesIntegerDivision) {
+  std::mt19937 rng(2300);
+  for (uint32_t seed = 1500; seed < 1510; seed++) {
+    TestImage image = MakeRandomNinePatch(seed, 40 + seed % 30, 30 + seed % 11);
+    std::string err;
+    std::unique_ptr<NinePatch> nine_patch = NinePatch::Create(
+        image.rows.data(), image.width, image.height, &err);
+    ASSERT_NE(nullptr, nine_patch) << "seed " << seed << ": " << err;
+    std::unique_ptr<uint8_t[]> chunk = MakeDeviceChunk(*nine_patch);
+    std::unique_ptr<NinePatchLayoutEngine> engine =
+        NinePatchLayoutEngine::Create(
+            *reinterpret_cast<android::Res_png_9patch*>(chunk.get()),
+            image.width - 2, image.height - 2, Bounds(), &err);
+    ASSERT_NE(nullptr, engine) << "seed " << seed << ": " << err;
+
+    // The second batch is long enough to need the integer division fallback.
+    for (int32_t max_length : {4096, 1 << 30}) {
+      std::vector<int32_t> widths;
+      std::vector<int32_t> heights;
+      for (int32_t q = 0; q < 300; q++) {
+        widths.push_back(q < 100 ? q
+                                 : static_cast<int32_t>(rng() % max_length));
+        heights.push_back(static_cast<int32_t>(rng() % 4096));
+      }
+      NinePatchLayouts layouts;
+      engine->Layout(widths.data(), heights.data(), widths.size(), &layouts);
+      for (size_t q = 0; q < widths.size(); q++) {
+        const std::vector<int32_t> cols = ExpectedLayoutEdges(
+            nine_patch->horizontal_stretch_regions, image.width - 2,
+            widths[q]);
+        ASSERT_EQ(cols.size(), (size_t)layouts.col_edge_count);
+        for (size_t k = 0; k < cols.size(); k++) {
+          ASSERT_EQ(cols[k], layouts.col_edges[k * widths.size() + q])
+              << "seed " << seed << " width " << widths[q] << " edge " << k;
+        }
+        const std::vector<int32_t> rows = ExpectedLayoutEdges(
+            nine_patch->vertical_stretch_regions, image.height - 2,
+            heights[q]);
+        for (size_t k = 0; k < rows.size(); k++) {
+          ASSERT_EQ(rows[k], layouts.row_edges[k * widths.size() + q])
+              << "seed " << seed << " height " << heights[q] << " edge " << k;
+        }
+      }
+    }
+  }
+}
+
+// Serializes a chunk, in device byte order, whose `x_divs` and `y_divs`
+// split a 9-patch into patches of the given `colors`.
+static std::vector<uint8_t> MakeChunk(const std::vector<int32_t>& x_divs,
+                                      const std::vector<int32_t>& y_divs,
+                                      const std::vector<uint32_t>& colors) {
+  android::Res_png_9patch header;
+  header.numXDivs = static_cast<uint8_t>(x_divs.size());
+  header.numYDivs = static_cast<uint8_t>(y_divs.size());
+  header.numColors = static_cast<uint8_t>(colors.size());
+  std::vector<uint8_t> chunk(header.serializedSize());
+  android::Res_png_9patch::serialize(header, x_divs.data(), y_divs.data(),
+                                     colors.data(), chunk.data());
+  return chunk;
+}
+
+// Sets `value` in `mask`, `width` pixels wide and offset by (`left`, `top`),
+// over `rect`.
+static void FillMask(const Rect& rect, int32_t left, int32_t top,
+                     int32_t width, int32_t value, std::vector<int32_t>* mask) {
+  for (int32_t y = rect.top; y < rect.bottom; y++) {
+    for (int32_t x = rect.left; x < rect.right; x++) {
+      (*mask)[(y - top) * width + (x - left)] += value;
+    }
+  }
+}
+
+TEST(NinePatchRegionTest, TransparentRegionOfManyDivs) {
+  std::mt19937 rng(2400);
+  for (int32_t round = 0; round < 20; round++) {
+    // 8 stretch columns and 6 stretch rows, which can touch, for about as
+    // many patches as numColors can count.
+    std::vector<int32_t> x_divs;
+    for (int32_t i = 0; i < 16; i++) {
+      x_divs.push_back(i * 5 + static_cast<int32_t>(rng() % 2) * 2);
+    }
+    std::vector<int32_t> y_divs;
+    for (int32_t i = 0; i < 12; i++) {
+      y_divs.push_back(i * 5 +
+                       (i % 2 == 0 ? 0 : static_cast<int32_t>(rng() % 6)));
+    }
+    const int32_t width = 85;
+    const int32_t height = 65;
+
+    // Lay out the patches first, to know how many colors the chunk needs.
+    std::string err;
+    std::vector<uint8_t> chunk = MakeChunk(x_divs, y_divs, {});
+    std::unique_ptr<NinePatchLayoutEngine> engine =
+        NinePatchLayoutEngine::Create(
+            *reinterpret_cast<android::Res_png_9patch*>(chunk.data()), width,
+            height, Bounds(), &err);
+    ASSERT_NE(nullptr, engine) << err;
+
+    const Rect dst(static_cast<int32_t>(rng() % 50) - 25,
+                   static_cast<int32_t>(rng() % 50) - 25, 0, 0);
+    const int32_t dst_width = static_cast<int32_t>(rng() % 300);
+    const int32_t dst_height = static_cast<int32_t>(rng() % 200);
+    NinePatchLayouts layouts;
+    engine->Layout(&dst_width, &dst_height, 1, &layouts);
+    const int32_t cols = layouts.col_edge_count - 1;
+    const int32_t rows = layouts.row_edge_count - 1;
+    std::vector<uint32_t> colors;
+    for (int32_t k = 0; k < cols * rows; k++) {
+      colors.push_back(rng() % 5 < 2
+                           ? android::Res_png_9patch::TRANSPARENT_COLOR
+                           : android::Res_png_9patch::NO_COLOR);
+    }
+    chunk = MakeChunk(x_divs, y_divs, colors);
+    const Rect dst_rect(dst.left, dst.top, dst.left + dst_width,
+                        dst.top + dst_height);
+
+    std::vector<Rect> rects;
+    ASSERT_TRUE(GetNinePatchTransparentRegion(
+        *reinterpret_cast<android::Res_png_9patch*>(chunk.data()), width,
+        height, dst_rect, &rects, &err))
+        << err;
+
+    // The rectangles cover each transparent patch pixel exactly once.
+    std::vector<int32_t> expected(dst_width * dst_height, 0);
+    std::vector<int32_t> actual(dst_width * dst_height, 0);
+    for (int32_t j = 0; j < rows; j++) {
+      for (int32_t i = 0; i < cols; i++) {
+        if (colors[j * cols + i] ==
+            android::Res_png_9patch::TRANSPARENT_COLOR) {
+          FillMask(layouts.GetPatchRect(0, i, j), 0, 0, dst_width, 1,
+                   &expected);
+        }
+      }
+    }
+    for (const Rect& rect : rects) {
+      ASSERT_FALSE(rect.empty());
+      FillMask(rect, dst_rect.left, dst_rect.top, dst_width, 1, &actual);
+    }
+    EXPECT_EQ(expected, actual) << "round " << round;
+
+    // Bands are sorted and merged.
+    for (size_t k = 1; k < rects.size(); k++) {
+      const Rect& a = rects[k - 1];
+      const Rect& b = rects[k];
+      if (a.top == b.top) {
+        EXPECT_EQ(a.bottom, b.bottom);
+        EXPECT_LT(a.right, b.left) << "round " << round;
+      } else {
+        EXPECT_LE(a.bottom, b.top) << "round " << round;
+      }
+    }
+  }
+}
+
+TEST(NinePatchRegionTest, TransparentRegionThroughBindings) {
+  // A transparent ring around a sampled center, 1px fixed around a stretch
+  // column and row.
+  const uint32_t t = android::Res_png_9patch::TRANSPARENT_COLOR;
+  const uint32_t n = android::Res_png_9patch::NO_COLOR;
+  std::vector<uint8_t> chunk =
+      MakeChunk({1, 2}, {1, 2}, {t, t, t, t, n, t, t, t, t});
+
+  int32_t rects[4 * 4];
+  EXPECT_EQ(4, SkNinePatchGlue_getTransparentRegion(
+                   reinterpret_cast<int8_t*>(chunk.data()), 3, 3, 10, 20, 20,
+                   30, rects, 4));
+  EXPECT_EQ((std::vector<int32_t>{10, 20, 20, 21, 10, 21, 11, 29, 19, 21, 20,
+                                  29, 10, 29, 20, 30}),
+            std::vector<int32_t>(rects, rects + 16));
+
+  // The count is returned even if it does not fit.
+  EXPECT_EQ(4, SkNinePatchGlue_getTransparentRegion(
+                   reinterpret_cast<int8_t*>(chunk.data()), 3, 3, 10, 20, 20,
+                   30, rects, 1));
+  EXPECT_EQ(-1, SkNinePatchGlue_getTransparentRegion(
+                    reinterpret_cast<int8_t*>(chunk.data()), 1, 1, 0, 0, 5, 5,
+                    rects, 4));
+}
+
+TEST(NinePatchRegionTest, OpaqueRegionFromOpacities) {
+  // Opaque red corners and right column, a translucent top edge, a
+  // transparent left edge and a sampled center, 1px fixed around a stretch
+  // column and row.
+  const uint32_t r = 0xffff0000u;
+  const uint32_t g = 0x80ff0000u;
+  const uint32_t t = android::Res_png_9patch::TRANSPARENT_COLOR;
+  const uint32_t n = android::Res_png_9patch::NO_COLOR;
+  std::vector<uint8_t> chunk =
+      MakeChunk({1, 2}, {1, 2}, {r, g, r, t, n, r, r, n, r});
+  const android::Res_png_9patch& patch =
+      *reinterpret_cast<android::Res_png_9patch*>(chunk.data());
+  const Rect dst(10, 20, 20, 30);
+
+  // Without opacities, only the solid colors are known.
+  std::string err;
+  std::vector<Rect> rects;
+  ASSERT_TRUE(GetNinePatchOpaqueRegion(patch, nullptr, 0, 3, 3, dst, &rects,
+                                       &err));
+  EXPECT_EQ((std::vector<Rect>{Rect(10, 20, 11, 21), Rect(19, 20, 20, 21),
+                               Rect(19, 21, 20, 29), Rect(10, 29, 11, 30),
+                               Rect(19, 29, 20, 30)}),
+            rects);
+
+  // The opacities also know the center and bottom edge are opaque.
+  const uint8_t o = static_cast<uint8_t>(RegionOpacity::kOpaque);
+  const uint8_t h = static_cast<uint8_t>(RegionOpacity::kTranslucent);
+  const uint8_t z = static_cast<uint8_t>(RegionOpacity::kTransparent);
+  const uint8_t opacities[] = {o, h, o, z, o, o, o, o, o};
+  ASSERT_TRUE(GetNinePatchOpaqueRegion(patch, opacities, 9, 3, 3, dst, &rects,
+                                       &err));
+  EXPECT_EQ((std::vector<Rect>{Rect(10, 20, 11, 21), Rect(19, 20, 20, 21),
+                               Rect(11, 21, 20, 29), Rect(10, 29, 20, 30)}),
+            rects);
+
+  EXPECT_FALSE(GetNinePatchOpaqueRegion(patch, opacities, 9, 1, 1, dst, &rects,
+                                        &err));
+}
+
+TEST(NinePatchMeshTest, EdgesMatchLayoutEngine) {
+  // Stretch columns of 1, 2 and 3px and rows of 1 and 3px, whose shares of
+  // most sizes round, some of them on a half pixel.
+  std::vector<uint8_t> chunk = MakeChunk({1, 2, 4, 6, 7, 10}, {0, 1, 3, 6}, {});
+  const android::Res_png_9patch& patch =
+      *reinterpret_cast<android::Res_png_9patch*>(chunk.data());
+  std::string err;
+  std::unique_ptr<NinePatchLayoutEngine> engine =
+      NinePatchLayoutEngine::Create(patch, 12, 8, Bounds(), &err);
+  ASSERT_NE(nullptr, engine) << err;
+
+  int32_t vertex_capacity;
+  int32_t index_capacity;
+  GetNinePatchMeshCapacity(patch, &vertex_capacity, &index_capacity);
+  std::vector<float> x(vertex_capacity), y(vertex_capacity);
+  std::vector<float> u(vertex_capacity), v(vertex_capacity);
+  std::vector<uint32_t> indices(index_capacity);
+  for (int32_t dst_width = 0; dst_width < 40; dst_width++) {
+    const int32_t dst_height = 37 - dst_width;
+    NinePatchLayouts layouts;
+    engine->Layout(&dst_width, &dst_height, 1, &layouts);
+
+    NinePatchMeshRequest request;
+    request.chunk = &patch;
+    request.width = 12;
+    request.height = 8;
+    request.dst.left = 3.0f;
+    request.dst.top = -5.0f;
+    request.dst.right = 3.0f + dst_width;
+    request.dst.bottom = -5.0f + dst_height;
+    NinePatchMeshBuffers buffers;
+    buffers.x = x.data();
+    buffers.y = y.data();
+    buffers.u = u.data();
+    buffers.v = v.data();
+    buffers.vertex_capacity = vertex_capacity;
+    buffers.indices = indices.data();
+    buffers.index_capacity = index_capacity;
+    NinePatchMeshRange range;
+    ASSERT_TRUE(BuildNinePatchMesh(request, &buffers, &range, &err)) << err;
+    if (range.vertex_count == 0) {
+      continue;
+    }
+
+    const int32_t stride = layouts.col_edge_count;
+    ASSERT_EQ(stride * layouts.row_edge_count, range.vertex_count);
+    for (int32_t i = 0; i < layouts.col_edge_count; i++) {
+      EXPECT_EQ(3.0f + layouts.col_edges[i], x[i]) << "width " << dst_width;
+    }
+    for (int32_t j = 0; j < layouts.row_edge_count; j++) {
+      EXPECT_EQ(-5.0f + layouts.row_edges[j], y[j * stride])
+          << "height " << dst_height;
+    }
+  }
+}
+
+TEST(NinePatchCacheTest, HitReturnsSharedResult) {
+  NinePatchCache cache(1024 * 1024);
+  TestImage image = MakeRandomNinePatch(1000, 60, 40);
+  std::string err;
+  std::shared_ptr<const NinePatch> first = cache.Get(
+      image.rows.data(), image.width, image.height, NinePatchOptions(), &err);
+  ASSERT_NE(nullptr, first) << err;
+  EXPECT_EQ(0u, cache.hits());
+  EXPECT_EQ(1u, cache.misses());
+
+  // The same pixels at another address, through the strided overload.
+  std::vector<uint8_t> copy(image.data);
+  std::shared_ptr<const NinePatch> second =
+      cache.Get(copy.data(), image.width * 4, 0, 0, image.width, image.height,
+                NinePatchOptions(), &err);
+  EXPECT_EQ(first, second);
+  EXPECT_EQ(1u, cache.hits());
+  EXPECT_EQ(1u, cache.entry_count());
+
+  std::unique_ptr<NinePatch> expected =
+      NinePatch::Create(image.rows.data(), image.width, image.height, &err);
+  ASSERT_NE(nullptr, expected);
+  ExpectSameNinePatch(*expected, *first);
+
+  // Options that change the result are part of the key.
+  NinePatchOptions options;
+  options.tight_outline = true;
+  EXPECT_NE(first, cache.Get(image.rows.data(), image.width, image.height,
+                             options, &err));
+  EXPECT_EQ(2u, cache.misses());
+
+  // So are the pixels.
+  image.rows[5][5 * 4] ^= 1;
+  EXPECT_NE(first, cache.Get(image.rows.data(), image.width, image.height,
+                             NinePatchOptions(), &err));
+  EXPECT_EQ(3u, cache.misses());
+}
+
+TEST(NinePatchCacheTest, InvalidImageIsNotCached) {
+  NinePatchCache cache(1024 * 1024);
+  std::string err;
+  EXPECT_EQ(nullptr, cache.Get(kLayoutBoundsWrongEdge3x3, 3, 3,
+                               NinePatchOptions(), &err));
+  EXPECT_EQ("found unexpected optical bounds (red pixel) on top border at x=1",
+            err);
+  EXPECT_EQ(nullptr, cache.Get(kLayoutBoundsWrongEdge3x3, 3, 3,
+                               NinePatchOptions(), &err));
+  EXPECT_EQ(0u, cache.hits());
+  EXPECT_EQ(2u, cache.misses());
+  EXPECT_EQ(0u, cache.entry_count());
+}
+
+TEST(NinePatchCacheTest, InvalidRectIsRejectedBeforeHashing) {
+  NinePatchCache cache(1024 * 1024);
+  TestImage image = MakeRandomNinePatch(1010, 20, 10);
+  const size_t stride = image.width * 4;
+  std::string create_err;
+  EXPECT_EQ(nullptr, NinePatch::Create(image.data.data(), stride, 0, 0, 2,
+                                       image.height, &create_err));
+
+  std::string err;
+  EXPECT_EQ(nullptr, cache.Get(image.data.data(), stride, 0, 0, 2,
+                               image.height, NinePatchOptions(), &err));
+  EXPECT_EQ(create_err, err);
+  EXPECT_EQ(nullptr, cache.Get(image.data.data(), stride, 0, 0, image.width,
+                               -1, NinePatchOptions(), &err));
+  EXPECT_EQ(create_err, err);
+  EXPECT_EQ(nullptr, cache.Get(image.data.data(), stride, -1, 0, image.width,
+                               image.height, NinePatchOptions(), &err));
+  EXPECT_EQ(nullptr, cache.Get(image.data.data(), stride, 0, -1, image.width,
+                               image.height, NinePatchOptions(), &err));
+  EXPECT_FALSE(err.empty());
+  EXPECT_EQ(0u, cache.misses());
+}
+
+TEST(NinePatchCacheTest, EvictsLeastRecentlyUsed) {
+  std::vector<TestImage> images;
+  for (uint32_t seed = 1010; seed < 1013; seed++) {
+    images.push_back(MakeRandomNinePatch(seed, 30, 30));
+  }
+  auto get = [](NinePatchCache* cache, TestImage& image) {
+    std::string err;
+    return cache->Get(image.rows.data(), image.width, image.height,
+                      NinePatchOptions(), &err);
+  };
+
+  // Measure the size of one entry.
+  NinePatchCache sizing(1024 * 1024);
+  size_t max_entry_bytes = 0;
+  for (TestImage& image : images) {
+    const size_t before = sizing.size_bytes();
+    ASSERT_NE(nullptr, get(&sizing, image));
+    max_entry_bytes = std::max(max_entry_bytes, sizing.size_bytes() - before);
+  }
+
+  // Room for two entries.
+  NinePatchCache cache(2 * max_entry_bytes + max_entry_bytes / 2);
+  get(&cache, images[0]);
+  get(&cache, images[1]);
+  get(&cache, images[0]);
+  get(&cache, images[2]);
+  EXPECT_EQ(2u, cache.entry_count());
+  EXPECT_LE(cache.size_bytes(), 2 * max_entry_bytes + max_entry_bytes / 2);
+
+  // images[1] was the least recently used.
+  get(&cache, images[0]);
+  get(&cache, images[2]);
+  EXPECT_EQ(3u, cache.hits());
+  get(&cache, images[1]);
+  EXPECT_EQ(4u, cache.misses());
+
+  cache.Clear();
+  EXPECT_EQ(0u, cache.entry_count());
+  EXPECT_EQ(0u, cache.size_bytes());
+}
+
+TEST(NinePatchCacheTest, ConcurrentGets) {
+  std::vector<TestImage> images;
+  for (uint32_t seed = 1020; seed < 1028; seed++) {
+    images.push_back(MakeRandomNinePatch(seed, 40, 30));
+  }
+
+  NinePatchCache cache(1024 * 1024);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([&]() {
+      for (int i = 0; i < 50; i++) {
+        TestImage& image = images[i % images.size()];
+        std::string err;
+        EXPECT_NE(nullptr, cache.Get(image.rows.data(), image.width,
+                                     image.height, NinePatchOptions(), &err));
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  EXPECT_EQ(200u, cache.hits() + cache.misses());
+  EXPECT_EQ(images.size(), cache.entry_count());
+}
+
+TEST(NinePatchTest, CreateBatchMatchesCreateInOrder) {
+  std::vector<TestImage> images;
+  for (uint32_t seed = 1100; seed < 1140; seed++) {
+    images.push_back(
+        MakeRandomNinePatch(seed, 20 + (seed % 7) * 9, 15 + (seed % 5) * 11));
+  }
+
+  // Every fifth image is invalid, and every other valid one is given by its
+  // stride instead of its rows.
+  std::vector<ImageRef> refs;
+  for (size_t i = 0; i < images.size(); i++) {
+    ImageRef ref;
+    if (i % 5 == 4) {
+      ref.rows = kLayoutBoundsWrongEdge3x3;
+      ref.width = 3;
+      ref.height = 3;
+    } else if (i % 2 == 0) {
+      ref.rows = images[i].rows.data();
+      ref.width = images[i].width;
+      ref.height = images[i].height;
+    } else {
+      ref.base = images[i].data.data();
+      ref.stride_bytes = images[i].width * 4;
+      ref.width = images[i].width;
+      ref.height = images[i].height;
+    }
+    refs.push_back(ref);
+  }
+
+  for (int32_t threads : {1, 3, 8}) {
+    NinePatchOptions options;
+    options.batch_threads = threads;
+    std::vector<NinePatchResult> results =
+        NinePatch::CreateBatch(refs.data(), refs.size(), options);
+    ASSERT_EQ(refs.size(), results.size());
+    EXPECT_NE("", results[4].error);
+    for (size_t i = 0; i < refs.size(); i++) {
+      std::string err;
+      std::unique_ptr<NinePatch> expected =
+          NinePatch::Create(refs[i].rows != nullptr
+                                ? refs[i].rows
+                                : images[i].rows.data(),
+                            refs[i].width, refs[i].height, &err);
+      EXPECT_EQ(err, results[i].error) << "image " << i;
+      ASSERT_EQ(expected == nullptr, results[i].nine_patch == nullptr)
+          << "image " << i;
+      if (expected != nullptr) {
+        ExpectSameNinePatch(*expected, *results[i].nine_patch);
+      }
+    }
+  }
+
+  EXPECT_TRUE(NinePatch::CreateBatch(nullptr, 0, NinePatchOptions()).empty());
+}
+
+TEST(NinePatchTest, InstrumentationReportsEveryStage) {
+  TestImage image = MakeRandomNinePatch(1200, 64, 48);
+  NinePatchStageHistograms histograms;
+  NinePatchOptions options;
+  options.instrumentation = &histograms;
+  std::string err;
+  std::unique_ptr<NinePatch> nine_patch = NinePatch::Create(
+      image.rows.data(), image.width, image.height, options, &err);
+  ASSERT_NE(nullptr, nine_patch) << err;
+
+  EXPECT_EQ(1u, histograms.Get(NinePatchStage::kGatherColumns).count);
+  EXPECT_EQ(1u, histograms.Get(NinePatchStage::kBorderScan).count);
+  EXPECT_EQ(2u, histograms.Get(NinePatchStage::kPopulateBounds).count);
+  EXPECT_EQ(1u, histograms.Get(NinePatchStage::kOutline).count);
+  EXPECT_EQ(1u, histograms.Get(NinePatchStage::kOutlineRadius).count);
+  EXPECT_EQ(0u, histograms.Get(NinePatchStage::kSinglePassSweep).count);
+  NinePatchStageHistograms::Histogram region_colors =
+      histograms.Get(NinePatchStage::kRegionColors);
+  EXPECT_EQ(1u, region_colors.count);
+  EXPECT_EQ(62u * 46u, region_colors.total_pixels);
+  EXPECT_LT(0u, histograms.Get(NinePatchStage::kBorderScan).total_allocations);
+
+  // The same image in single_pass mode scans the borders in two stages around
+  // the sweep, and gives the same result.
+  histograms.Clear();
+  options.single_pass = true;
+  std::unique_ptr<NinePatch> single_pass = NinePatch::Create(
+      image.rows.data(), image.width, image.height, options, &err);
+  ASSERT_NE(nullptr, single_pass) << err;
+  ExpectSameNinePatch(*nine_patch, *single_pass);
+  EXPECT_EQ(2u, histograms.Get(NinePatchStage::kBorderScan).count);
+  EXPECT_EQ(1u, histograms.Get(NinePatchStage::kSinglePassSweep).count);
+  EXPECT_EQ(0u, histograms.Get(NinePatchStage::kRegionColors).count);
+
+  // An invalid image stops reporting at the stage that found it.
+  histograms.Clear();
+  EXPECT_EQ(nullptr,
+            NinePatch::Create(kLayoutBoundsWrongEdge3x3, 3, 3, options, &err));
+  EXPECT_EQ(0u, histograms.Get(NinePatchStage::kOutline).count);
+}
+
+TEST(NinePatchTest, StageHistogramQuantiles) {
+  NinePatchStageHistograms histograms;
+  NinePatchStageStats stats;
+  stats.stage = NinePatchStage::kRegionColors;
+  for (int64_t ns : {0, 3, 100, 120, 5000}) {
+    stats.nanoseconds = ns;
+    histograms.OnStage(stats);
+  }
+
+  NinePatchStageHistograms::Histogram histogram =
+      histograms.Get(NinePatchStage::kRegionColors);
+  EXPECT_EQ(5u, histogram.count);
+  EXPECT_EQ(5223u, histogram.total_ns);
+  EXPECT_EQ(0u, histogram.QuantileNs(0.2));
+  EXPECT_EQ(3u, histogram.QuantileNs(0.4));
+  EXPECT_EQ(127u, histogram.QuantileNs(0.6));
+  EXPECT_EQ(127u, histogram.QuantileNs(0.8));
+  EXPECT_EQ(5000u, histogram.QuantileNs(1.0));
+  EXPECT_EQ(0u, histograms.Get(NinePatchStage::kOutline).count);
+}
+
+// Converts an 8-bit channel to a half float, for values in [0, 1].
+static uint16_t ToHalf(uint8_t channel) {
+  if (channel == 0) {
+    return 0;
+  }
+  int exponent;
+  const float mantissa = std::frexp(channel / 255.0f, &exponent);
+  uint32_t biased = exponent + 14;
+  uint32_t fraction =
+      static_cast<uint32_t>(std::lround((mantissa * 2.0f - 1.0f) * 1024.0f));
+  if (fraction == 1024) {
+    fraction = 0;
+    biased++;
+  }
+  return static_cast<uint16_t>((biased << 10) | fraction);
+}
+
+TEST(NinePatchTest, Bgra8888MatchesRgba8888) {
+  for (uint32_t seed = 500; seed < 505; seed++) {
+    TestImage image = MakeRandomNinePatch(seed, 45 + seed % 10, 31);
+    ExpectFormatMatchesRgba(image, PixelFormat::kBGRA_8888, 4,
+                            [](const uint8_t* in, uint8_t* out) {
+                              out[0] = in[2];
+                              out[1] = in[1];
+                              out[2] = in[0];
+                              out[3] = in[3];
+                            });
+  }
+}
+
+TEST(NinePatchTest, PremultipliedRgba8888MatchesRgba8888) {
+  for (uint32_t seed = 510; seed < 515; seed++) {
+    TestImage image = MakeRandomNinePatch(seed, 45 + seed % 10, 31);
+    ExpectFormatMatchesRgba(image, PixelFormat::kRGBA_8888_Premul, 4,
+                            [](const uint8_t* in, uint8_t* out) {
+                              for (int c = 0; c < 3; c++) {
+                                out[c] = (in[c] * in[3] + 127) / 255;
+                              }
+                              out[3] = in[3];
+                            });
+  }
+}
+
+TEST(NinePatchTest, PremultipliedRegionColorIsUnpremultiplied) {
+  // Red at 20% alpha, premultiplied.
+  static uint8_t* kPremulRed3x3[] = {
+      (uint8_t*)TRANS BLACK TRANS, (uint8_t*)BLACK "\x33\x00\x00\x33" TRANS,
+      (uint8_t*)TRANS TRANS TRANS,
+  };
+  NinePatchOptions options;
+  options.pixel_format = PixelFormat::kRGBA_8888_Premul;
+  std::string err;
+  std::unique_ptr<NinePatch> nine_patch =
+      NinePatch::Create(kPremulRed3x3, 3, 3, options, &err);
+  ASSERT_NE(nullptr, nine_patch) << err;
+  ASSERT_EQ(1u, nine_patch->region_colors.size());
+  EXPECT_EQ(0x33ff0000u, nine_patch->region_colors[0]);
+}
+
+TEST(NinePatchTest, RgbaF16MatchesRgba8888) {
+  for (uint32_t seed = 520; seed < 525; seed++) {
+    TestImage image = MakeRandomNinePatch(seed, 45 + seed % 10, 31);
+    ExpectFormatMatchesRgba(image, PixelFormat::kRGBA_F16, 8,
+                            [](const uint8_t* in, uint8_t* out) {
+                              for (int c = 0; c < 4; c++) {
+                                const uint16_t half = ToHalf(in[c]);
+                                memcpy(out + c * 2, &half, 2);
+                              }
+                            });
+  }
+}
+
+TEST(NinePatchTest, RgbaF16ClampsOutOfRangeChannels) {
+  // Extended range white (1.5) is still the white neutral color, and negative
+  // alpha is transparent.
+  const uint16_t kOne = 0x3c00;
+  const uint16_t kOneAndAHalf = 0x3e00;
+  const uint16_t kMinusOne = 0xbc00;
+  const uint16_t white[] = {kOneAndAHalf, kOneAndAHalf, kOne, kOne};
+  const uint16_t black[] = {0, 0, 0, kOne};
+  const uint16_t negative[] = {0, 0, 0, kMinusOne};
+  std::vector<uint8_t> data(3 * 3 * 8);
+  for (int i = 0; i < 9; i++) {
+    memcpy(data.data() + i * 8, i == 1 || i == 3 ? black : white, 8);
+  }
+  memcpy(data.data() + 4 * 8, negative, 8);
+
+  NinePatchOptions options;
+  options.pixel_format = PixelFormat::kRGBA_F16;
+  std::string err;
+  std::unique_ptr<NinePatch> nine_patch =
+      NinePatch::Create(data.data(), 3 * 8, 0, 0, 3, 3, options, &err);
+  ASSERT_NE(nullptr, nine_patch) << err;
+  EXPECT_EQ(std::vector<Range>{Range(0, 1)},
+            nine_patch->horizontal_stretch_regions);
+  EXPECT_EQ(std::vector<Range>{Range(0, 1)},
+            nine_patch->vertical_stretch_regions);
+  ASSERT_EQ(1u, nine_patch->region_colors.size());
+  EXPECT_EQ((uint32_t)android::Res_png_9patch::TRANSPARENT_COLOR,
+            nine_patch->region_colors[0]);
+}
+
+TEST(NinePatchTest, A8MatchesBlackRgba8888) {
+  for (uint32_t seed = 530; seed < 535; seed++) {
+    TestImage image = MakeRandomNinePatch(seed, 45 + seed % 10, 31);
+
+    // An A8 image can only express black and transparent, so keep the stretch
+    // regions and content alpha, and clear the neutral, padding and layout
+    // bounds pixels.
+    for (int32_t y = 0; y < image.height; y++) {
+      for (int32_t x = 0; x < image.width; x++) {
+        uint8_t* pixel = image.rows[y] + x * 4;
+        const bool border = x == 0 || y == 0 || x == image.width - 1 ||
+                            y == image.height - 1;
+        const bool stretch = (x == 0 || y == 0) && pixel[0] == 0 &&
+                             pixel[3] == 0xff;
+        memset(pixel, 0, 3);
+        if (border && !stretch) {
+          pixel[3] = 0;
+        }
+      }
+    }
+    ExpectFormatMatchesRgba(
+        image, PixelFormat::kA8, 1,
+        [](const uint8_t* in, uint8_t* out) { out[0] = in[3]; });
+  }
+}
+
 ::testing::AssertionResult BigEndianOne(uint8_t* cursor) {
   if (cursor[0] == 0 && cursor[1] == 0 && cursor[2] == 0 && cursor[3] == 1) {
     return ::testing::AssertionSuccess();
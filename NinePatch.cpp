@@ -18,11 +18,18 @@
 
 #include "image.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <type_traits>
 #include <vector>
 
 #include "9patch.h"
+#include "NinePatchSimd.h"
 #include "StringPiece.h"
 #include <functional>
 
@@ -87,103 +94,367 @@ static uint32_t get_alpha(uint32_t color);
  * or a fully opaque white color as neutral, based on the
  * pixel color at (0,0) of the image. One or the other is fine,
  * but we need to ensure consistency throughout the image.
+ *
+ * Validators are compile-time policies, so that the analysis is instantiated
+ * once per neutral color and the checks inline into the scanning loops.
+ * A validator derives from ColorValidator<Validator> and provides:
+ *
+ *   // Returns true if the color specified is a neutral color
+ *   // (no padding, stretching, or optical bounds).
+ *   static bool IsNeutralColor(uint32_t color);
+ *
+ *   // Every neutral color satisfies (color & kNeutralMask) == kNeutralValue.
+ *   // Used to skip runs of neutral pixels in bulk.
+ *   static constexpr uint32_t kNeutralMask;
+ *   static constexpr uint32_t kNeutralValue;
  */
+template <typename Validator>
 class ColorValidator {
  public:
-  virtual ~ColorValidator() = default;
-
-  /**
-   * Returns true if the color specified is a neutral color
-   * (no padding, stretching, or optical bounds).
-   */
-  virtual bool IsNeutralColor(uint32_t color) const = 0;
-
   /**
    * Returns true if the color is either a neutral color
    * or one denoting padding, stretching, or optical bounds.
    */
-  bool IsValidColor(uint32_t color) const {
+  static inline bool IsValidColor(uint32_t color) {
     switch (color) {
       case kPrimaryColor:
       case kSecondaryColor:
         return true;
     }
-    return IsNeutralColor(color);
+    return Validator::IsNeutralColor(color);
+  }
+};
+
+class TransparentNeutralColorValidator
+    : public ColorValidator<TransparentNeutralColorValidator> {
+ public:
+  static constexpr uint32_t kNeutralMask = 0xff000000u;
+  static constexpr uint32_t kNeutralValue = 0u;
+
+  static inline bool IsNeutralColor(uint32_t color) {
+    return get_alpha(color) == 0;
+  }
+};
+
+class WhiteNeutralColorValidator
+    : public ColorValidator<WhiteNeutralColorValidator> {
+ public:
+  static constexpr uint32_t kNeutralMask = 0xffffffffu;
+  static constexpr uint32_t kNeutralValue = kColorOpaqueWhite;
+
+  static inline bool IsNeutralColor(uint32_t color) {
+    return color == kColorOpaqueWhite;
   }
 };
 
-// Walks an ImageLine and records Ranges of primary and secondary colors.
+// Records an error in `out_status` and returns false.
+static bool SetError(const NinePatchErrorCode code, const NinePatchEdge edge,
+                     const int32_t position, NinePatchStatus* out_status) {
+  out_status->code = code;
+  out_status->edge = edge;
+  out_status->position = position;
+  return false;
+}
+
+// Walks a contiguous line of RGBA_8888 pixels and records Ranges of primary
+// and secondary colors.
 // The primary color is black and is used to denote a padding or stretching
 // range,
 // depending on which border we're iterating over.
 // The secondary color is red and is used to denote optical bounds.
 //
-// An ImageLine is a templated-interface that would look something like this if
-// it
+// Instead of examining every pixel, the active SIMD kernel skips over the run
+// of pixels that share the kind (neutral, primary or secondary) of the last
+// examined pixel, so only the pixels where a range starts or ends are
+// classified individually. Columns are gathered into contiguous lines first.
+template <typename Validator>
+static bool FillRanges(const uint8_t* pixels, const int32_t length,
+                       const NinePatchEdge edge,
+                       std::pmr::vector<Range>* primary_ranges,
+                       std::pmr::vector<Range>* secondary_ranges,
+                       NinePatchStatus* out_status) {
+  const simd::Kernels& kernels = simd::ActiveKernels();
+  const int32_t end = length - 1;
+
+  uint32_t run_mask = Validator::kNeutralMask;
+  uint32_t run_value = Validator::kNeutralValue;
+  uint32_t last_color = 0xffffffffu;
+  int32_t idx = 1;
+  while (true) {
+    idx = kernels.find_run_end(pixels, idx, end, run_mask, run_value);
+    if (idx >= end) {
+      break;
+    }
+
+    // The run ended, so this pixel is of a different kind than the last one.
+    const uint32_t color = NinePatch::PackRGBA(pixels + idx * 4);
+    if (!Validator::IsValidColor(color)) {
+      return SetError(NinePatchErrorCode::kInvalidColor, edge, idx,
+                      out_status);
+    }
+
+    // note: encode the x offset without the final 1 pixel border.
+    if (last_color == kPrimaryColor) {
+      primary_ranges->back().end = idx - 1;
+    } else if (last_color == kSecondaryColor) {
+      secondary_ranges->back().end = idx - 1;
+    }
+
+    if (color == kPrimaryColor) {
+      primary_ranges->push_back(Range(idx - 1, length - 2));
+      run_mask = 0xffffffffu;
+      run_value = kPrimaryColor;
+    } else if (color == kSecondaryColor) {
+      secondary_ranges->push_back(Range(idx - 1, length - 2));
+      run_mask = 0xffffffffu;
+      run_value = kSecondaryColor;
+    } else {
+      run_mask = Validator::kNeutralMask;
+      run_value = Validator::kNeutralValue;
+    }
+    last_color = color;
+    idx++;
+  }
+  return true;
+}
+
+// Pixels are read through a Format accessor, which converts a pixel of one of
+// the supported PixelFormats to the 0xAARRGGBB color the analysis works with.
+// Format is a templated-interface that would look something like this if it
 // were polymorphic:
 //
-// class ImageLine {
+// class Format {
 // public:
-//      virtual int32_t GetLength() const = 0;
-//      virtual uint32_t GetColor(int32_t idx) const = 0;
+//      static constexpr int32_t kBytesPerPixel;
+//
+//      // Returns the unpremultiplied color of the pixel as 0xAARRGGBB.
+//      virtual uint32_t GetColor(const uint8_t* pixel) const = 0;
+//
+//      // True if the run kernels in NinePatchSimd.h can scan pixels of this
+//      // format, with masks and values converted by ToKernelColor().
+//      static constexpr bool kHasRunKernel;
+//      virtual uint32_t ToKernelColor(uint32_t color) const = 0;
 // };
 //
-template <typename ImageLine>
-static bool FillRanges(const ImageLine* image_line,
-                       const ColorValidator* color_validator,
-                       std::vector<Range>* primary_ranges,
-                       std::vector<Range>* secondary_ranges,
-                       std::string* out_err) {
-  const int32_t length = image_line->GetLength();
 
-  uint32_t last_color = 0xffffffffu;
-  for (int32_t idx = 1; idx < length - 1; idx++) {
-    const uint32_t color = image_line->GetColor(idx);
-    if (!color_validator->IsValidColor(color)) {
-      *out_err = "found an invalid color";
-      return false;
+class Rgba8888Format {
+ public:
+  static constexpr int32_t kBytesPerPixel = 4;
+  static constexpr bool kHasRunKernel = true;
+
+  static inline uint32_t GetColor(const uint8_t* pixel) {
+    return NinePatch::PackRGBA(pixel);
+  }
+
+  static inline uint32_t ToKernelColor(uint32_t color) { return color; }
+};
+
+// The kernels read pixels as RGBA_8888, so a BGRA_8888 pixel reaches them with
+// red and blue swapped. Swapping them in the masks and values as well gives the
+// same result as comparing the unswapped colors.
+class Bgra8888Format {
+ public:
+  static constexpr int32_t kBytesPerPixel = 4;
+  static constexpr bool kHasRunKernel = true;
+
+  static inline uint32_t GetColor(const uint8_t* pixel) {
+    return (pixel[3] << 24) | (pixel[2] << 16) | (pixel[1] << 8) | pixel[0];
+  }
+
+  static inline uint32_t ToKernelColor(uint32_t color) {
+    return (color & 0xff00ff00u) | ((color >> 16) & 0xffu) |
+           ((color & 0xffu) << 16);
+  }
+};
+
+class PremulRgba8888Format {
+ public:
+  static constexpr int32_t kBytesPerPixel = 4;
+  static constexpr bool kHasRunKernel = false;
+
+  static inline uint32_t GetColor(const uint8_t* pixel) {
+    const uint32_t alpha = pixel[3];
+    if (alpha == 0xff) {
+      return NinePatch::PackRGBA(pixel);
+    } else if (alpha == 0) {
+      // The color of a transparent pixel is lost, and does not matter.
+      return 0;
     }
+    return (alpha << 24) | (Unpremultiply(pixel[0], alpha) << 16) |
+           (Unpremultiply(pixel[1], alpha) << 8) |
+           Unpremultiply(pixel[2], alpha);
+  }
 
-    if (color != last_color) {
-      // We are ending a range. Which range?
-      // note: encode the x offset without the final 1 pixel border.
-      if (last_color == kPrimaryColor) {
-        primary_ranges->back().end = idx - 1;
-      } else if (last_color == kSecondaryColor) {
-        secondary_ranges->back().end = idx - 1;
-      }
+  static inline uint32_t ToKernelColor(uint32_t color) { return color; }
 
-      // We are starting a range. Which range?
-      // note: encode the x offset without the final 1 pixel border.
-      if (color == kPrimaryColor) {
-        primary_ranges->push_back(Range(idx - 1, length - 2));
-      } else if (color == kSecondaryColor) {
-        secondary_ranges->push_back(Range(idx - 1, length - 2));
-      }
-      last_color = color;
+ private:
+  static inline uint32_t Unpremultiply(uint32_t channel, uint32_t alpha) {
+    return std::min((channel * 0xff + alpha / 2) / alpha, 0xffu);
+  }
+};
+
+class RgbaF16Format {
+ public:
+  static constexpr int32_t kBytesPerPixel = 8;
+  static constexpr bool kHasRunKernel = false;
+
+  static inline uint32_t GetColor(const uint8_t* pixel) {
+    uint16_t half[4];
+    memcpy(half, pixel, sizeof(half));
+    return (ToUnorm8(half[3]) << 24) | (ToUnorm8(half[0]) << 16) |
+           (ToUnorm8(half[1]) << 8) | ToUnorm8(half[2]);
+  }
+
+  static inline uint32_t ToKernelColor(uint32_t color) { return color; }
+
+ private:
+  // Converts a half float to an 8-bit channel, clamping it to [0, 1] and
+  // rounding to the nearest value. NaN becomes 0.
+  static inline uint32_t ToUnorm8(uint16_t half) {
+    const uint32_t exponent = (half >> 10) & 0x1f;
+    const uint32_t mantissa = half & 0x3ff;
+    if ((half & 0x8000) != 0 || (exponent == 0 && mantissa == 0)) {
+      // Negative, or zero.
+      return 0;
+    } else if (exponent >= 15) {
+      // At least 1.0, infinite or NaN.
+      return exponent == 0x1f && mantissa != 0 ? 0 : 0xff;
+    }
+
+    float value;
+    if (exponent == 0) {
+      value = std::ldexp(static_cast<float>(mantissa), -24);
+    } else {
+      value = std::ldexp(static_cast<float>(mantissa | 0x400),
+                         static_cast<int>(exponent) - 25);
     }
+    return static_cast<uint32_t>(value * 255.0f + 0.5f);
   }
-  return true;
+};
+
+class A8Format {
+ public:
+  static constexpr int32_t kBytesPerPixel = 1;
+  static constexpr bool kHasRunKernel = false;
+
+  static inline uint32_t GetColor(const uint8_t* pixel) {
+    return pixel[0] << 24;
+  }
+
+  static inline uint32_t ToKernelColor(uint32_t color) { return color; }
+};
+
+// Returns the color of pixel `x` of `row`.
+template <typename Format>
+static inline uint32_t GetPixel(const uint8_t* row, const int32_t x) {
+  return Format::GetColor(row + x * Format::kBytesPerPixel);
+}
+
+// Stores `color` as an RGBA_8888 pixel. The inverse of NinePatch::PackRGBA().
+static inline void UnpackRGBA(const uint32_t color, uint8_t* pixel) {
+  pixel[0] = (color >> 16) & 0xff;
+  pixel[1] = (color >> 8) & 0xff;
+  pixel[2] = color & 0xff;
+  pixel[3] = color >> 24;
+}
+
+// Returns the first `length` pixels of `row` as RGBA_8888, converting them into
+// `scratch` unless they are in that format already.
+template <typename Format>
+static const uint8_t* ToRgba8888(const uint8_t* row, const int32_t length,
+                                 std::pmr::vector<uint8_t>* scratch) {
+  if (std::is_same<Format, Rgba8888Format>::value) {
+    return row;
+  }
+
+  scratch->resize(length * 4);
+  for (int32_t x = 0; x < length; x++) {
+    UnpackRGBA(GetPixel<Format>(row, x), scratch->data() + x * 4);
+  }
+  return scratch->data();
 }
 
+// The analysis is templated on how the rows of the image are addressed. Rows
+// is a templated-interface that would look something like this if it were
+// polymorphic:
+//
+// class Rows {
+// public:
+//      // The Format accessor of the pixels in the rows.
+//      typedef ... Format;
+//
+//      virtual const uint8_t* operator[](int32_t y) const = 0;
+// };
+//
+
+/**
+ * Rows of an image given as a table of row pointers. Implements the templated
+ * Rows interface.
+ */
+template <typename FormatT>
+class RowTable {
+ public:
+  typedef FormatT Format;
+
+  explicit RowTable(uint8_t** rows) : rows_(rows) {}
+
+  inline const uint8_t* operator[](int32_t y) const { return rows_[y]; }
+
+ private:
+  uint8_t** rows_;
+};
+
+/**
+ * Rows of an image stored in a single buffer, each row starting `stride` bytes
+ * after the previous one. Implements the templated Rows interface.
+ */
+template <typename FormatT>
+class StridedRows {
+ public:
+  typedef FormatT Format;
+
+  explicit StridedRows(const uint8_t* base, size_t stride)
+      : base_(base), stride_(stride) {}
+
+  inline const uint8_t* operator[](int32_t y) const {
+    return base_ + y * stride_;
+  }
+
+ private:
+  const uint8_t* base_;
+  size_t stride_;
+};
+
+// An ImageLine is a templated-interface that would look something like this if
+// it
+// were polymorphic:
+//
+// class ImageLine {
+// public:
+//      virtual int32_t GetLength() const = 0;
+//      virtual uint32_t GetColor(int32_t idx) const = 0;
+// };
+//
+
 /**
  * Iterates over a row in an image. Implements the templated ImageLine
  * interface.
  */
+template <typename Rows>
 class HorizontalImageLine {
  public:
-  explicit HorizontalImageLine(uint8_t** rows, int32_t xoffset, int32_t yoffset,
-                               int32_t length)
+  explicit HorizontalImageLine(const Rows& rows, int32_t xoffset,
+                               int32_t yoffset, int32_t length)
       : rows_(rows), xoffset_(xoffset), yoffset_(yoffset), length_(length) {}
 
   inline int32_t GetLength() const { return length_; }
 
   inline uint32_t GetColor(int32_t idx) const {
-    return NinePatch::PackRGBA(rows_[yoffset_] + (idx + xoffset_) * 4);
+    return GetPixel<typename Rows::Format>(rows_[yoffset_], idx + xoffset_);
   }
 
  private:
-  uint8_t** rows_;
+  Rows rows_;
   int32_t xoffset_, yoffset_, length_;
 
   DISALLOW_COPY_AND_ASSIGN(HorizontalImageLine);
@@ -193,29 +464,32 @@ class HorizontalImageLine {
  * Iterates over a column in an image. Implements the templated ImageLine
  * interface.
  */
+template <typename Rows>
 class VerticalImageLine {
  public:
-  explicit VerticalImageLine(uint8_t** rows, int32_t xoffset, int32_t yoffset,
-                             int32_t length)
+  explicit VerticalImageLine(const Rows& rows, int32_t xoffset,
+                             int32_t yoffset, int32_t length)
       : rows_(rows), xoffset_(xoffset), yoffset_(yoffset), length_(length) {}
 
   inline int32_t GetLength() const { return length_; }
 
   inline uint32_t GetColor(int32_t idx) const {
-    return NinePatch::PackRGBA(rows_[yoffset_ + idx] + (xoffset_ * 4));
+    return GetPixel<typename Rows::Format>(rows_[yoffset_ + idx], xoffset_);
   }
 
  private:
-  uint8_t** rows_;
+  Rows rows_;
   int32_t xoffset_, yoffset_, length_;
 
   DISALLOW_COPY_AND_ASSIGN(VerticalImageLine);
 };
 
+template <typename Rows>
 class DiagonalImageLine {
  public:
-  explicit DiagonalImageLine(uint8_t** rows, int32_t xoffset, int32_t yoffset,
-                             int32_t xstep, int32_t ystep, int32_t length)
+  explicit DiagonalImageLine(const Rows& rows, int32_t xoffset,
+                             int32_t yoffset, int32_t xstep, int32_t ystep,
+                             int32_t length)
       : rows_(rows),
         xoffset_(xoffset),
         yoffset_(yoffset),
@@ -226,47 +500,83 @@ class DiagonalImageLine {
   inline int32_t GetLength() const { return length_; }
 
   inline uint32_t GetColor(int32_t idx) const {
-    return NinePatch::PackRGBA(rows_[yoffset_ + (idx * ystep_)] +
-                               ((idx + xoffset_) * xstep_) * 4);
+    return GetPixel<typename Rows::Format>(rows_[yoffset_ + (idx * ystep_)],
+                                           (idx + xoffset_) * xstep_);
   }
 
  private:
-  uint8_t** rows_;
+  Rows rows_;
   int32_t xoffset_, yoffset_, xstep_, ystep_, length_;
 
   DISALLOW_COPY_AND_ASSIGN(DiagonalImageLine);
 };
 
-class TransparentNeutralColorValidator : public ColorValidator {
+/**
+ * The left and right borders and the center column of an image, copied into
+ * contiguous RGBA_8888 buffers. Vertical scans can then walk sequential memory
+ * with the row kernels instead of touching a new row (and usually a new cache
+ * line) for every pixel.
+ */
+class GatheredColumns {
  public:
-  bool IsNeutralColor(uint32_t color) const override {
-    return get_alpha(color) == 0;
+  enum Column { kLeft, kRight, kMid, kCount };
+
+  // The border columns come first, so gathering only the first kBorderCount
+  // columns skips the center column.
+  static constexpr int kBorderCount = kRight + 1;
+
+  // Gathers the first `count` columns.
+  explicit GatheredColumns(const int32_t width, const int32_t height,
+                           std::pmr::memory_resource* resource,
+                           const int count = kCount)
+      : count_(count),
+        x_{0, width - 1, width / 2},
+        buffers_{std::pmr::vector<uint8_t>(height * 4, resource),
+                 std::pmr::vector<uint8_t>(height * 4, resource),
+                 std::pmr::vector<uint8_t>(count > kMid ? height * 4 : 0,
+                                           resource)} {}
+
+  // Copies the pixels of row `y` that lie in the gathered columns.
+  template <typename Format>
+  inline void GatherRow(const uint8_t* row, const int32_t y) {
+    for (int c = 0; c < count_; c++) {
+      UnpackRGBA(GetPixel<Format>(row, x_[c]), buffers_[c].data() + y * 4);
+    }
   }
-};
 
-class WhiteNeutralColorValidator : public ColorValidator {
- public:
-  bool IsNeutralColor(uint32_t color) const override {
-    return color == kColorOpaqueWhite;
+  // Gathers every row in a single top-to-bottom sweep.
+  template <typename Rows>
+  void GatherAll(const Rows& rows, const int32_t height) {
+    for (int32_t y = 0; y < height; y++) {
+      GatherRow<typename Rows::Format>(rows[y], y);
+    }
   }
+
+  inline uint8_t* Get(Column column) { return buffers_[column].data(); }
+
+ private:
+  const int count_;
+  const int32_t x_[kCount];
+  std::pmr::vector<uint8_t> buffers_[kCount];
+
+  DISALLOW_COPY_AND_ASSIGN(GatheredColumns);
 };
 
 inline static uint32_t get_alpha(uint32_t color) {
   return (color & 0xff000000u) >> 24;
 }
 
-static bool PopulateBounds(const std::vector<Range>& padding,
-                           const std::vector<Range>& layout_bounds,
+static bool PopulateBounds(const std::pmr::vector<Range>& padding,
+                           const std::pmr::vector<Range>& layout_bounds,
                            const std::vector<Range>& stretch_regions,
                            const int32_t length, int32_t* padding_start,
                            int32_t* padding_end, int32_t* layout_start,
-                           int32_t* layout_end, const StringPiece& edge_name,
-                           std::string* out_err) {
+                           int32_t* layout_end, const NinePatchEdge edge,
+                           NinePatchStatus* out_status) {
+  // Positions in the ranges exclude the 1px border.
   if (padding.size() > 1) {
-    std::stringstream err_stream;
-    err_stream << "too many padding sections on " << edge_name << " border";
-    *out_err = err_stream.str();
-    return false;
+    return SetError(NinePatchErrorCode::kTooManyPaddingSections, edge,
+                    padding[1].start + 1, out_status);
   }
 
   *padding_start = 0;
@@ -283,11 +593,8 @@ static bool PopulateBounds(const std::vector<Range>& padding,
   }
 
   if (layout_bounds.size() > 2) {
-    std::stringstream err_stream;
-    err_stream << "too many layout bounds sections on " << edge_name
-               << " border";
-    *out_err = err_stream.str();
-    return false;
+    return SetError(NinePatchErrorCode::kTooManyLayoutBoundsSections, edge,
+                    layout_bounds[2].start + 1, out_status);
   }
 
   *layout_start = 0;
@@ -298,22 +605,16 @@ static bool PopulateBounds(const std::vector<Range>& padding,
     // then it should
     // end at length.
     if (range.start != 0 && range.end != length) {
-      std::stringstream err_stream;
-      err_stream << "layout bounds on " << edge_name
-                 << " border must start at edge";
-      *out_err = err_stream.str();
-      return false;
+      return SetError(NinePatchErrorCode::kLayoutBoundsNotAtEdge, edge,
+                      range.start + 1, out_status);
     }
     *layout_start = range.end;
 
     if (layout_bounds.size() >= 2) {
       const Range& range = layout_bounds.back();
       if (range.end != length) {
-        std::stringstream err_stream;
-        err_stream << "layout bounds on " << edge_name
-                   << " border must start at edge";
-        *out_err = err_stream.str();
-        return false;
+        return SetError(NinePatchErrorCode::kLayoutBoundsNotAtEdge, edge,
+                        range.start + 1, out_status);
       }
       *layout_end = length - range.start;
     }
@@ -338,102 +639,353 @@ static int32_t CalculateSegmentCount(const std::vector<Range>& stretch_regions,
   return static_cast<int32_t>(stretch_regions.size()) * 2 + modifier;
 }
 
-static uint32_t GetRegionColor(uint8_t** rows, const Bounds& region) {
-  // Sample the first pixel to compare against.
-  const uint32_t expected_color =
-      NinePatch::PackRGBA(rows[region.top] + region.left * 4);
-  for (int32_t y = region.top; y < region.bottom; y++) {
-    const uint8_t* row = rows[y];
-    for (int32_t x = region.left; x < region.right; x++) {
-      const uint32_t color = NinePatch::PackRGBA(row + x * 4);
-      if (get_alpha(color) == 0) {
-        // The color is transparent.
-        // If the expectedColor is not transparent, NO_COLOR.
-        if (get_alpha(expected_color) != 0) {
-          return android::Res_png_9patch::NO_COLOR;
-        }
-      } else if (color != expected_color) {
-        return android::Res_png_9patch::NO_COLOR;
-      }
+// Returns true if `color` matches `expected_color` in a region of a solid
+// color. All transparent colors are considered equal.
+static inline bool ColorsMatch(const uint32_t color,
+                               const uint32_t expected_color) {
+  if (get_alpha(color) == 0) {
+    return get_alpha(expected_color) == 0;
+  }
+  return color == expected_color;
+}
+
+// Returns true if the pixels of `row` in [left, right) all equal `value` in
+// the bits of `mask`. This is a run test, which the active SIMD kernel
+// performs a vector of pixels at a time, stopping at the first vector with a
+// mismatch, for the formats it can read.
+template <typename Format>
+static bool RowMatchesMasked(const uint8_t* row, const int32_t left,
+                             const int32_t right, const uint32_t mask,
+                             const uint32_t value) {
+  if (Format::kHasRunKernel) {
+    return simd::ActiveKernels().find_run_end(
+               row, left, right, Format::ToKernelColor(mask),
+               Format::ToKernelColor(value)) == right;
+  }
+
+  for (int32_t x = left; x < right; x++) {
+    if ((GetPixel<Format>(row, x) & mask) != value) {
+      return false;
     }
   }
+  return true;
+}
+
+// Returns true if the pixels of `row` in [left, right) all have the color
+// `expected_color`. All transparent pixels are considered equal, so when the
+// expected color is transparent only the alpha channel is compared, and
+// otherwise the whole color is.
+template <typename Format>
+static bool RowMatchesColor(const uint8_t* row, const int32_t left,
+                            const int32_t right,
+                            const uint32_t expected_color) {
+  const uint32_t mask =
+      get_alpha(expected_color) == 0 ? 0xff000000u : 0xffffffffu;
+  return RowMatchesMasked<Format>(row, left, right, mask,
+                                  expected_color & mask);
+}
+
+// Returns true if the pixels of `row` in [left, right) are all fully opaque.
+template <typename Format>
+static bool RowIsOpaque(const uint8_t* row, const int32_t left,
+                        const int32_t right) {
+  return RowMatchesMasked<Format>(row, left, right, 0xff000000u, 0xff000000u);
+}
 
+// Returns the color of a region whose pixels all matched `expected_color`.
+static uint32_t SolidRegionColor(const uint32_t expected_color) {
   if (get_alpha(expected_color) == 0) {
     return android::Res_png_9patch::TRANSPARENT_COLOR;
   }
   return expected_color;
 }
 
+// Splits a line of the 9-patch into its alternating fixed and stretchy
+// segments.
+//
+// Note that `length` and the indices in the stretch regions exclude the 9-patch
+// 1px border, while the segments are offset by 1 so that they can be used to
+// access the rows directly.
+static void SplitSegments(const std::vector<Range>& stretch_regions,
+                          const int32_t length,
+                          std::pmr::vector<Range>* out_segments) {
+  int32_t next_start = 0;
+  auto iter = stretch_regions.begin();
+  while (next_start != length) {
+    if (iter != stretch_regions.end()) {
+      if (next_start != iter->start) {
+        // This is a fixed segment.
+        out_segments->push_back(Range(next_start + 1, iter->start + 1));
+        next_start = iter->start;
+      } else {
+        // This is a stretchy segment.
+        out_segments->push_back(Range(iter->start + 1, iter->end + 1));
+        next_start = iter->end;
+        ++iter;
+      }
+    } else {
+      // This is the end, fixed section.
+      out_segments->push_back(Range(next_start + 1, length + 1));
+      next_start = length;
+    }
+  }
+}
+
+/**
+ * The color state of a region, or of the part of a region within some rows.
+ */
+struct RegionColorState {
+  // False if the region does not intersect the rows the state was computed on.
+  bool present = false;
+  // The first pixel of the region, which all others are compared against.
+  uint32_t expected_color = 0;
+  // True if some pixel did not match expected_color.
+  bool no_color = false;
+  // True if every pixel visited is fully opaque. Once no_color is set, only
+  // kept up to date when the opacity is tracked.
+  bool opaque = false;
+
+  uint32_t GetColor() const {
+    return no_color ? (uint32_t)android::Res_png_9patch::NO_COLOR
+                    : SolidRegionColor(expected_color);
+  }
+
+  // A region of mixed colors cannot be fully transparent, since all
+  // transparent pixels match.
+  RegionOpacity GetOpacity() const {
+    if (opaque) {
+      return RegionOpacity::kOpaque;
+    } else if (!no_color && get_alpha(expected_color) == 0) {
+      return RegionOpacity::kTransparent;
+    }
+    return RegionOpacity::kTranslucent;
+  }
+};
+
+/**
+ * Tracks the colors of the regions in one band of rows (one vertical segment)
+ * while the rows of the band are visited from top to bottom. Each row is loaded
+ * once for all of the band's regions. Regions that have resolved to NO_COLOR
+ * are dropped from the active set, so later rows only test the regions that
+ * may still be a solid color.
+ *
+ * If the band tracks opacity, a NO_COLOR region that is opaque so far stays
+ * active until a row of it is not, and is then only tested for opacity.
+ */
+template <typename Format>
+class RegionBand {
+ public:
+  // `col_segments` are the horizontal segments, offset to include the border.
+  explicit RegionBand(const std::pmr::vector<Range>* col_segments,
+                      const bool track_opacity,
+                      std::pmr::memory_resource* resource)
+      : col_segments_(*col_segments),
+        track_opacity_(track_opacity),
+        states_(col_segments->size(), resource),
+        active_(resource) {}
+
+  // Starts a new band whose first row is `row`.
+  void Begin(const uint8_t* row) {
+    active_.clear();
+    for (size_t i = 0; i < col_segments_.size(); i++) {
+      // Sample the first pixel to compare against.
+      states_[i].present = true;
+      states_[i].expected_color =
+          GetPixel<Format>(row, col_segments_[i].start);
+      states_[i].no_color = false;
+      states_[i].opaque = get_alpha(states_[i].expected_color) == 0xff;
+      active_.push_back(i);
+    }
+  }
+
+  // Tests `row` against the regions that may still be a solid color, or
+  // opaque.
+  void AddRow(const uint8_t* row) {
+    size_t kept = 0;
+    for (const size_t i : active_) {
+      RegionColorState& state = states_[i];
+      const Range& segment = col_segments_[i];
+      if (!state.no_color && RowMatchesColor<Format>(row, segment.start,
+                                                     segment.end,
+                                                     state.expected_color)) {
+        active_[kept++] = i;
+        continue;
+      }
+      state.no_color = true;
+      state.opaque = track_opacity_ && state.opaque &&
+                     RowIsOpaque<Format>(row, segment.start, segment.end);
+      if (state.opaque) {
+        active_[kept++] = i;
+      }
+    }
+    active_.resize(kept);
+  }
+
+  // Returns true if every region of the band is known to be NO_COLOR, and
+  // not opaque if the opacity is tracked, in which case the remaining rows of
+  // the band need not be visited.
+  bool Resolved() const { return active_.empty(); }
+
+  // Appends the colors of the band's regions, from left to right, and their
+  // opacities to `out_opacities` if not null.
+  void Finish(std::vector<uint32_t>* out_colors,
+              std::vector<RegionOpacity>* out_opacities) const {
+    for (const RegionColorState& state : states_) {
+      out_colors->push_back(state.GetColor());
+      if (out_opacities != nullptr) {
+        out_opacities->push_back(state.GetOpacity());
+      }
+    }
+  }
+
+  // Copies the states of the band's regions, from left to right.
+  void Finish(RegionColorState* out_states) const {
+    std::copy(states_.begin(), states_.end(), out_states);
+  }
+
+ private:
+  const std::pmr::vector<Range>& col_segments_;
+  const bool track_opacity_;
+  std::pmr::vector<RegionColorState> states_;
+  std::pmr::vector<size_t> active_;
+
+  DISALLOW_COPY_AND_ASSIGN(RegionBand);
+};
+
 // Fills out_colors with each 9-patch section's color. If the whole section is
 // transparent,
 // it gets the special TRANSPARENT color. If the whole section is the same
 // color, it is assigned
 // that color. Otherwise it gets the special NO_COLOR color.
 //
-// Note that the rows contain the 9-patch 1px border, and the indices in the
-// stretch regions are
-// already offset to exclude the border. This means that each time the rows are
-// accessed,
-// the indices must be offset by 1.
+// The image is walked row by row, one band of rows at a time, and a band is
+// left as soon as all of its regions are known to be NO_COLOR.
 //
-// width and height also include the 9-patch 1px border.
+// If `out_opacities` is not null, it is filled with each section's opacity in
+// the same pass, and a band is only left once its NO_COLOR sections are also
+// known not to be opaque.
+//
+// width and height exclude the 9-patch 1px border.
+template <typename Rows>
 static void CalculateRegionColors(
-    uint8_t** rows, const std::vector<Range>& horizontal_stretch_regions,
+    const Rows& rows, const std::vector<Range>& horizontal_stretch_regions,
     const std::vector<Range>& vertical_stretch_regions, const int32_t width,
-    const int32_t height, std::vector<uint32_t>* out_colors) {
-  int32_t next_top = 0;
-  Bounds bounds;
-  auto row_iter = vertical_stretch_regions.begin();
-  while (next_top != height) {
-    if (row_iter != vertical_stretch_regions.end()) {
-      if (next_top != row_iter->start) {
-        // This is a fixed segment.
-        // Offset the bounds by 1 to accommodate the border.
-        bounds.top = next_top + 1;
-        bounds.bottom = row_iter->start + 1;
-        next_top = row_iter->start;
-      } else {
-        // This is a stretchy segment.
-        // Offset the bounds by 1 to accommodate the border.
-        bounds.top = row_iter->start + 1;
-        bounds.bottom = row_iter->end + 1;
-        next_top = row_iter->end;
-        ++row_iter;
-      }
+    const int32_t height, std::pmr::memory_resource* resource,
+    std::vector<uint32_t>* out_colors,
+    std::vector<RegionOpacity>* out_opacities) {
+  std::pmr::vector<Range> row_segments(resource);
+  std::pmr::vector<Range> col_segments(resource);
+  SplitSegments(vertical_stretch_regions, height, &row_segments);
+  SplitSegments(horizontal_stretch_regions, width, &col_segments);
+
+  RegionBand<typename Rows::Format> band(&col_segments,
+                                         out_opacities != nullptr, resource);
+  for (const Range& row_segment : row_segments) {
+    band.Begin(rows[row_segment.start]);
+    for (int32_t y = row_segment.start;
+         y < row_segment.end && !band.Resolved(); y++) {
+      band.AddRow(rows[y]);
+    }
+    band.Finish(out_colors, out_opacities);
+  }
+}
+
+// Computes the state of every region over the rows [top, bottom) only, into
+// `out_states` which holds one entry per region in region_colors order.
+template <typename Rows>
+static void CalculateRegionColorStates(
+    const Rows& rows, const std::pmr::vector<Range>& row_segments,
+    const std::pmr::vector<Range>& col_segments, const int32_t top,
+    const int32_t bottom, const bool track_opacity,
+    std::vector<RegionColorState>* out_states) {
+  // The band is on a worker thread, so it allocates from the global heap
+  // rather than from a resource that may not be thread-safe.
+  RegionBand<typename Rows::Format> band(&col_segments, track_opacity,
+                                         std::pmr::new_delete_resource());
+  for (size_t j = 0; j < row_segments.size(); j++) {
+    const int32_t band_top = std::max(row_segments[j].start, top);
+    const int32_t band_bottom = std::min(row_segments[j].end, bottom);
+    if (band_top >= band_bottom) {
+      continue;
+    }
+
+    band.Begin(rows[band_top]);
+    for (int32_t y = band_top; y < band_bottom && !band.Resolved(); y++) {
+      band.AddRow(rows[y]);
+    }
+    band.Finish(out_states->data() + j * col_segments.size());
+  }
+}
+
+// Same as CalculateRegionColors, but splits the rows into `thread_count`
+// chunks that are scanned concurrently. Each chunk records, for the part of
+// every region within its rows, the first pixel and whether all others matched
+// it. The chunks are then merged from top to bottom: a region is a solid color
+// if every part of it is, and the first pixels of all parts match, and it is
+// opaque if every part of it is. The result does not depend on the thread
+// count or on scheduling.
+template <typename Rows>
+static void CalculateRegionColorsParallel(
+    const Rows& rows, const std::vector<Range>& horizontal_stretch_regions,
+    const std::vector<Range>& vertical_stretch_regions, const int32_t width,
+    const int32_t height, int32_t thread_count,
+    std::pmr::memory_resource* resource, std::vector<uint32_t>* out_colors,
+    std::vector<RegionOpacity>* out_opacities) {
+  std::pmr::vector<Range> row_segments(resource);
+  std::pmr::vector<Range> col_segments(resource);
+  SplitSegments(vertical_stretch_regions, height, &row_segments);
+  SplitSegments(horizontal_stretch_regions, width, &col_segments);
+  const size_t region_count = row_segments.size() * col_segments.size();
+
+  thread_count = std::min(thread_count, height);
+  std::vector<std::vector<RegionColorState>> chunks(
+      thread_count, std::vector<RegionColorState>(region_count));
+  std::vector<std::thread> threads;
+  for (int32_t i = 0; i < thread_count; i++) {
+    // Offset the rows by 1 to accommodate the border.
+    const int32_t top = 1 + static_cast<int32_t>((int64_t)height * i /
+                                                 thread_count);
+    const int32_t bottom = 1 + static_cast<int32_t>((int64_t)height * (i + 1) /
+                                                    thread_count);
+    std::vector<RegionColorState>* states = &chunks[i];
+    const bool track_opacity = out_opacities != nullptr;
+    auto work = [&rows, &row_segments, &col_segments, top, bottom,
+                 track_opacity, states]() {
+      CalculateRegionColorStates(rows, row_segments, col_segments, top, bottom,
+                                 track_opacity, states);
+    };
+    if (i == thread_count - 1) {
+      // The calling thread takes the last chunk.
+      work();
     } else {
-      // This is the end, fixed section.
-      // Offset the bounds by 1 to accommodate the border.
-      bounds.top = next_top + 1;
-      bounds.bottom = height + 1;
-      next_top = height;
-    }
-
-    int32_t next_left = 0;
-    auto col_iter = horizontal_stretch_regions.begin();
-    while (next_left != width) {
-      if (col_iter != horizontal_stretch_regions.end()) {
-        if (next_left != col_iter->start) {
-          // This is a fixed segment.
-          // Offset the bounds by 1 to accommodate the border.
-          bounds.left = next_left + 1;
-          bounds.right = col_iter->start + 1;
-          next_left = col_iter->start;
-        } else {
-          // This is a stretchy segment.
-          // Offset the bounds by 1 to accommodate the border.
-          bounds.left = col_iter->start + 1;
-          bounds.right = col_iter->end + 1;
-          next_left = col_iter->end;
-          ++col_iter;
-        }
-      } else {
-        // This is the end, fixed section.
-        // Offset the bounds by 1 to accommodate the border.
-        bounds.left = next_left + 1;
-        bounds.right = width + 1;
-        next_left = width;
+      threads.emplace_back(work);
+    }
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  for (size_t r = 0; r < region_count; r++) {
+    RegionColorState merged;
+    for (const std::vector<RegionColorState>& chunk : chunks) {
+      const RegionColorState& part = chunk[r];
+      if (!part.present) {
+        continue;
+      }
+
+      if (!merged.present) {
+        merged = part;
+        continue;
+      }
+      if (part.no_color ||
+          !ColorsMatch(part.expected_color, merged.expected_color)) {
+        merged.no_color = true;
       }
-      out_colors->push_back(GetRegionColor(rows, bounds));
+      merged.opaque = merged.opaque && part.opaque;
+    }
+    out_colors->push_back(merged.GetColor());
+    if (out_opacities != nullptr) {
+      out_opacities->push_back(merged.GetOpacity());
     }
   }
 }
@@ -441,11 +993,16 @@ static void CalculateRegionColors(
 // Calculates the insets of a row/column of pixels based on where the largest
 // alpha value begins
 // (on both sides).
+//
+// The start inset only depends on the first half of the line. If `out_end` is
+// null, only the start inset is computed and the second half is not read.
 template <typename ImageLine>
 static void FindOutlineInsets(const ImageLine* image_line, int32_t* out_start,
                               int32_t* out_end) {
   *out_start = 0;
-  *out_end = 0;
+  if (out_end != nullptr) {
+    *out_end = 0;
+  }
 
   const int32_t length = image_line->GetLength();
   if (length < 3) {
@@ -467,6 +1024,10 @@ static void FindOutlineInsets(const ImageLine* image_line, int32_t* out_start,
     }
   }
 
+  if (out_end == nullptr) {
+    return;
+  }
+
   max_alpha = 0;
   for (int32_t i = length - 1; i >= mid2 && max_alpha != 0xff; i--) {
     uint32_t alpha = get_alpha(image_line->GetColor(i));
@@ -491,124 +1052,351 @@ static uint32_t FindMaxAlpha(const ImageLine* image_line) {
   return max_alpha;
 }
 
-// Pack the pixels in as 0xAARRGGBB (as 9-patch expects it).
-uint32_t NinePatch::PackRGBA(const uint8_t* pixel) {
-  return (pixel[3] << 24) | (pixel[0] << 16) | (pixel[1] << 8) | pixel[2];
-}
+/**
+ * Forwards allocations to another memory resource, counting them and the bytes
+ * allocated.
+ */
+class CountingMemoryResource : public std::pmr::memory_resource {
+ public:
+  explicit CountingMemoryResource(std::pmr::memory_resource* upstream)
+      : upstream_(upstream) {}
 
-std::unique_ptr<NinePatch> NinePatch::Create(uint8_t** rows,
-                                             const int32_t width,
-                                             const int32_t height,
-                                             std::string* out_err) {
-  if (width < 3 || height < 3) {
-    *out_err = "image must be at least 3x3 (1x1 image with 1 pixel border)";
-    return {};
-  }
+  size_t bytes_allocated() const { return bytes_allocated_; }
 
-  std::vector<Range> horizontal_padding;
-  std::vector<Range> horizontal_layout_bounds;
-  std::vector<Range> vertical_padding;
-  std::vector<Range> vertical_layout_bounds;
-  std::vector<Range> unexpected_ranges;
-  std::unique_ptr<ColorValidator> color_validator;
+  size_t allocations() const { return allocations_; }
 
-  if (rows[0][3] == 0) {
-    color_validator = util::make_unique<TransparentNeutralColorValidator>();
-  } else if (PackRGBA(rows[0]) == kColorOpaqueWhite) {
-    color_validator = util::make_unique<WhiteNeutralColorValidator>();
-  } else {
-    *out_err =
-        "top-left corner pixel must be either opaque white or transparent";
-    return {};
+ private:
+  void* do_allocate(size_t bytes, size_t alignment) override {
+    bytes_allocated_ += bytes;
+    allocations_++;
+    return upstream_->allocate(bytes, alignment);
   }
 
-  // Private constructor, can't use make_unique.
-  auto nine_patch = std::unique_ptr<NinePatch>(new NinePatch());
+  void do_deallocate(void* p, size_t bytes, size_t alignment) override {
+    upstream_->deallocate(p, bytes, alignment);
+  }
 
-  HorizontalImageLine top_row(rows, 0, 0, width);
-  if (!FillRanges(&top_row, color_validator.get(),
-                  &nine_patch->horizontal_stretch_regions, &unexpected_ranges,
-                  out_err)) {
-    return {};
+  bool do_is_equal(
+      const std::pmr::memory_resource& other) const noexcept override {
+    return this == &other;
   }
 
+  std::pmr::memory_resource* upstream_;
+  size_t bytes_allocated_ = 0;
+  size_t allocations_ = 0;
+
+  DISALLOW_COPY_AND_ASSIGN(CountingMemoryResource);
+};
+
+/**
+ * Stage hooks of an uninstrumented analysis. The analysis functions take their
+ * hooks as a template parameter and open a Hooks::Scope around each stage;
+ * these scopes are empty, so the default instantiation has no trace of them.
+ */
+class NoStageHooks {
+ public:
+  class Scope {
+   public:
+    explicit Scope(const NoStageHooks&, NinePatchStage, int64_t) {}
+
+   private:
+    DISALLOW_COPY_AND_ASSIGN(Scope);
+  };
+};
+
+/**
+ * Stage hooks reporting the time, pixels and temporary allocations of each
+ * stage to a NinePatchInstrumentation.
+ */
+class ReportingStageHooks {
+ public:
+  explicit ReportingStageHooks(NinePatchInstrumentation* instrumentation,
+                               const CountingMemoryResource* resource)
+      : instrumentation_(instrumentation), resource_(resource) {}
+
+  class Scope {
+   public:
+    explicit Scope(const ReportingStageHooks& hooks, NinePatchStage stage,
+                   int64_t pixels)
+        : hooks_(hooks),
+          allocations_(hooks.resource_->allocations()),
+          allocated_bytes_(hooks.resource_->bytes_allocated()),
+          start_(std::chrono::steady_clock::now()) {
+      stats_.stage = stage;
+      stats_.pixels = pixels;
+    }
+
+    ~Scope() {
+      stats_.nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                               std::chrono::steady_clock::now() - start_)
+                               .count();
+      stats_.allocations = static_cast<int64_t>(
+          hooks_.resource_->allocations() - allocations_);
+      stats_.allocated_bytes = static_cast<int64_t>(
+          hooks_.resource_->bytes_allocated() - allocated_bytes_);
+      hooks_.instrumentation_->OnStage(stats_);
+    }
+
+   private:
+    const ReportingStageHooks& hooks_;
+    NinePatchStageStats stats_;
+    const size_t allocations_;
+    const size_t allocated_bytes_;
+    const std::chrono::steady_clock::time_point start_;
+
+    DISALLOW_COPY_AND_ASSIGN(Scope);
+  };
+
+ private:
+  NinePatchInstrumentation* instrumentation_;
+  const CountingMemoryResource* resource_;
+};
+
+// Scans the top border for the horizontal stretch regions. The top border may
+// not contain optical bounds.
+template <typename Validator>
+static bool ScanTopBorder(const uint8_t* top_row, const int32_t width,
+                          std::pmr::memory_resource* resource,
+                          NinePatch* nine_patch,
+                          NinePatchStatus* out_status) {
+  std::pmr::vector<Range> stretch_regions(resource);
+  std::pmr::vector<Range> unexpected_ranges(resource);
+  if (!FillRanges<Validator>(top_row, width, NinePatchEdge::kTop,
+                             &stretch_regions, &unexpected_ranges,
+                             out_status)) {
+    return false;
+  }
+  nine_patch->horizontal_stretch_regions.assign(stretch_regions.begin(),
+                                                stretch_regions.end());
+
   if (!unexpected_ranges.empty()) {
-    const Range& range = unexpected_ranges[0];
-    std::stringstream err_stream;
-    err_stream << "found unexpected optical bounds (red pixel) on top border "
-               << "at x=" << range.start + 1;
-    *out_err = err_stream.str();
-    return {};
+    return SetError(NinePatchErrorCode::kUnexpectedOpticalBounds,
+                    NinePatchEdge::kTop, unexpected_ranges[0].start + 1,
+                    out_status);
   }
+  return true;
+}
 
-  VerticalImageLine left_col(rows, 0, 0, height);
-  if (!FillRanges(&left_col, color_validator.get(),
-                  &nine_patch->vertical_stretch_regions, &unexpected_ranges,
-                  out_err)) {
-    return {};
+// Scans the left border for the vertical stretch regions, then the bottom and
+// right borders for the padding and optical layout bounds.
+template <typename Validator, typename Hooks = NoStageHooks>
+static bool ScanRemainingBorders(const uint8_t* left_col,
+                                 const uint8_t* bottom_row,
+                                 const uint8_t* right_col, const int32_t width,
+                                 const int32_t height,
+                                 std::pmr::memory_resource* resource,
+                                 NinePatch* nine_patch,
+                                 NinePatchStatus* out_status,
+                                 const Hooks& hooks = Hooks()) {
+  std::pmr::vector<Range> stretch_regions(resource);
+  std::pmr::vector<Range> horizontal_padding(resource);
+  std::pmr::vector<Range> horizontal_layout_bounds(resource);
+  std::pmr::vector<Range> vertical_padding(resource);
+  std::pmr::vector<Range> vertical_layout_bounds(resource);
+  std::pmr::vector<Range> unexpected_ranges(resource);
+
+  if (!FillRanges<Validator>(left_col, height, NinePatchEdge::kLeft,
+                             &stretch_regions, &unexpected_ranges,
+                             out_status)) {
+    return false;
   }
+  nine_patch->vertical_stretch_regions.assign(stretch_regions.begin(),
+                                              stretch_regions.end());
 
   if (!unexpected_ranges.empty()) {
-    const Range& range = unexpected_ranges[0];
-    std::stringstream err_stream;
-    err_stream << "found unexpected optical bounds (red pixel) on left border "
-               << "at y=" << range.start + 1;
-    return {};
+    return SetError(NinePatchErrorCode::kUnexpectedOpticalBounds,
+                    NinePatchEdge::kLeft, unexpected_ranges[0].start + 1,
+                    out_status);
   }
 
-  HorizontalImageLine bottom_row(rows, 0, height - 1, width);
-  if (!FillRanges(&bottom_row, color_validator.get(), &horizontal_padding,
-                  &horizontal_layout_bounds, out_err)) {
-    return {};
+  if (!FillRanges<Validator>(bottom_row, width, NinePatchEdge::kBottom,
+                             &horizontal_padding, &horizontal_layout_bounds,
+                             out_status)) {
+    return false;
   }
 
-  if (!PopulateBounds(horizontal_padding, horizontal_layout_bounds,
-                      nine_patch->horizontal_stretch_regions, width - 2,
-                      &nine_patch->padding.left, &nine_patch->padding.right,
-                      &nine_patch->layout_bounds.left,
-                      &nine_patch->layout_bounds.right, "bottom", out_err)) {
-    return {};
+  {
+    typename Hooks::Scope scope(hooks, NinePatchStage::kPopulateBounds, 0);
+    if (!PopulateBounds(horizontal_padding, horizontal_layout_bounds,
+                        nine_patch->horizontal_stretch_regions, width - 2,
+                        &nine_patch->padding.left, &nine_patch->padding.right,
+                        &nine_patch->layout_bounds.left,
+                        &nine_patch->layout_bounds.right,
+                        NinePatchEdge::kBottom, out_status)) {
+      return false;
+    }
   }
 
-  VerticalImageLine right_col(rows, width - 1, 0, height);
-  if (!FillRanges(&right_col, color_validator.get(), &vertical_padding,
-                  &vertical_layout_bounds, out_err)) {
-    return {};
+  if (!FillRanges<Validator>(right_col, height, NinePatchEdge::kRight,
+                             &vertical_padding, &vertical_layout_bounds,
+                             out_status)) {
+    return false;
   }
 
-  if (!PopulateBounds(vertical_padding, vertical_layout_bounds,
-                      nine_patch->vertical_stretch_regions, height - 2,
-                      &nine_patch->padding.top, &nine_patch->padding.bottom,
-                      &nine_patch->layout_bounds.top,
-                      &nine_patch->layout_bounds.bottom, "right", out_err)) {
-    return {};
-  }
+  typename Hooks::Scope scope(hooks, NinePatchStage::kPopulateBounds, 0);
+  return PopulateBounds(vertical_padding, vertical_layout_bounds,
+                        nine_patch->vertical_stretch_regions, height - 2,
+                        &nine_patch->padding.top, &nine_patch->padding.bottom,
+                        &nine_patch->layout_bounds.top,
+                        &nine_patch->layout_bounds.bottom,
+                        NinePatchEdge::kRight, out_status);
+}
 
-  // Fill the region colors of the 9-patch.
+// Checks that the 9-patch does not have more regions than the chunk format
+// supports, and returns the number of region colors that will be computed.
+static bool CheckRegionCount(const NinePatch& nine_patch, const int32_t width,
+                             const int32_t height, int32_t* out_count,
+                             NinePatchStatus* out_status) {
   const int32_t num_rows =
-      CalculateSegmentCount(nine_patch->horizontal_stretch_regions, width - 2);
+      CalculateSegmentCount(nine_patch.horizontal_stretch_regions, width - 2);
   const int32_t num_cols =
-      CalculateSegmentCount(nine_patch->vertical_stretch_regions, height - 2);
+      CalculateSegmentCount(nine_patch.vertical_stretch_regions, height - 2);
   if ((int64_t)num_rows * (int64_t)num_cols > 0x7f) {
-    *out_err = "too many regions in 9-patch";
-    return {};
+    return SetError(NinePatchErrorCode::kTooManyRegions, NinePatchEdge::kNone,
+                    -1, out_status);
+  }
+  *out_count = num_rows * num_cols;
+  return true;
+}
+
+// Computes the radius of the outline in `nine_patch`, assuming the image is a
+// round rect, by marching diagonally from the top left corner of the outline
+// towards the center.
+template <typename Rows>
+static void CalculateOutlineRadius(const Rows& rows, const int32_t width,
+                                   const int32_t height,
+                                   NinePatch* nine_patch) {
+  const int32_t outline_width =
+      (width - 2) - nine_patch->outline.left - nine_patch->outline.right;
+  const int32_t outline_height =
+      (height - 2) - nine_patch->outline.top - nine_patch->outline.bottom;
+  DiagonalImageLine diagonal(rows, 1 + nine_patch->outline.left,
+                             1 + nine_patch->outline.top, 1, 1,
+                             std::min(outline_width, outline_height));
+  int32_t top_left;
+  FindOutlineInsets(&diagonal, &top_left, nullptr);
+
+  /* Determine source radius based upon inset:
+   *     sqrt(r^2 + r^2) = sqrt(i^2 + i^2) + r
+   *     sqrt(2) * r = sqrt(2) * i + r
+   *     (sqrt(2) - 1) * r = sqrt(2) * i
+   *     r = sqrt(2) / (sqrt(2) - 1) * i
+   */
+  nine_patch->outline_radius = 3.4142f * top_left;
+}
+
+/**
+ * Finds the bounding box of the pixels holding the largest alpha value in the
+ * content of an image (inside the 1px border), from rows added top to bottom.
+ *
+ * Once a row reaching the largest alpha seen so far is found, the other rows
+ * are only searched for that alpha from both ends, which stops at the first
+ * and last matching pixels. Opaque shapes reach 0xff early, after which a row
+ * costs a few vectors from each end up to the shape's edges.
+ */
+class AlphaBounds {
+ public:
+  explicit AlphaBounds(const int32_t width)
+      : kernels_(simd::ActiveKernels()), length_(width - 2) {}
+
+  // Adds the content of row `y`: the `width - 2` pixels after the border.
+  // Only byte 3 of each 4-byte pixel is read, which is the alpha in every
+  // 4-byte format.
+  void AddRow(const uint8_t* pixels, const int32_t y) {
+    uint32_t row_alpha = 0xff;
+    if (max_alpha_ != 0xff) {
+      row_alpha = kernels_.max_alpha(pixels, 0, length_);
+      if (row_alpha == 0 || row_alpha < max_alpha_) {
+        return;
+      }
+    }
+
+    const int32_t first = kernels_.find_alpha(pixels, 0, length_, row_alpha);
+    if (first == length_) {
+      return;
+    }
+    const int32_t last =
+        kernels_.find_last_alpha(pixels, first, length_, row_alpha);
+
+    if (row_alpha > max_alpha_) {
+      max_alpha_ = row_alpha;
+      left_ = first;
+      right_ = last;
+      top_ = y;
+    } else {
+      left_ = std::min(left_, first);
+      right_ = std::max(right_, last);
+    }
+    bottom_ = y;
   }
 
-  nine_patch->region_colors.reserve(num_rows * num_cols);
-  CalculateRegionColors(rows, nine_patch->horizontal_stretch_regions,
-                        nine_patch->vertical_stretch_regions, width - 2,
-                        height - 2, &nine_patch->region_colors);
+  // Sets the outline and outline alpha of `nine_patch`. A fully transparent
+  // image has no insets.
+  void Finish(const int32_t height, NinePatch* nine_patch) const {
+    nine_patch->outline_alpha = max_alpha_;
+    if (max_alpha_ == 0) {
+      nine_patch->outline = Bounds();
+      return;
+    }
+    nine_patch->outline = Bounds(left_, top_ - 1, length_ - 1 - right_,
+                                 height - 2 - bottom_);
+  }
 
-  // Compute the outline based on opacity.
+ private:
+  const simd::Kernels& kernels_;
+  const int32_t length_;
+  uint32_t max_alpha_ = 0;
+  int32_t left_ = 0;
+  int32_t right_ = 0;
+  int32_t top_ = 0;
+  int32_t bottom_ = 0;
+
+  DISALLOW_COPY_AND_ASSIGN(AlphaBounds);
+};
 
+// Returns the content of `row` for AlphaBounds::AddRow(), converting it into
+// `scratch` if its pixels are not 4 bytes wide.
+template <typename Format>
+static const uint8_t* GetAlphaBoundsRow(const uint8_t* row,
+                                        const int32_t width,
+                                        std::pmr::vector<uint8_t>* scratch) {
+  if (Format::kBytesPerPixel == 4) {
+    return row + 4;
+  }
+  return ToRgba8888<Format>(row + Format::kBytesPerPixel, width - 2, scratch);
+}
+
+// Computes the outline as the bounding box of the pixels holding the largest
+// alpha value in the image, in one pass over the rows.
+template <typename Rows>
+static void CalculateTightOutline(const Rows& rows, const int32_t width,
+                                  const int32_t height,
+                                  std::pmr::memory_resource* resource,
+                                  NinePatch* nine_patch) {
+  std::pmr::vector<uint8_t> scratch(resource);
+  AlphaBounds bounds(width);
+  for (int32_t y = 1; y < height - 1; y++) {
+    bounds.AddRow(
+        GetAlphaBoundsRow<typename Rows::Format>(rows[y], width, &scratch), y);
+  }
+  bounds.Finish(height, nine_patch);
+}
+
+// Computes the outline based on opacity. `mid_col` holds the gathered RGBA_8888
+// pixels of column width / 2.
+template <typename Rows>
+static void CalculateOutline(const Rows& rows, const int32_t width,
+                             const int32_t height, uint8_t* mid_col,
+                             NinePatch* nine_patch) {
   // Find left and right extent of 9-patch content on center row.
   HorizontalImageLine mid_row(rows, 1, height / 2, width - 2);
   FindOutlineInsets(&mid_row, &nine_patch->outline.left,
                     &nine_patch->outline.right);
 
   // Find top and bottom extent of 9-patch content on center column.
-  VerticalImageLine mid_col(rows, width / 2, 1, height - 2);
-  FindOutlineInsets(&mid_col, &nine_patch->outline.top,
+  const StridedRows<Rgba8888Format> mid_col_rows(mid_col, 0);
+  HorizontalImageLine mid_col_line(mid_col_rows, 1, 0, height - 2);
+  FindOutlineInsets(&mid_col_line, &nine_patch->outline.top,
                     &nine_patch->outline.bottom);
 
   const int32_t outline_width =
@@ -620,30 +1408,1071 @@ std::unique_ptr<NinePatch> NinePatch::Create(uint8_t** rows,
   HorizontalImageLine outline_mid_row(
       rows, 1 + nine_patch->outline.left,
       1 + nine_patch->outline.top + (outline_height / 2), outline_width);
-  VerticalImageLine outline_mid_col(
-      rows, 1 + nine_patch->outline.left + (outline_width / 2),
-      1 + nine_patch->outline.top, outline_height);
+  const int32_t outline_mid_x =
+      1 + nine_patch->outline.left + (outline_width / 2);
+  uint32_t outline_mid_col_alpha;
+  if (outline_mid_x == width / 2) {
+    // The outline is centered, so its middle column was already gathered.
+    HorizontalImageLine outline_mid_col(
+        mid_col_rows, 1 + nine_patch->outline.top, 0, outline_height);
+    outline_mid_col_alpha = FindMaxAlpha(&outline_mid_col);
+  } else {
+    VerticalImageLine outline_mid_col(rows, outline_mid_x,
+                                      1 + nine_patch->outline.top,
+                                      outline_height);
+    outline_mid_col_alpha = FindMaxAlpha(&outline_mid_col);
+  }
   nine_patch->outline_alpha =
-      std::max(FindMaxAlpha(&outline_mid_row), FindMaxAlpha(&outline_mid_col));
+      std::max(FindMaxAlpha(&outline_mid_row), outline_mid_col_alpha);
+}
 
-  // Assuming the image is a round rect, compute the radius by marching
-  // diagonally from the top left corner towards the center.
-  DiagonalImageLine diagonal(rows, 1 + nine_patch->outline.left,
-                             1 + nine_patch->outline.top, 1, 1,
-                             std::min(outline_width, outline_height));
-  int32_t top_left, bottom_right;
-  FindOutlineInsets(&diagonal, &top_left, &bottom_right);
+// Single-pass form of the analysis done by NinePatch::Create.
+//
+// The top border is scanned first, since it defines the columns of the regions.
+// A single sweep down the image then gathers the left and right borders and the
+// center column, and tracks the color of every region in the current band of
+// rows. Bands are delimited by changes between stretch and non-stretch pixels
+// on the left border, which yields the same segments as the vertical stretch
+// regions once the left border has been validated.
+//
+// The borders and outline are then computed from the gathered columns and the
+// middle row. Only the pixels sampled for the outline alpha and radius, whose
+// positions depend on the computed outline, are read a second time. A tight
+// outline is tracked during the sweep, so only its radius reads pixels again.
+template <typename Validator, typename Rows, typename Hooks>
+static bool AnalyzeSinglePass(const Rows& rows, const int32_t width,
+                              const int32_t height,
+                              const NinePatchOptions& options,
+                              std::pmr::memory_resource* resource,
+                              NinePatch* nine_patch,
+                              NinePatchStatus* out_status,
+                              const Hooks& hooks) {
+  typedef typename Rows::Format Format;
+  std::pmr::vector<uint8_t> scratch(resource);
+  {
+    typename Hooks::Scope scope(hooks, NinePatchStage::kBorderScan, width);
+    if (!ScanTopBorder<Validator>(ToRgba8888<Format>(rows[0], width, &scratch),
+                                  width, resource, nine_patch, out_status)) {
+      return false;
+    }
+  }
 
-  /* Determine source radius based upon inset:
-   *     sqrt(r^2 + r^2) = sqrt(i^2 + i^2) + r
-   *     sqrt(2) * r = sqrt(2) * i + r
-   *     (sqrt(2) - 1) * r = sqrt(2) * i
-   *     r = sqrt(2) / (sqrt(2) - 1) * i
-   */
-  nine_patch->outline_radius = 3.4142f * top_left;
+  std::pmr::vector<Range> col_segments(resource);
+  SplitSegments(nine_patch->horizontal_stretch_regions, width - 2,
+                &col_segments);
+
+  RegionBand<typename Rows::Format> band(&col_segments, options.region_opacity,
+                                         resource);
+  std::vector<uint32_t>* region_colors = &nine_patch->region_colors;
+  std::vector<RegionOpacity>* region_opacities =
+      options.region_opacity ? &nine_patch->region_opacities : nullptr;
+
+  GatheredColumns columns(width, height, resource);
+  AlphaBounds alpha_bounds(width);
+  bool band_is_stretch = false;
+  {
+    typename Hooks::Scope scope(hooks, NinePatchStage::kSinglePassSweep,
+                                (int64_t)width * height);
+    for (int32_t y = 0; y < height; y++) {
+      const uint8_t* row = rows[y];
+      columns.GatherRow<Format>(row, y);
+      if (y == 0 || y == height - 1) {
+        continue;
+      }
+
+      if (options.tight_outline) {
+        alpha_bounds.AddRow(GetAlphaBoundsRow<Format>(row, width, &scratch), y);
+      }
+
+      const bool is_stretch = GetPixel<Format>(row, 0) == kPrimaryColor;
+      if (y == 1 || is_stretch != band_is_stretch) {
+        if (y != 1) {
+          band.Finish(region_colors, region_opacities);
+        }
+        band.Begin(row);
+        band_is_stretch = is_stretch;
+      }
+      band.AddRow(row);
+    }
+    band.Finish(region_colors, region_opacities);
+  }
+
+  {
+    typename Hooks::Scope scope(hooks, NinePatchStage::kBorderScan,
+                                width + 2 * height);
+    if (!ScanRemainingBorders<Validator>(
+            columns.Get(GatheredColumns::kLeft),
+            ToRgba8888<Format>(rows[height - 1], width, &scratch),
+            columns.Get(GatheredColumns::kRight), width, height, resource,
+            nine_patch, out_status, hooks)) {
+      return false;
+    }
+
+    int32_t region_count;
+    if (!CheckRegionCount(*nine_patch, width, height, &region_count,
+                          out_status)) {
+      return false;
+    }
+  }
+
+  {
+    typename Hooks::Scope scope(hooks, NinePatchStage::kOutline,
+                                options.tight_outline
+                                    ? 0
+                                    : 2 * (int64_t)(width + height));
+    if (options.tight_outline) {
+      alpha_bounds.Finish(height, nine_patch);
+    } else {
+      CalculateOutline(rows, width, height,
+                       columns.Get(GatheredColumns::kMid), nine_patch);
+    }
+  }
+
+  typename Hooks::Scope scope(hooks, NinePatchStage::kOutlineRadius,
+                              std::min(width, height) / 2);
+  CalculateOutlineRadius(rows, width, height, nine_patch);
+  return true;
+}
+
+// Pack the pixels in as 0xAARRGGBB (as 9-patch expects it).
+uint32_t NinePatch::PackRGBA(const uint8_t* pixel) {
+  return (pixel[3] << 24) | (pixel[0] << 16) | (pixel[1] << 8) | pixel[2];
+}
+
+std::unique_ptr<NinePatch> NinePatch::Create(uint8_t** rows,
+                                             const int32_t width,
+                                             const int32_t height,
+                                             std::string* out_err) {
+  return Create(rows, width, height, NinePatchOptions(), out_err);
+}
+
+// Scans the four borders of the image into `nine_patch`, and checks the number
+// of regions they define. `columns` must hold the gathered columns.
+template <typename Validator, typename Rows, typename Hooks = NoStageHooks>
+static bool ScanBorders(const Rows& rows, const int32_t width,
+                        const int32_t height, GatheredColumns* columns,
+                        std::pmr::memory_resource* resource,
+                        NinePatch* nine_patch, int32_t* out_region_count,
+                        NinePatchStatus* out_status,
+                        const Hooks& hooks = Hooks()) {
+  typename Hooks::Scope scope(hooks, NinePatchStage::kBorderScan,
+                              2 * (int64_t)(width + height));
+  // The borders are scanned as RGBA_8888 by the run kernels.
+  typedef typename Rows::Format Format;
+  std::pmr::vector<uint8_t> scratch(resource);
+  if (!ScanTopBorder<Validator>(ToRgba8888<Format>(rows[0], width, &scratch),
+                                width, resource, nine_patch, out_status)) {
+    return false;
+  }
+
+  if (!ScanRemainingBorders<Validator>(
+          columns->Get(GatheredColumns::kLeft),
+          ToRgba8888<Format>(rows[height - 1], width, &scratch),
+          columns->Get(GatheredColumns::kRight), width, height, resource,
+          nine_patch, out_status, hooks)) {
+    return false;
+  }
+
+  return CheckRegionCount(*nine_patch, width, height, out_region_count,
+                          out_status);
+}
+
+// Runs the analysis with the neutral color policy chosen by AnalyzeImage.
+// Temporary buffers are allocated from `resource`.
+template <typename Validator, typename Rows, typename Hooks>
+static bool AnalyzeWithValidator(const Rows& rows, const int32_t width,
+                                 const int32_t height,
+                                 const NinePatchOptions& options,
+                                 std::pmr::memory_resource* resource,
+                                 NinePatch* nine_patch,
+                                 NinePatchStatus* out_status,
+                                 const Hooks& hooks) {
+  if (options.single_pass) {
+    return AnalyzeSinglePass<Validator>(rows, width, height, options, resource,
+                                        nine_patch, out_status, hooks);
+  }
+
+  // Gather the left and right borders and the center column up front, so the
+  // vertical scans below read contiguous memory.
+  GatheredColumns columns(width, height, resource);
+  {
+    typename Hooks::Scope scope(hooks, NinePatchStage::kGatherColumns,
+                                3 * (int64_t)height);
+    columns.GatherAll(rows, height);
+  }
+
+  int32_t region_count;
+  if (!ScanBorders<Validator>(rows, width, height, &columns, resource,
+                              nine_patch, &region_count, out_status, hooks)) {
+    return false;
+  }
+
+  // Fill the region colors of the 9-patch.
+  {
+    typename Hooks::Scope scope(hooks, NinePatchStage::kRegionColors,
+                                (int64_t)(width - 2) * (height - 2));
+    nine_patch->region_colors.reserve(region_count);
+    std::vector<RegionOpacity>* region_opacities = nullptr;
+    if (options.region_opacity) {
+      region_opacities = &nine_patch->region_opacities;
+      region_opacities->reserve(region_count);
+    }
+    if (options.region_color_threads > 1 &&
+        (int64_t)width * height >= options.parallel_min_pixels) {
+      CalculateRegionColorsParallel(
+          rows, nine_patch->horizontal_stretch_regions,
+          nine_patch->vertical_stretch_regions, width - 2, height - 2,
+          options.region_color_threads, resource, &nine_patch->region_colors,
+          region_opacities);
+    } else {
+      CalculateRegionColors(rows, nine_patch->horizontal_stretch_regions,
+                            nine_patch->vertical_stretch_regions, width - 2,
+                            height - 2, resource, &nine_patch->region_colors,
+                            region_opacities);
+    }
+  }
+
+  {
+    typename Hooks::Scope scope(hooks, NinePatchStage::kOutline,
+                                options.tight_outline
+                                    ? (int64_t)(width - 2) * (height - 2)
+                                    : 2 * (int64_t)(width + height));
+    if (options.tight_outline) {
+      CalculateTightOutline(rows, width, height, resource, nine_patch);
+    } else {
+      CalculateOutline(rows, width, height, columns.Get(GatheredColumns::kMid),
+                       nine_patch);
+    }
+  }
+
+  typename Hooks::Scope scope(hooks, NinePatchStage::kOutlineRadius,
+                              std::min(width, height) / 2);
+  CalculateOutlineRadius(rows, width, height, nine_patch);
+  return true;
+}
+
+static bool CheckImageSize(const int32_t width, const int32_t height,
+                           NinePatchStatus* out_status) {
+  if (width < 3 || height < 3) {
+    return SetError(NinePatchErrorCode::kImageTooSmall, NinePatchEdge::kNone,
+                    -1, out_status);
+  }
+  return true;
+}
+
+// Calls `fn` with an instance of the neutral color validator chosen by the
+// top-left pixel of the image, the first pixel of `top_row`.
+template <typename Format, typename Fn>
+static bool DispatchValidator(const uint8_t* top_row, Fn fn,
+                              NinePatchStatus* out_status) {
+  const uint32_t top_left = GetPixel<Format>(top_row, 0);
+  if (get_alpha(top_left) == 0) {
+    return fn(TransparentNeutralColorValidator());
+  } else if (top_left == kColorOpaqueWhite) {
+    return fn(WhiteNeutralColorValidator());
+  }
+  return SetError(NinePatchErrorCode::kInvalidCornerColor, NinePatchEdge::kTop,
+                  0, out_status);
+}
+
+// Analyzes the image addressed by `rows` into `nine_patch`, reporting the
+// stages to `hooks`.
+template <typename Rows, typename Hooks = NoStageHooks>
+static bool AnalyzeImage(const Rows& rows, const int32_t width,
+                         const int32_t height, const NinePatchOptions& options,
+                         std::pmr::memory_resource* resource,
+                         NinePatch* nine_patch, NinePatchStatus* out_status,
+                         const Hooks& hooks = Hooks()) {
+  if (!CheckImageSize(width, height, out_status)) {
+    return false;
+  }
+
+  // Every other field is overwritten by a successful analysis.
+  nine_patch->region_colors.clear();
+  nine_patch->region_opacities.clear();
+  return DispatchValidator<typename Rows::Format>(
+      rows[0],
+      [&](auto validator) {
+        return AnalyzeWithValidator<decltype(validator)>(
+            rows, width, height, options, resource, nine_patch, out_status,
+            hooks);
+      },
+      out_status);
+}
+
+// Checks the borders of the image addressed by `rows`, stopping before the
+// region colors and outline.
+template <typename Rows>
+static void ValidateImage(const Rows& rows, const int32_t width,
+                          const int32_t height,
+                          std::pmr::memory_resource* resource,
+                          NinePatchStatus* out_status) {
+  if (!CheckImageSize(width, height, out_status)) {
+    return;
+  }
+
+  DispatchValidator<typename Rows::Format>(
+      rows[0],
+      [&](auto validator) {
+        // Receives the stretch regions and bounds, which are then dropped.
+        NinePatch nine_patch;
+        GatheredColumns columns(width, height, resource,
+                                GatheredColumns::kBorderCount);
+        columns.GatherAll(rows, height);
+        int32_t region_count;
+        return ScanBorders<decltype(validator)>(rows, width, height, &columns,
+                                                resource, &nine_patch,
+                                                &region_count, out_status);
+      },
+      out_status);
+}
+
+// Copies every field of `from` into `to`.
+static void CopyNinePatch(const NinePatch& from, NinePatch* to) {
+  to->padding = from.padding;
+  to->layout_bounds = from.layout_bounds;
+  to->outline = from.outline;
+  to->outline_radius = from.outline_radius;
+  to->outline_alpha = from.outline_alpha;
+  to->horizontal_stretch_regions = from.horizontal_stretch_regions;
+  to->vertical_stretch_regions = from.vertical_stretch_regions;
+  to->region_colors = from.region_colors;
+  to->region_opacities = from.region_opacities;
+}
+
+// Returns the state of the region covering the rows of `row_segment` and the
+// columns of `col_segment`, the same way RegionBand does.
+template <typename Rows>
+static RegionColorState CalculateRegionState(const Rows& rows,
+                                             const Range& row_segment,
+                                             const Range& col_segment,
+                                             const bool track_opacity) {
+  typedef typename Rows::Format Format;
+  RegionColorState state;
+  state.present = true;
+  state.expected_color =
+      GetPixel<Format>(rows[row_segment.start], col_segment.start);
+  state.opaque = get_alpha(state.expected_color) == 0xff;
+  for (int32_t y = row_segment.start; y < row_segment.end; y++) {
+    if (!state.no_color &&
+        RowMatchesColor<Format>(rows[y], col_segment.start, col_segment.end,
+                                state.expected_color)) {
+      continue;
+    }
+    state.no_color = true;
+    state.opaque = track_opacity && state.opaque &&
+                   RowIsOpaque<Format>(rows[y], col_segment.start,
+                                       col_segment.end);
+    if (!state.opaque) {
+      break;
+    }
+  }
+  return state;
+}
+
+// Recomputes the colors of the regions intersecting `dirty`, keeping the other
+// entries of region_colors. The opacities are recomputed along if the
+// NinePatch has them.
+template <typename Rows>
+static void UpdateRegionColors(const Rows& rows, const int32_t width,
+                               const int32_t height, const Rect& dirty,
+                               std::pmr::memory_resource* resource,
+                               NinePatch* nine_patch) {
+  std::pmr::vector<Range> row_segments(resource);
+  std::pmr::vector<Range> col_segments(resource);
+  SplitSegments(nine_patch->vertical_stretch_regions, height - 2,
+                &row_segments);
+  SplitSegments(nine_patch->horizontal_stretch_regions, width - 2,
+                &col_segments);
+  const bool track_opacity = !nine_patch->region_opacities.empty();
+
+  for (size_t j = 0; j < row_segments.size(); j++) {
+    if (row_segments[j].end <= dirty.top ||
+        row_segments[j].start >= dirty.bottom) {
+      continue;
+    }
+    for (size_t i = 0; i < col_segments.size(); i++) {
+      if (col_segments[i].end <= dirty.left ||
+          col_segments[i].start >= dirty.right) {
+        continue;
+      }
+      const RegionColorState state = CalculateRegionState(
+          rows, row_segments[j], col_segments[i], track_opacity);
+      const size_t r = j * col_segments.size() + i;
+      nine_patch->region_colors[r] = state.GetColor();
+      if (track_opacity) {
+        nine_patch->region_opacities[r] = state.GetOpacity();
+      }
+    }
+  }
+}
+
+// Returns true if `dirty` intersects one of the lines CalculateOutline()
+// sampled to find the outline of `nine_patch`.
+static bool IntersectsOutlineSamples(const NinePatch& nine_patch,
+                                     const int32_t width, const int32_t height,
+                                     const Rect& dirty) {
+  auto intersects_row = [&](int32_t y, int32_t left, int32_t right) {
+    return y >= dirty.top && y < dirty.bottom && left < dirty.right &&
+           right > dirty.left;
+  };
+  auto intersects_col = [&](int32_t x, int32_t top, int32_t bottom) {
+    return x >= dirty.left && x < dirty.right && top < dirty.bottom &&
+           bottom > dirty.top;
+  };
+
+  // The insets come from the center row and column.
+  if (intersects_row(height / 2, 1, width - 1) ||
+      intersects_col(width / 2, 1, height - 1)) {
+    return true;
+  }
+
+  // The alpha comes from the middle row and column of the outline.
+  const int32_t left = 1 + nine_patch.outline.left;
+  const int32_t top = 1 + nine_patch.outline.top;
+  const int32_t outline_width =
+      (width - 2) - nine_patch.outline.left - nine_patch.outline.right;
+  const int32_t outline_height =
+      (height - 2) - nine_patch.outline.top - nine_patch.outline.bottom;
+  if (intersects_row(top + outline_height / 2, left, left + outline_width) ||
+      intersects_col(left + outline_width / 2, top, top + outline_height)) {
+    return true;
+  }
+
+  // The radius comes from the diagonal starting at the top left corner of the
+  // outline. Pixel i of the diagonal is at (left + i, top + i).
+  const int32_t first =
+      std::max(std::max(dirty.left - left, dirty.top - top), 0);
+  const int32_t last = std::min(
+      std::min(dirty.right - left, dirty.bottom - top),
+      std::min(outline_width, outline_height));
+  return first < last;
+}
+
+// Analyzes the image addressed by `rows` into `nine_patch`, given the result
+// `prev` of analyzing it before the pixels in `dirty` changed.
+template <typename Rows>
+static bool UpdateImage(const NinePatch& prev, const Rows& rows,
+                        const int32_t width, const int32_t height, Rect dirty,
+                        const NinePatchOptions& options,
+                        std::pmr::memory_resource* resource,
+                        NinePatch* nine_patch, NinePatchStatus* out_status) {
+  if (!CheckImageSize(width, height, out_status)) {
+    return false;
+  }
+
+  dirty = Rect(std::max(dirty.left, 0), std::max(dirty.top, 0),
+               std::min(dirty.right, width), std::min(dirty.bottom, height));
+  if (dirty.empty()) {
+    CopyNinePatch(prev, nine_patch);
+    return true;
+  }
+
+  if (dirty.left == 0 || dirty.top == 0) {
+    // The stretch regions, and with them every region, or the neutral color
+    // may have changed.
+    return AnalyzeImage(rows, width, height, options, resource, nine_patch,
+                        out_status);
+  }
+
+  CopyNinePatch(prev, nine_patch);
+  if (dirty.right == width || dirty.bottom == height) {
+    // The padding or layout bounds may have changed. The stretch regions, and
+    // so the region count, stay the same.
+    const bool scanned = DispatchValidator<typename Rows::Format>(
+        rows[0],
+        [&](auto validator) {
+          GatheredColumns columns(width, height, resource);
+          columns.GatherAll(rows, height);
+          int32_t region_count;
+          return ScanBorders<decltype(validator)>(
+              rows, width, height, &columns, resource, nine_patch,
+              &region_count, out_status);
+        },
+        out_status);
+    if (!scanned) {
+      return false;
+    }
+  }
+
+  const Rect content(dirty.left, dirty.top, std::min(dirty.right, width - 1),
+                     std::min(dirty.bottom, height - 1));
+  if (content.empty()) {
+    return true;
+  }
+
+  UpdateRegionColors(rows, width, height, content, resource, nine_patch);
+  if (options.tight_outline) {
+    CalculateTightOutline(rows, width, height, resource, nine_patch);
+    CalculateOutlineRadius(rows, width, height, nine_patch);
+  } else if (IntersectsOutlineSamples(prev, width, height, content)) {
+    GatheredColumns columns(width, height, resource);
+    columns.GatherAll(rows, height);
+    CalculateOutline(rows, width, height, columns.Get(GatheredColumns::kMid),
+                     nine_patch);
+    CalculateOutlineRadius(rows, width, height, nine_patch);
+  }
+  return true;
+}
+
+// Calls `fn` with an instance of the Format accessor for `pixel_format`, so
+// that the analysis is instantiated once per format.
+template <typename Fn>
+static bool DispatchPixelFormat(const PixelFormat pixel_format, Fn fn) {
+  switch (pixel_format) {
+    case PixelFormat::kBGRA_8888:
+      return fn(Bgra8888Format());
+    case PixelFormat::kRGBA_8888_Premul:
+      return fn(PremulRgba8888Format());
+    case PixelFormat::kRGBA_F16:
+      return fn(RgbaF16Format());
+    case PixelFormat::kA8:
+      return fn(A8Format());
+    case PixelFormat::kRGBA_8888:
+      break;
+  }
+  return fn(Rgba8888Format());
+}
+
+std::unique_ptr<NinePatch> NinePatch::Create(uint8_t** rows,
+                                             const int32_t width,
+                                             const int32_t height,
+                                             const NinePatchOptions& options,
+                                             std::string* out_err) {
+  auto nine_patch = util::make_unique<NinePatch>();
+  if (!Analyze(rows, width, height, options, nine_patch.get(), nullptr,
+               out_err)) {
+    return {};
+  }
+  return nine_patch;
+}
+
+std::unique_ptr<NinePatch> NinePatch::Create(const uint8_t* base,
+                                             const size_t stride_bytes,
+                                             const int32_t x, const int32_t y,
+                                             const int32_t width,
+                                             const int32_t height,
+                                             std::string* out_err) {
+  return Create(base, stride_bytes, x, y, width, height, NinePatchOptions(),
+                out_err);
+}
+
+std::unique_ptr<NinePatch> NinePatch::Create(const uint8_t* base,
+                                             const size_t stride_bytes,
+                                             const int32_t x, const int32_t y,
+                                             const int32_t width,
+                                             const int32_t height,
+                                             const NinePatchOptions& options,
+                                             std::string* out_err) {
+  auto nine_patch = util::make_unique<NinePatch>();
+  if (!Analyze(base, stride_bytes, x, y, width, height, options,
+               nine_patch.get(), nullptr, out_err)) {
+    return {};
+  }
+  return nine_patch;
+}
+
+// Returns options.memory_resource, or the default resource if it is not set.
+static std::pmr::memory_resource* GetMemoryResource(
+    const NinePatchOptions& options) {
+  return options.memory_resource != nullptr ? options.memory_resource
+                                            : std::pmr::get_default_resource();
+}
+
+// Runs AnalyzeImage with stage hooks reporting to options.instrumentation, or
+// with the empty hooks if it is not set.
+template <typename Rows>
+static bool AnalyzeWithHooks(const Rows& rows, const int32_t width,
+                             const int32_t height,
+                             const NinePatchOptions& options,
+                             CountingMemoryResource* resource,
+                             NinePatch* nine_patch,
+                             NinePatchStatus* out_status) {
+  if (options.instrumentation != nullptr) {
+    return AnalyzeImage(rows, width, height, options, resource, nine_patch,
+                        out_status,
+                        ReportingStageHooks(options.instrumentation, resource));
+  }
+  return AnalyzeImage(rows, width, height, options, resource, nine_patch,
+                      out_status);
+}
+
+bool NinePatch::Analyze(uint8_t** rows, const int32_t width,
+                        const int32_t height, const NinePatchOptions& options,
+                        NinePatch* nine_patch, size_t* out_bytes_used,
+                        std::string* out_err) {
+  CountingMemoryResource resource(GetMemoryResource(options));
+  NinePatchStatus status;
+  const bool analyzed =
+      DispatchPixelFormat(options.pixel_format, [&](auto format) {
+        typedef decltype(format) Format;
+        return AnalyzeWithHooks(RowTable<Format>(rows), width, height,
+                                options, &resource, nine_patch, &status);
+      });
+  if (out_bytes_used != nullptr) {
+    *out_bytes_used = resource.bytes_allocated();
+  }
+  if (!analyzed) {
+    *out_err = status.Message();
+  }
+  return analyzed;
+}
+
+bool NinePatch::Analyze(const uint8_t* base, const size_t stride_bytes,
+                        const int32_t x, const int32_t y, const int32_t width,
+                        const int32_t height, const NinePatchOptions& options,
+                        NinePatch* nine_patch, size_t* out_bytes_used,
+                        std::string* out_err) {
+  CountingMemoryResource resource(GetMemoryResource(options));
+  NinePatchStatus status;
+  const bool analyzed =
+      DispatchPixelFormat(options.pixel_format, [&](auto format) {
+        typedef decltype(format) Format;
+        const StridedRows<Format> rows(
+            base + y * stride_bytes + x * Format::kBytesPerPixel,
+            stride_bytes);
+        return AnalyzeWithHooks(rows, width, height, options, &resource,
+                                nine_patch, &status);
+      });
+  if (out_bytes_used != nullptr) {
+    *out_bytes_used = resource.bytes_allocated();
+  }
+  if (!analyzed) {
+    *out_err = status.Message();
+  }
+  return analyzed;
+}
+
+NinePatchStatus NinePatch::Validate(uint8_t** rows, const int32_t width,
+                                    const int32_t height) {
+  return Validate(rows, width, height, NinePatchOptions());
+}
+
+NinePatchStatus NinePatch::Validate(uint8_t** rows, const int32_t width,
+                                    const int32_t height,
+                                    const NinePatchOptions& options) {
+  NinePatchStatus status;
+  DispatchPixelFormat(options.pixel_format, [&](auto format) {
+    typedef decltype(format) Format;
+    ValidateImage(RowTable<Format>(rows), width, height,
+                  GetMemoryResource(options), &status);
+    return status.ok();
+  });
+  return status;
+}
+
+NinePatchStatus NinePatch::Validate(const uint8_t* base,
+                                    const size_t stride_bytes, const int32_t x,
+                                    const int32_t y, const int32_t width,
+                                    const int32_t height,
+                                    const NinePatchOptions& options) {
+  NinePatchStatus status;
+  DispatchPixelFormat(options.pixel_format, [&](auto format) {
+    typedef decltype(format) Format;
+    const StridedRows<Format> rows(
+        base + y * stride_bytes + x * Format::kBytesPerPixel, stride_bytes);
+    ValidateImage(rows, width, height, GetMemoryResource(options), &status);
+    return status.ok();
+  });
+  return status;
+}
+
+std::unique_ptr<NinePatch> NinePatch::Update(const NinePatch& prev,
+                                             uint8_t** rows,
+                                             const int32_t width,
+                                             const int32_t height,
+                                             const Rect& dirty,
+                                             std::string* out_err) {
+  return Update(prev, rows, width, height, dirty, NinePatchOptions(),
+                out_err);
+}
+
+std::unique_ptr<NinePatch> NinePatch::Update(const NinePatch& prev,
+                                             uint8_t** rows,
+                                             const int32_t width,
+                                             const int32_t height,
+                                             const Rect& dirty,
+                                             const NinePatchOptions& options,
+                                             std::string* out_err) {
+  auto nine_patch = util::make_unique<NinePatch>();
+  NinePatchStatus status;
+  const bool updated =
+      DispatchPixelFormat(options.pixel_format, [&](auto format) {
+        typedef decltype(format) Format;
+        return UpdateImage(prev, RowTable<Format>(rows), width, height, dirty,
+                           options, GetMemoryResource(options),
+                           nine_patch.get(), &status);
+      });
+  if (!updated) {
+    *out_err = status.Message();
+    return {};
+  }
   return nine_patch;
 }
 
+static const char* GetEdgeName(const NinePatchEdge edge) {
+  switch (edge) {
+    case NinePatchEdge::kTop:
+      return "top";
+    case NinePatchEdge::kLeft:
+      return "left";
+    case NinePatchEdge::kBottom:
+      return "bottom";
+    case NinePatchEdge::kRight:
+      return "right";
+    case NinePatchEdge::kNone:
+      break;
+  }
+  return "";
+}
+
+std::string NinePatchStatus::Message() const {
+  std::stringstream err_stream;
+  switch (code) {
+    case NinePatchErrorCode::kOk:
+      break;
+    case NinePatchErrorCode::kImageTooSmall:
+      err_stream << "image must be at least 3x3 (1x1 image with 1 pixel "
+                    "border)";
+      break;
+    case NinePatchErrorCode::kInvalidCornerColor:
+      err_stream << "top-left corner pixel must be either opaque white or "
+                    "transparent";
+      break;
+    case NinePatchErrorCode::kInvalidColor:
+      err_stream << "found an invalid color";
+      break;
+    case NinePatchErrorCode::kUnexpectedOpticalBounds:
+      err_stream << "found unexpected optical bounds (red pixel) on "
+                 << GetEdgeName(edge) << " border at "
+                 << (edge == NinePatchEdge::kTop ? "x=" : "y=") << position;
+      break;
+    case NinePatchErrorCode::kTooManyPaddingSections:
+      err_stream << "too many padding sections on " << GetEdgeName(edge)
+                 << " border";
+      break;
+    case NinePatchErrorCode::kTooManyLayoutBoundsSections:
+      err_stream << "too many layout bounds sections on " << GetEdgeName(edge)
+                 << " border";
+      break;
+    case NinePatchErrorCode::kLayoutBoundsNotAtEdge:
+      err_stream << "layout bounds on " << GetEdgeName(edge)
+                 << " border must start at edge";
+      break;
+    case NinePatchErrorCode::kTooManyRegions:
+      err_stream << "too many regions in 9-patch";
+      break;
+  }
+  return err_stream.str();
+}
+
+// The streaming analysis behind NinePatchBuilder. It is created from the first
+// row, once the neutral color and the pixel format are known.
+class NinePatchBuilder::Analysis {
+ public:
+  virtual ~Analysis() = default;
+
+  virtual bool AddRow(const uint8_t* row, int32_t y, NinePatch* nine_patch,
+                      NinePatchStatus* out_status) = 0;
+
+  virtual bool Finish(NinePatch* nine_patch, NinePatchStatus* out_status) = 0;
+};
+
+// Streaming form of AnalyzeSinglePass. Each row is visited exactly once:
+//
+// - The top border is scanned from row 0, and the bottom border is kept until
+//   Finish(), where all the remaining borders are scanned in the same order as
+//   NinePatch::Create() does, so the same error is reported.
+// - The left and right borders and the center column are gathered, and the
+//   region colors are tracked band by band.
+// - The outline samples of a row depend on the left, right and top insets of
+//   the outline, which are known once the center row is added. Until then the
+//   alpha of the rows is kept. Afterwards each row is reduced to its samples
+//   right away: the alpha of the outline's middle column and of the diagonal,
+//   and the largest alpha within the outline's columns. The bottom inset, and
+//   so which of those samples are used, is only known in Finish().
+template <typename Validator, typename Format>
+class StreamingAnalysis : public NinePatchBuilder::Analysis {
+ public:
+  explicit StreamingAnalysis(const int32_t width, const int32_t height,
+                             const bool track_opacity,
+                             std::pmr::memory_resource* resource)
+      : width_(width),
+        height_(height),
+        mid_y_(height / 2),
+        track_opacity_(track_opacity),
+        resource_(resource),
+        col_segments_(resource),
+        columns_(width, height, resource),
+        bottom_row_(resource),
+        alpha_(resource),
+        outline_col_alpha_(height, resource),
+        diagonal_alpha_(height, resource),
+        outline_row_max_alpha_(height, resource) {}
+
+  bool AddRow(const uint8_t* row, const int32_t y, NinePatch* nine_patch,
+              NinePatchStatus* out_status) override {
+    columns_.GatherRow<Format>(row, y);
+    if (y == 0) {
+      std::pmr::vector<uint8_t> scratch(resource_);
+      if (!ScanTopBorder<Validator>(ToRgba8888<Format>(row, width_, &scratch),
+                                    width_, resource_, nine_patch,
+                                    out_status)) {
+        return false;
+      }
+      SplitSegments(nine_patch->horizontal_stretch_regions, width_ - 2,
+                    &col_segments_);
+      band_.reset(new RegionBand<Format>(&col_segments_, track_opacity_,
+                                         resource_));
+      nine_patch->region_colors.clear();
+      nine_patch->region_opacities.clear();
+      return true;
+    } else if (y == height_ - 1) {
+      std::pmr::vector<uint8_t> scratch(resource_);
+      const uint8_t* bottom_row = ToRgba8888<Format>(row, width_, &scratch);
+      bottom_row_.assign(bottom_row, bottom_row + width_ * 4);
+      return true;
+    }
+
+    const bool is_stretch = GetPixel<Format>(row, 0) == kPrimaryColor;
+    if (y == 1 || is_stretch != band_is_stretch_) {
+      if (y != 1) {
+        band_->Finish(&nine_patch->region_colors, RegionOpacities(nine_patch));
+      }
+      band_->Begin(row);
+      band_is_stretch_ = is_stretch;
+    }
+    band_->AddRow(row);
+
+    if (y < mid_y_) {
+      KeepAlpha(row);
+    } else if (y == mid_y_) {
+      KeepAlpha(row);
+      FindOutlineStart(row);
+      for (int32_t kept_y = 1; kept_y <= mid_y_; kept_y++) {
+        SampleOutline<A8Format>(alpha_.data() + (kept_y - 1) * width_, kept_y);
+      }
+      std::pmr::vector<uint8_t>(resource_).swap(alpha_);
+    } else {
+      SampleOutline<Format>(row, y);
+    }
+    return true;
+  }
+
+  bool Finish(NinePatch* nine_patch, NinePatchStatus* out_status) override {
+    band_->Finish(&nine_patch->region_colors, RegionOpacities(nine_patch));
+
+    if (!ScanRemainingBorders<Validator>(
+            columns_.Get(GatheredColumns::kLeft), bottom_row_.data(),
+            columns_.Get(GatheredColumns::kRight), width_, height_,
+            resource_, nine_patch, out_status)) {
+      return false;
+    }
+
+    int32_t region_count;
+    if (!CheckRegionCount(*nine_patch, width_, height_, &region_count,
+                          out_status)) {
+      return false;
+    }
+
+    const StridedRows<Rgba8888Format> mid_col_rows(
+        columns_.Get(GatheredColumns::kMid), 0);
+    HorizontalImageLine mid_col(mid_col_rows, 1, 0, height_ - 2);
+    nine_patch->outline.left = outline_left_;
+    nine_patch->outline.right = outline_right_;
+    FindOutlineInsets(&mid_col, &nine_patch->outline.top,
+                      &nine_patch->outline.bottom);
+
+    const int32_t outline_top = nine_patch->outline.top;
+    const int32_t outline_height =
+        (height_ - 2) - outline_top - nine_patch->outline.bottom;
+
+    const StridedRows<A8Format> outline_col_rows(outline_col_alpha_.data(), 0);
+    HorizontalImageLine outline_mid_col(outline_col_rows, 1 + outline_top, 0,
+                                        outline_height);
+    nine_patch->outline_alpha = std::max(
+        static_cast<uint32_t>(
+            outline_row_max_alpha_[1 + outline_top + (outline_height / 2)]),
+        FindMaxAlpha(&outline_mid_col));
+
+    const StridedRows<A8Format> diagonal_rows(diagonal_alpha_.data(), 0);
+    HorizontalImageLine diagonal(diagonal_rows, 1 + outline_top, 0,
+                                 std::min(outline_width_, outline_height));
+    int32_t top_left;
+    FindOutlineInsets(&diagonal, &top_left, nullptr);
+    nine_patch->outline_radius = 3.4142f * top_left;
+    return true;
+  }
+
+ private:
+  // Returns the vector the band appends the region opacities to, or null if
+  // they are not tracked.
+  std::vector<RegionOpacity>* RegionOpacities(NinePatch* nine_patch) const {
+    return track_opacity_ ? &nine_patch->region_opacities : nullptr;
+  }
+
+  // Appends the alpha of a row above the center row.
+  void KeepAlpha(const uint8_t* row) {
+    for (int32_t x = 0; x < width_; x++) {
+      alpha_.push_back(get_alpha(GetPixel<Format>(row, x)));
+    }
+  }
+
+  // Finds the left, right and top insets of the outline. The top inset only
+  // depends on the upper half of the center column, which is gathered by the
+  // time the center row is added.
+  void FindOutlineStart(const uint8_t* center_row) {
+    const StridedRows<Format> center_row_rows(center_row, 0);
+    HorizontalImageLine mid_row(center_row_rows, 1, 0, width_ - 2);
+    FindOutlineInsets(&mid_row, &outline_left_, &outline_right_);
+
+    const StridedRows<Rgba8888Format> mid_col_rows(
+        columns_.Get(GatheredColumns::kMid), 0);
+    HorizontalImageLine mid_col(mid_col_rows, 1, 0, height_ - 2);
+    FindOutlineInsets(&mid_col, &outline_top_, nullptr);
+
+    outline_width_ = (width_ - 2) - outline_left_ - outline_right_;
+    outline_mid_x_ = 1 + outline_left_ + (outline_width_ / 2);
+  }
+
+  // Records the outline samples of row `y`.
+  template <typename RowFormat>
+  void SampleOutline(const uint8_t* row, const int32_t y) {
+    outline_col_alpha_[y] = get_alpha(GetPixel<RowFormat>(row, outline_mid_x_));
+
+    // The diagonal starts at (1 + left, 1 + top) and steps by (1, 1).
+    const int32_t diagonal_x = 1 + outline_left_ + (y - 1 - outline_top_);
+    if (y > outline_top_ && diagonal_x < width_ - 1) {
+      diagonal_alpha_[y] = get_alpha(GetPixel<RowFormat>(row, diagonal_x));
+    }
+
+    const StridedRows<RowFormat> rows(row, 0);
+    HorizontalImageLine outline_row(rows, 1 + outline_left_, 0,
+                                    outline_width_);
+    outline_row_max_alpha_[y] = FindMaxAlpha(&outline_row);
+  }
+
+  const int32_t width_;
+  const int32_t height_;
+  const int32_t mid_y_;
+  const bool track_opacity_;
+  std::pmr::memory_resource* resource_;
+
+  std::pmr::vector<Range> col_segments_;
+  std::unique_ptr<RegionBand<Format>> band_;
+  bool band_is_stretch_ = false;
+
+  GatheredColumns columns_;
+  std::pmr::vector<uint8_t> bottom_row_;
+
+  // The alpha of rows 1 to mid_y_, until the center row is added.
+  std::pmr::vector<uint8_t> alpha_;
+  int32_t outline_left_ = 0;
+  int32_t outline_right_ = 0;
+  int32_t outline_top_ = 0;
+  int32_t outline_width_ = 0;
+  int32_t outline_mid_x_ = 0;
+
+  // Outline samples, indexed by row.
+  std::pmr::vector<uint8_t> outline_col_alpha_;
+  std::pmr::vector<uint8_t> diagonal_alpha_;
+  std::pmr::vector<uint8_t> outline_row_max_alpha_;
+
+  DISALLOW_COPY_AND_ASSIGN(StreamingAnalysis);
+};
+
+NinePatchBuilder::NinePatchBuilder(const int32_t width, const int32_t height)
+    : NinePatchBuilder(width, height, NinePatchOptions()) {}
+
+NinePatchBuilder::NinePatchBuilder(const int32_t width, const int32_t height,
+                                   const NinePatchOptions& options)
+    : width_(width),
+      height_(height),
+      options_(options),
+      nine_patch_(util::make_unique<NinePatch>()) {}
+
+NinePatchBuilder::~NinePatchBuilder() = default;
+
+bool NinePatchBuilder::Fail(const std::string& err, std::string* out_err) {
+  failed_ = true;
+  error_ = err;
+  *out_err = err;
+  return false;
+}
+
+bool NinePatchBuilder::AddRow(const uint8_t* row, std::string* out_err) {
+  if (failed_) {
+    *out_err = error_;
+    return false;
+  }
+
+  if (next_row_ >= height_) {
+    return Fail("too many rows added to 9-patch", out_err);
+  }
+
+  NinePatchStatus status;
+  const int32_t y = next_row_++;
+  if (y == 0) {
+    if (!CheckImageSize(width_, height_, &status)) {
+      return Fail(status.Message(), out_err);
+    }
+
+    const bool started =
+        DispatchPixelFormat(options_.pixel_format, [&](auto format) {
+          typedef decltype(format) Format;
+          return DispatchValidator<Format>(
+              row,
+              [&](auto validator) {
+                typedef decltype(validator) Validator;
+                analysis_.reset(new StreamingAnalysis<Validator, Format>(
+                    width_, height_, options_.region_opacity,
+                    GetMemoryResource(options_)));
+                return true;
+              },
+              &status);
+        });
+    if (!started) {
+      return Fail(status.Message(), out_err);
+    }
+  }
+
+  if (!analysis_->AddRow(row, y, nine_patch_.get(), &status)) {
+    return Fail(status.Message(), out_err);
+  }
+  return true;
+}
+
+std::unique_ptr<NinePatch> NinePatchBuilder::Finish(std::string* out_err) {
+  if (failed_) {
+    *out_err = error_;
+    return {};
+  }
+
+  // AddRow checks the size on the first row, which a 9-patch with no rows
+  // never gets.
+  NinePatchStatus status;
+  if (!CheckImageSize(width_, height_, &status)) {
+    Fail(status.Message(), out_err);
+    return {};
+  }
+
+  if (next_row_ != height_) {
+    std::stringstream err_stream;
+    err_stream << "9-patch has " << height_ << " rows but " << next_row_
+               << " were added";
+    Fail(err_stream.str(), out_err);
+    return {};
+  }
+
+  if (!analysis_->Finish(nine_patch_.get(), &status)) {
+    Fail(status.Message(), out_err);
+    return {};
+  }
+  failed_ = true;
+  error_ = "9-patch builder already finished";
+  return std::move(nine_patch_);
+}
+
 std::unique_ptr<uint8_t[]> NinePatch::SerializeBase(size_t* outLen) const {
   android::Res_png_9patch data;
   data.numXDivs = static_cast<uint8_t>(horizontal_stretch_regions.size()) * 2;
@@ -715,6 +2544,18 @@ std::unique_ptr<uint8_t[]> NinePatch::SerializeRoundedRectOutline(
   return buffer;
 }
 
+std::unique_ptr<uint8_t[]> NinePatch::SerializeRegionOpacities(
+    size_t* out_len) const {
+  size_t chunk_len = region_opacities.size();
+  auto buffer = std::unique_ptr<uint8_t[]>(new uint8_t[chunk_len]);
+  for (size_t i = 0; i < chunk_len; i++) {
+    buffer[i] = static_cast<uint8_t>(region_opacities[i]);
+  }
+
+  *out_len = chunk_len;
+  return buffer;
+}
+
 ::std::ostream& operator<<(::std::ostream& out, const Range& range) {
   return out << "[" << range.start << ", " << range.end << ")";
 }
@@ -0,0 +1,176 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "image.h"
+
+#include <algorithm>
+#include <memory_resource>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace aapt {
+
+/**
+ * The indices of the images of a batch, split into one contiguous share per
+ * worker. A worker takes the images of its own share from the front. Once its
+ * share is empty, it steals the back half of the largest share left, which
+ * becomes its own. Shares stay contiguous, and halving them keeps steals rare
+ * until the last few images.
+ *
+ * Each share has its own lock, which the owner only contends for with thieves.
+ */
+class BatchQueue {
+ public:
+  explicit BatchQueue(const size_t count, const int32_t worker_count)
+      : shares_(worker_count) {
+    for (int32_t i = 0; i < worker_count; i++) {
+      shares_[i].begin = count * i / worker_count;
+      shares_[i].end = count * (i + 1) / worker_count;
+    }
+  }
+
+  /**
+   * Sets `out_index` to the next image for `worker` to analyze. Returns false
+   * once every image was taken.
+   */
+  bool Next(const int32_t worker, size_t* out_index) {
+    Share& own = shares_[worker];
+    {
+      std::lock_guard<std::mutex> lock(own.mutex);
+      if (own.begin < own.end) {
+        *out_index = own.begin++;
+        return true;
+      }
+    }
+    return Steal(worker, out_index);
+  }
+
+ private:
+  // Aligned to a cache line, so that workers taking images from their own
+  // shares do not invalidate each other's.
+  struct alignas(64) Share {
+    std::mutex mutex;
+    size_t begin = 0;
+    size_t end = 0;
+  };
+
+  bool Steal(const int32_t worker, size_t* out_index) {
+    for (;;) {
+      Share* victim = nullptr;
+      size_t most = 0;
+      for (Share& share : shares_) {
+        if (&share == &shares_[worker]) {
+          continue;
+        }
+        std::lock_guard<std::mutex> lock(share.mutex);
+        if (share.end - share.begin > most) {
+          most = share.end - share.begin;
+          victim = &share;
+        }
+      }
+      if (victim == nullptr) {
+        return false;
+      }
+
+      size_t begin;
+      size_t end;
+      {
+        std::lock_guard<std::mutex> lock(victim->mutex);
+        const size_t left = victim->end - victim->begin;
+        if (left == 0) {
+          // Taken by its owner or another thief since the scan; look again.
+          continue;
+        }
+        end = victim->end;
+        begin = end - (left + 1) / 2;
+        victim->end = begin;
+      }
+
+      Share& own = shares_[worker];
+      std::lock_guard<std::mutex> lock(own.mutex);
+      own.begin = begin + 1;
+      own.end = end;
+      *out_index = begin;
+      return true;
+    }
+  }
+
+  std::vector<Share> shares_;
+
+  DISALLOW_COPY_AND_ASSIGN(BatchQueue);
+};
+
+// Analyzes `image` into `out_result`.
+static void AnalyzeBatchImage(const ImageRef& image,
+                              const NinePatchOptions& options,
+                              NinePatchResult* out_result) {
+  std::unique_ptr<NinePatch> nine_patch(new NinePatch());
+  bool ok;
+  if (image.rows != nullptr) {
+    ok = NinePatch::Analyze(image.rows, image.width, image.height, options,
+                            nine_patch.get(), nullptr, &out_result->error);
+  } else {
+    ok = NinePatch::Analyze(image.base, image.stride_bytes, image.x, image.y,
+                            image.width, image.height, options,
+                            nine_patch.get(), nullptr, &out_result->error);
+  }
+  if (ok) {
+    out_result->nine_patch = std::move(nine_patch);
+  }
+}
+
+std::vector<NinePatchResult> NinePatch::CreateBatch(
+    const ImageRef* images, const size_t count,
+    const NinePatchOptions& options) {
+  std::vector<NinePatchResult> results(count);
+  if (count == 0) {
+    return results;
+  }
+
+  size_t thread_count = options.batch_threads > 0
+                            ? static_cast<size_t>(options.batch_threads)
+                            : std::thread::hardware_concurrency();
+  thread_count = std::max<size_t>(1, std::min(thread_count, count));
+
+  BatchQueue queue(count, static_cast<int32_t>(thread_count));
+  auto work = [&](const int32_t worker) {
+    // The pool keeps the blocks freed by one analysis for the next, so after
+    // the first few images the temporary buffers come from memory this thread
+    // already owns, without touching the shared heap.
+    std::pmr::unsynchronized_pool_resource scratch;
+    NinePatchOptions worker_options = options;
+    worker_options.memory_resource = &scratch;
+
+    size_t index;
+    while (queue.Next(worker, &index)) {
+      AnalyzeBatchImage(images[index], worker_options, &results[index]);
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i + 1 < thread_count; i++) {
+    threads.emplace_back(work, static_cast<int32_t>(i));
+  }
+  // The calling thread is the last worker.
+  work(static_cast<int32_t>(thread_count - 1));
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  return results;
+}
+
+}  // namespace aapt
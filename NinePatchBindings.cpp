@@ -19,6 +19,7 @@
 #define LOG_TAG "9patch"
 
 #include "NinePatchBindings.h"
+#include "NinePatchRegion.h"
 
 //#include "NinePatchPeeker.h"
 //#include "NinePatchUtils.h"
@@ -62,44 +63,38 @@ CSHARP_BINDING_API void SkNinePatchGlue_finalize(int8_t * patch) {
     delete[] patch;
 }
 
-// static jlong getTransparentRegion(JNIEnv* env, jobject, jlong bitmapPtr,
-//         jlong chunkHandle, jobject dstRect) {
-//     Res_png_9patch* chunk = reinterpret_cast<Res_png_9patch*>(chunkHandle);
-//     SkASSERT(chunk);
-//
-//     SkBitmap bitmap;
-//     bitmap::toBitmap(bitmapPtr).getSkBitmap(&bitmap);
-//     SkRect dst;
-//     GraphicsJNI::jrect_to_rect(env, dstRect, &dst);
-//
-//     SkCanvas::Lattice lattice;
-//     SkIRect src = SkIRect::MakeWH(bitmap.width(), bitmap.height());
-//     lattice.fBounds = &src;
-//     NinePatchUtils::SetLatticeDivs(&lattice, *chunk, bitmap.width(), bitmap.height());
-//     lattice.fRectTypes = nullptr;
-//     lattice.fColors = nullptr;
-//
-//     SkRegion* region = nullptr;
-//     if (SkLatticeIter::Valid(bitmap.width(), bitmap.height(), lattice)) {
-//         SkLatticeIter iter(lattice, dst);
-//         if (iter.numRectsToDraw() == chunk->numColors) {
-//             SkRect dummy;
-//             SkRect iterDst;
-//             int index = 0;
-//             while (iter.next(&dummy, &iterDst)) {
-//                 if (0 == chunk->getColors()[index++] && !iterDst.isEmpty()) {
-//                     if (!region) {
-//                         region = new SkRegion();
-//                     }
-//
-//                     region->op(iterDst.round(), SkRegion::kUnion_Op);
-//                 }
-//             }
-//         }
-//     }
-//
-//     return reinterpret_cast<jlong>(region);
-// }
+/**
+ * Writes the area covered by the transparent patches of |patch|, drawn from a
+ * bitmapWidth x bitmapHeight bitmap into the destination rectangle, to
+ * |outRects| as up to |maxRects| rectangles of 4 int32_t each: left, top,
+ * right and bottom. The rectangles are disjoint, in y-x bands (see
+ * aapt::GetNinePatchTransparentRegion). Returns the number of rectangles of
+ * the region, which may exceed |maxRects|, or -1 if the divs of the chunk do
+ * not fit the bitmap.
+ */
+CSHARP_BINDING_API int32_t SkNinePatchGlue_getTransparentRegion(int8_t* patch,
+        int32_t bitmapWidth, int32_t bitmapHeight, int32_t left, int32_t top,
+        int32_t right, int32_t bottom, int32_t* outRects, int32_t maxRects) {
+    const Res_png_9patch* chunk = reinterpret_cast<const Res_png_9patch*>(patch);
+    if (nullptr == chunk) {
+        return -1;
+    }
+
+    std::vector<aapt::Rect> rects;
+    std::string err;
+    if (!aapt::GetNinePatchTransparentRegion(*chunk, bitmapWidth, bitmapHeight,
+            aapt::Rect(left, top, right, bottom), &rects, &err)) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < rects.size() && (int32_t) i < maxRects; i++) {
+        outRects[i * 4 + 0] = rects[i].left;
+        outRects[i * 4 + 1] = rects[i].top;
+        outRects[i * 4 + 2] = rects[i].right;
+        outRects[i * 4 + 3] = rects[i].bottom;
+    }
+    return (int32_t) rects.size();
+}
 
 // jobject NinePatchPeeker::createNinePatchInsets(JNIEnv* env, float scale) const {
 //     if (!mHasInsets) {
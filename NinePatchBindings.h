@@ -35,3 +35,7 @@ CSHARP_BINDING_API int8_t SkNinePatchGlue_isNinePatchChunk(int8_t* array, int32_
 CSHARP_BINDING_API int8_t* SkNinePatchGlue_validateNinePatchChunk(int8_t* array, int32_t length);
 
 CSHARP_BINDING_API void SkNinePatchGlue_finalize(int8_t* patch);
+
+CSHARP_BINDING_API int32_t SkNinePatchGlue_getTransparentRegion(int8_t* patch,
+        int32_t bitmapWidth, int32_t bitmapHeight, int32_t left, int32_t top,
+        int32_t right, int32_t bottom, int32_t* outRects, int32_t maxRects);
@@ -0,0 +1,266 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "NinePatchCache.h"
+
+#include <cstring>
+#include <utility>
+
+namespace aapt {
+
+static constexpr uint64_t kPrime1 = 0x9e3779b185ebca87ull;
+static constexpr uint64_t kPrime2 = 0xc2b2ae3d27d4eb4full;
+static constexpr uint64_t kPrime3 = 0x165667b19e3779f9ull;
+
+static inline uint64_t RotateLeft(uint64_t value, int bits) {
+  return (value << bits) | (value >> (64 - bits));
+}
+
+static inline uint64_t MixWord(uint64_t lane, uint64_t word) {
+  lane += word * kPrime2;
+  return RotateLeft(lane, 31) * kPrime1;
+}
+
+static inline uint64_t LoadWord(const uint8_t* bytes) {
+  uint64_t word;
+  memcpy(&word, bytes, sizeof(word));
+  return word;
+}
+
+/**
+ * 64-bit hash of the pixels of an image, fed one row at a time. Hashes 32
+ * bytes per step into four independent lanes, using the round function of
+ * xxHash64, which is several times faster than the byte-oriented
+ * JenkinsHashMixBytes() and has a wider result.
+ *
+ * Every row has the same length, so the rows are not delimited.
+ */
+class PixelHasher {
+ public:
+  explicit PixelHasher()
+      : lanes_{kPrime1 + kPrime2, kPrime2, 0, 0 - kPrime1} {}
+
+  void AddRow(const uint8_t* bytes, size_t size) {
+    for (; size >= 32; bytes += 32, size -= 32) {
+      for (int i = 0; i < 4; i++) {
+        lanes_[i] = MixWord(lanes_[i], LoadWord(bytes + i * 8));
+      }
+    }
+    for (int i = 0; size >= 8; bytes += 8, size -= 8, i++) {
+      lanes_[i] = MixWord(lanes_[i], LoadWord(bytes));
+    }
+    if (size > 0) {
+      uint64_t word = 0;
+      memcpy(&word, bytes, size);
+      lanes_[3] = MixWord(lanes_[3], word);
+    }
+  }
+
+  uint64_t Finish() const {
+    uint64_t hash = RotateLeft(lanes_[0], 1) + RotateLeft(lanes_[1], 7) +
+                    RotateLeft(lanes_[2], 12) + RotateLeft(lanes_[3], 18);
+    hash ^= hash >> 33;
+    hash *= kPrime2;
+    hash ^= hash >> 29;
+    hash *= kPrime3;
+    hash ^= hash >> 32;
+    return hash;
+  }
+
+ private:
+  uint64_t lanes_[4];
+
+  DISALLOW_COPY_AND_ASSIGN(PixelHasher);
+};
+
+// Estimates the memory held by a cached NinePatch.
+static size_t EstimateBytes(const NinePatch& nine_patch) {
+  return sizeof(NinePatch) +
+         nine_patch.horizontal_stretch_regions.capacity() * sizeof(Range) +
+         nine_patch.vertical_stretch_regions.capacity() * sizeof(Range) +
+         nine_patch.region_colors.capacity() * sizeof(uint32_t) +
+         nine_patch.region_opacities.capacity() * sizeof(RegionOpacity);
+}
+
+bool NinePatchCache::Key::operator==(const Key& other) const {
+  return hash == other.hash && width == other.width &&
+         height == other.height && pixel_format == other.pixel_format &&
+         tight_outline == other.tight_outline &&
+         region_opacity == other.region_opacity;
+}
+
+size_t NinePatchCache::KeyHash::operator()(const Key& key) const {
+  // The dimensions and options are already part of the lookup through
+  // operator==, and rarely differ between images with the same pixel hash.
+  return static_cast<size_t>(key.hash);
+}
+
+// Fails the way NinePatch::Create() does for an image too small to be a
+// 9-patch, before any of its rows are hashed.
+static bool CheckImageSize(const int32_t width, const int32_t height,
+                           std::string* out_err) {
+  if (width < 3 || height < 3) {
+    NinePatchStatus status;
+    status.code = NinePatchErrorCode::kImageTooSmall;
+    *out_err = status.Message();
+    return false;
+  }
+  return true;
+}
+
+NinePatchCache::NinePatchCache(const size_t max_bytes)
+    : max_bytes_(max_bytes) {}
+
+NinePatchCache::Key NinePatchCache::MakeKey(uint64_t hash,
+                                            const int32_t width,
+                                            const int32_t height,
+                                            const NinePatchOptions& options) {
+  return Key{hash, width, height, options.pixel_format,
+             options.tight_outline, options.region_opacity};
+}
+
+template <typename CreateFn>
+std::shared_ptr<const NinePatch> NinePatchCache::GetOrCreate(const Key& key,
+                                                             CreateFn create) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::shared_ptr<const NinePatch> nine_patch = Lookup(key);
+    if (nine_patch != nullptr) {
+      hits_++;
+      return nine_patch;
+    }
+    misses_++;
+  }
+
+  // Analyze without holding the lock, so that other images can be looked up
+  // and analyzed meanwhile.
+  std::shared_ptr<const NinePatch> nine_patch = create();
+  if (nine_patch == nullptr) {
+    return {};
+  }
+  return Insert(key, std::move(nine_patch));
+}
+
+std::shared_ptr<const NinePatch> NinePatchCache::Get(
+    uint8_t** rows, const int32_t width, const int32_t height,
+    const NinePatchOptions& options, std::string* out_err) {
+  if (!CheckImageSize(width, height, out_err)) {
+    return {};
+  }
+
+  const size_t row_bytes = width * GetBytesPerPixel(options.pixel_format);
+  PixelHasher hasher;
+  for (int32_t y = 0; y < height; y++) {
+    hasher.AddRow(rows[y], row_bytes);
+  }
+
+  return GetOrCreate(
+      MakeKey(hasher.Finish(), width, height, options),
+      [&]() -> std::shared_ptr<const NinePatch> {
+        return NinePatch::Create(rows, width, height, options, out_err);
+      });
+}
+
+std::shared_ptr<const NinePatch> NinePatchCache::Get(
+    const uint8_t* base, const size_t stride_bytes, const int32_t x,
+    const int32_t y, const int32_t width, const int32_t height,
+    const NinePatchOptions& options, std::string* out_err) {
+  if (!CheckImageSize(width, height, out_err)) {
+    return {};
+  }
+  if (x < 0 || y < 0) {
+    *out_err = "9-patch offset must not be negative";
+    return {};
+  }
+
+  const int32_t bytes_per_pixel = GetBytesPerPixel(options.pixel_format);
+  const size_t row_bytes = width * bytes_per_pixel;
+  PixelHasher hasher;
+  for (int32_t row = 0; row < height; row++) {
+    hasher.AddRow(base + (y + row) * stride_bytes + x * bytes_per_pixel,
+                  row_bytes);
+  }
+
+  return GetOrCreate(
+      MakeKey(hasher.Finish(), width, height, options),
+      [&]() -> std::shared_ptr<const NinePatch> {
+        return NinePatch::Create(base, stride_bytes, x, y, width, height,
+                                 options, out_err);
+      });
+}
+
+std::shared_ptr<const NinePatch> NinePatchCache::Lookup(const Key& key) {
+  auto iter = index_.find(key);
+  if (iter == index_.end()) {
+    return {};
+  }
+  lru_.splice(lru_.begin(), lru_, iter->second);
+  return iter->second->nine_patch;
+}
+
+std::shared_ptr<const NinePatch> NinePatchCache::Insert(
+    const Key& key, std::shared_ptr<const NinePatch> nine_patch) {
+  const size_t bytes = sizeof(Entry) + EstimateBytes(*nine_patch);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::shared_ptr<const NinePatch> existing = Lookup(key);
+  if (existing != nullptr) {
+    return existing;
+  }
+  if (bytes > max_bytes_) {
+    return nine_patch;
+  }
+
+  lru_.push_front(Entry{key, nine_patch, bytes});
+  index_[key] = lru_.begin();
+  size_bytes_ += bytes;
+  while (size_bytes_ > max_bytes_) {
+    const Entry& oldest = lru_.back();
+    size_bytes_ -= oldest.bytes;
+    index_.erase(oldest.key);
+    lru_.pop_back();
+  }
+  return nine_patch;
+}
+
+void NinePatchCache::Clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  index_.clear();
+  lru_.clear();
+  size_bytes_ = 0;
+}
+
+uint64_t NinePatchCache::hits() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return hits_;
+}
+
+uint64_t NinePatchCache::misses() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return misses_;
+}
+
+size_t NinePatchCache::size_bytes() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return size_bytes_;
+}
+
+size_t NinePatchCache::entry_count() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return lru_.size();
+}
+
+}  // namespace aapt
@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AAPT_COMPILE_NINEPATCH_CACHE_H
+#define AAPT_COMPILE_NINEPATCH_CACHE_H
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "image.h"
+#include "macros.h"
+
+namespace aapt {
+
+/**
+ * Memoizes NinePatch::Create() by image content, so that the same pixels
+ * analyzed again, e.g. for another flavor or density of an app, are looked up
+ * instead. Safe to use from multiple threads.
+ *
+ * Entries are keyed by the dimensions, the options that change the result
+ * (pixel_format, tight_outline and region_opacity) and a 64-bit hash of the
+ * pixels. A hit only hashes the pixels. Images whose key collides with another
+ * image's would get its result, which for a 64-bit hash is unlikely enough to
+ * ignore.
+ *
+ * The results are shared and immutable. The least recently used entries are
+ * evicted once the results held exceed the byte budget. Invalid 9-patches are
+ * not cached.
+ */
+class NinePatchCache {
+ public:
+  explicit NinePatchCache(const size_t max_bytes);
+
+  /**
+   * Returns the cached result for the image, or analyzes it with
+   * NinePatch::Create() and caches the result. Returns nullptr and sets
+   * `out_err` if the image is not a valid 9-patch. The strided overload also
+   * fails if `x` or `y` is negative.
+   */
+  std::shared_ptr<const NinePatch> Get(uint8_t** rows, const int32_t width,
+                                       const int32_t height,
+                                       const NinePatchOptions& options,
+                                       std::string* out_err);
+
+  std::shared_ptr<const NinePatch> Get(const uint8_t* base,
+                                       const size_t stride_bytes,
+                                       const int32_t x, const int32_t y,
+                                       const int32_t width,
+                                       const int32_t height,
+                                       const NinePatchOptions& options,
+                                       std::string* out_err);
+
+  /**
+   * Drops every entry. The counters are kept.
+   */
+  void Clear();
+
+  /**
+   * Number of calls to Get() answered from the cache.
+   */
+  uint64_t hits() const;
+
+  /**
+   * Number of calls to Get() that analyzed the image.
+   */
+  uint64_t misses() const;
+
+  /**
+   * Estimated memory held by the cached results, at most the byte budget.
+   */
+  size_t size_bytes() const;
+
+  size_t entry_count() const;
+
+ private:
+  struct Key {
+    uint64_t hash;
+    int32_t width;
+    int32_t height;
+    PixelFormat pixel_format;
+    bool tight_outline;
+    bool region_opacity;
+
+    bool operator==(const Key& other) const;
+  };
+
+  struct KeyHash {
+    size_t operator()(const Key& key) const;
+  };
+
+  struct Entry {
+    Key key;
+    std::shared_ptr<const NinePatch> nine_patch;
+    size_t bytes;
+  };
+
+  static Key MakeKey(uint64_t hash, const int32_t width, const int32_t height,
+                     const NinePatchOptions& options);
+
+  // Returns the cached result for `key`, or calls `create` to analyze the
+  // image and caches its result.
+  template <typename CreateFn>
+  std::shared_ptr<const NinePatch> GetOrCreate(const Key& key,
+                                               CreateFn create);
+
+  // Returns the entry for `key` and marks it as the most recently used, or
+  // nullptr. Requires mutex_.
+  std::shared_ptr<const NinePatch> Lookup(const Key& key);
+
+  // Adds the result for `key`, evicting entries to stay within the budget.
+  // Returns the entry already cached if another thread added it first.
+  std::shared_ptr<const NinePatch> Insert(
+      const Key& key, std::shared_ptr<const NinePatch> nine_patch);
+
+  const size_t max_bytes_;
+
+  mutable std::mutex mutex_;
+
+  // Most recently used first.
+  std::list<Entry> lru_;
+  std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> index_;
+  size_t size_bytes_ = 0;
+  uint64_t hits_ = 0;
+  uint64_t misses_ = 0;
+
+  DISALLOW_COPY_AND_ASSIGN(NinePatchCache);
+};
+
+}  // namespace aapt
+
+#endif /* AAPT_COMPILE_NINEPATCH_CACHE_H */
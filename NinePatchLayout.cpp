@@ -0,0 +1,210 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "NinePatchLayout.h"
+
+#include <algorithm>
+
+#include "9patch.h"
+
+using android::Res_png_9patch;
+
+namespace aapt {
+
+using AxisPlan = NinePatchLayoutEngine::AxisPlan;
+
+// Fixed point shares are exact while the destination length times the shared
+// source length stays below this.
+constexpr int64_t kExactProductLimit = int64_t(1) << 31;
+
+// Returns ceil(consumed * 2^32 / total), or 0 if `total` is 0.
+static uint64_t ShareFactor(const int64_t consumed, const int64_t total) {
+  if (total == 0) {
+    return 0;
+  }
+  return ((static_cast<uint64_t>(consumed) << 32) + total - 1) / total;
+}
+
+// Plans the edges of the segments the `count` divs split [0, length) into,
+// the same way the region colors are laid out. Returns false if the divs are
+// not pairs of increasing positions within the length.
+static bool PlanAxis(const int32_t* divs, const int32_t count,
+                     const int32_t length, AxisPlan* out_plan) {
+  if (count % 2 != 0) {
+    return false;
+  }
+
+  // The source edges of the segments, and whether each one stretches.
+  std::vector<int32_t> edges = {0};
+  std::vector<bool> stretch;
+  int32_t next_start = 0;
+  for (int32_t i = 0; i < count; i += 2) {
+    const int32_t start = divs[i];
+    const int32_t end = divs[i + 1];
+    if (start < next_start || end < start || end > length) {
+      return false;
+    }
+    if (start != next_start) {
+      edges.push_back(start);
+      stretch.push_back(false);
+    }
+    edges.push_back(end);
+    stretch.push_back(true);
+    next_start = end;
+  }
+  if (next_start != length) {
+    edges.push_back(length);
+    stretch.push_back(false);
+  }
+
+  AxisPlan& plan = *out_plan;
+  for (size_t k = 0; k < stretch.size(); k++) {
+    (stretch[k] ? plan.stretch_length : plan.fixed_length) +=
+        edges[k + 1] - edges[k];
+  }
+
+  int64_t fixed_consumed = 0;
+  int64_t stretch_consumed = 0;
+  for (size_t k = 0; k < edges.size(); k++) {
+    if (k > 0) {
+      (stretch[k - 1] ? stretch_consumed : fixed_consumed) +=
+          edges[k] - edges[k - 1];
+    }
+    plan.fixed_before.push_back(static_cast<int32_t>(fixed_consumed));
+    plan.stretch_factors.push_back(
+        ShareFactor(stretch_consumed, plan.stretch_length));
+    plan.fixed_factors.push_back(
+        ShareFactor(fixed_consumed, plan.fixed_length));
+    plan.stretch_consumed.push_back(stretch_consumed);
+    plan.fixed_consumed.push_back(fixed_consumed);
+  }
+  return true;
+}
+
+// Writes edge k of query q to out_edges[k * count + q], for the `count`
+// destination `lengths`.
+static void LayoutEdges(const AxisPlan& plan, const int32_t* lengths,
+                        const size_t count, int32_t* out_edges) {
+  int64_t max_length = 0;
+  for (size_t q = 0; q < count; q++) {
+    max_length = std::max<int64_t>(max_length, lengths[q]);
+  }
+  const bool fixed_point =
+      max_length * std::max(plan.fixed_length, plan.stretch_length) <
+      kExactProductLimit;
+  const int64_t fixed_length = plan.fixed_length;
+  const bool has_stretch = plan.stretch_length > 0;
+
+  for (size_t k = 0; k < plan.fixed_before.size(); k++) {
+    int32_t* edges = out_edges + k * count;
+    const int32_t fixed_before = plan.fixed_before[k];
+    if (fixed_point) {
+      const uint64_t stretch_factor = plan.stretch_factors[k];
+      const uint64_t fixed_factor = plan.fixed_factors[k];
+      for (size_t q = 0; q < count; q++) {
+        const int64_t length = std::max<int64_t>(lengths[q], 0);
+        const bool stretches = has_stretch && length >= fixed_length;
+        const uint64_t space = stretches ? length - fixed_length : length;
+        const uint64_t factor = stretches ? stretch_factor : fixed_factor;
+        edges[q] = (stretches ? fixed_before : 0) +
+                   static_cast<int32_t>((space * factor + (1ull << 31)) >> 32);
+      }
+      continue;
+    }
+
+    for (size_t q = 0; q < count; q++) {
+      const int64_t length = std::max<int64_t>(lengths[q], 0);
+      const bool stretches = has_stretch && length >= fixed_length;
+      const int64_t space = stretches ? length - fixed_length : length;
+      const int64_t total = stretches ? plan.stretch_length : fixed_length;
+      const int64_t consumed =
+          stretches ? plan.stretch_consumed[k] : plan.fixed_consumed[k];
+      edges[q] = (stretches ? fixed_before : 0) +
+                 (total > 0 ? static_cast<int32_t>((2 * space * consumed +
+                                                    total) /
+                                                   (2 * total))
+                            : 0);
+    }
+  }
+}
+
+// Sets the box inside `insets` for each of the `count` sizes.
+static void InsetBoxes(const Bounds& insets, const int32_t* widths,
+                       const int32_t* heights, const size_t count,
+                       int32_t* out_left, int32_t* out_top,
+                       int32_t* out_right, int32_t* out_bottom) {
+  for (size_t q = 0; q < count; q++) {
+    out_left[q] = insets.left;
+    out_top[q] = insets.top;
+    out_right[q] = widths[q] - insets.right;
+    out_bottom[q] = heights[q] - insets.bottom;
+  }
+}
+
+Rect NinePatchLayouts::GetPatchRect(const size_t query, const int32_t col,
+                                    const int32_t row) const {
+  return Rect(col_edges[col * query_count + query],
+              row_edges[row * query_count + query],
+              col_edges[(col + 1) * query_count + query],
+              row_edges[(row + 1) * query_count + query]);
+}
+
+std::unique_ptr<NinePatchLayoutEngine> NinePatchLayoutEngine::Create(
+    const Res_png_9patch& chunk, const int32_t width, const int32_t height,
+    const Bounds& optical_insets, std::string* out_err) {
+  std::unique_ptr<NinePatchLayoutEngine> engine(new NinePatchLayoutEngine());
+  if (!PlanAxis(chunk.getXDivs(), chunk.numXDivs, width, &engine->cols_)) {
+    *out_err = "9-patch xDivs do not fit the image width";
+    return {};
+  }
+  if (!PlanAxis(chunk.getYDivs(), chunk.numYDivs, height, &engine->rows_)) {
+    *out_err = "9-patch yDivs do not fit the image height";
+    return {};
+  }
+  engine->padding_ = Bounds(chunk.paddingLeft, chunk.paddingTop,
+                            chunk.paddingRight, chunk.paddingBottom);
+  engine->optical_insets_ = optical_insets;
+  return engine;
+}
+
+void NinePatchLayoutEngine::Layout(const int32_t* dst_widths,
+                                   const int32_t* dst_heights,
+                                   const size_t count,
+                                   NinePatchLayouts* out_layouts) const {
+  NinePatchLayouts& layouts = *out_layouts;
+  layouts.query_count = count;
+  layouts.col_edge_count = static_cast<int32_t>(cols_.fixed_before.size());
+  layouts.row_edge_count = static_cast<int32_t>(rows_.fixed_before.size());
+  layouts.col_edges.resize(layouts.col_edge_count * count);
+  layouts.row_edges.resize(layouts.row_edge_count * count);
+  LayoutEdges(cols_, dst_widths, count, layouts.col_edges.data());
+  LayoutEdges(rows_, dst_heights, count, layouts.row_edges.data());
+
+  for (std::vector<int32_t>* box :
+       {&layouts.content_left, &layouts.content_top, &layouts.content_right,
+        &layouts.content_bottom, &layouts.optical_left, &layouts.optical_top,
+        &layouts.optical_right, &layouts.optical_bottom}) {
+    box->resize(count);
+  }
+  InsetBoxes(padding_, dst_widths, dst_heights, count,
+             layouts.content_left.data(), layouts.content_top.data(),
+             layouts.content_right.data(), layouts.content_bottom.data());
+  InsetBoxes(optical_insets_, dst_widths, dst_heights, count,
+             layouts.optical_left.data(), layouts.optical_top.data(),
+             layouts.optical_right.data(), layouts.optical_bottom.data());
+}
+
+}  // namespace aapt
@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AAPT_COMPILE_NINEPATCH_LAYOUT_H
+#define AAPT_COMPILE_NINEPATCH_LAYOUT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "image.h"
+
+namespace android {
+struct Res_png_9patch;
+}  // namespace android
+
+namespace aapt {
+
+/**
+ * The layouts of one 9-patch at many destination sizes, as a struct of arrays:
+ * the values of query q are at index q of each array, and edge k of query q is
+ * at k * query_count + q of the edge arrays.
+ */
+struct NinePatchLayouts {
+  size_t query_count = 0;
+
+  // The x of each column edge, from 0 to the destination width, and the y of
+  // each row edge. Patch (i, j) spans columns [i, i + 1) and rows [j, j + 1).
+  int32_t col_edge_count = 0;
+  int32_t row_edge_count = 0;
+  std::vector<int32_t> col_edges;
+  std::vector<int32_t> row_edges;
+
+  // The box inside the padding, where the content of the view goes.
+  std::vector<int32_t> content_left;
+  std::vector<int32_t> content_top;
+  std::vector<int32_t> content_right;
+  std::vector<int32_t> content_bottom;
+
+  // The box inside the optical insets (layout bounds), which the view is
+  // aligned by.
+  std::vector<int32_t> optical_left;
+  std::vector<int32_t> optical_top;
+  std::vector<int32_t> optical_right;
+  std::vector<int32_t> optical_bottom;
+
+  /**
+   * Returns the destination rectangle of patch (`col`, `row`) for `query`.
+   */
+  Rect GetPatchRect(const size_t query, const int32_t col,
+                    const int32_t row) const;
+};
+
+/**
+ * Computes where the patches of a 9-patch go, and its content and optical
+ * boxes, for many destination sizes at once.
+ *
+ * The stretch distribution is the one NinePatchRenderer draws: fixed segments
+ * keep their length and stretch segments share the rest in proportion to their
+ * lengths, or the fixed segments share all of it if they do not fit. Each edge
+ * is the running total of the shares rounded to the nearest pixel, half up.
+ * The shares are computed in 32.32 fixed point from factors prepared once per
+ * 9-patch, so that the loops over the queries have no division and vectorize;
+ * the results are exact for every destination length below 2^31 divided by
+ * the length the segments are shared by, and batches with longer lengths fall
+ * back to integer division.
+ */
+class NinePatchLayoutEngine {
+ public:
+  /**
+   * The fixed point layout of one axis. Edge k is at
+   * (stretched ? fixed_before[k] : 0) + round(space * factors[k] / 2^32), where
+   * `space` is what the shared segments share, and `factors` are
+   * stretch_factors or fixed_factors.
+   */
+  struct AxisPlan {
+    int64_t fixed_length = 0;
+    int64_t stretch_length = 0;
+    std::vector<int32_t> fixed_before;
+    std::vector<uint64_t> stretch_factors;
+    std::vector<uint64_t> fixed_factors;
+
+    // The source lengths shared so far at each edge, for the exact fallback.
+    std::vector<int64_t> stretch_consumed;
+    std::vector<int64_t> fixed_consumed;
+  };
+
+  /**
+   * Prepares the layouts of the `width` x `height` image of `chunk`, which
+   * must be in device byte order (see Res_png_9patch::fileToDevice()), with
+   * `optical_insets` from its layout bounds. Returns nullptr and sets
+   * `out_err` if the divs do not fit the image.
+   */
+  static std::unique_ptr<NinePatchLayoutEngine> Create(
+      const android::Res_png_9patch& chunk, const int32_t width,
+      const int32_t height, const Bounds& optical_insets,
+      std::string* out_err);
+
+  /**
+   * Lays out the 9-patch at the `count` sizes `dst_widths[q]` x
+   * `dst_heights[q]` into `out_layouts`, whose arrays are resized as needed
+   * and can be reused across calls.
+   */
+  void Layout(const int32_t* dst_widths, const int32_t* dst_heights,
+              const size_t count, NinePatchLayouts* out_layouts) const;
+
+ private:
+  explicit NinePatchLayoutEngine() = default;
+
+  AxisPlan cols_;
+  AxisPlan rows_;
+  Bounds padding_;
+  Bounds optical_insets_;
+
+  DISALLOW_COPY_AND_ASSIGN(NinePatchLayoutEngine);
+};
+
+}  // namespace aapt
+
+#endif /* AAPT_COMPILE_NINEPATCH_LAYOUT_H */
@@ -0,0 +1,243 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "NinePatchMesh.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "9patch.h"
+
+using android::Res_png_9patch;
+
+namespace aapt {
+
+// The most segments one axis can have: numXDivs and numYDivs are at most 255,
+// which allows 127 stretch segments with a fixed segment around each.
+constexpr int32_t kMaxSegments = 255;
+
+/**
+ * The segments of one axis and the positions of their edges. It lives on the
+ * stack, so that building a mesh allocates nothing.
+ */
+struct AxisLattice {
+  int32_t count = 0;
+  int32_t source_edges[kMaxSegments + 1];
+  bool stretch[kMaxSegments];
+
+  // The destination position and normalized texture coordinate of each edge.
+  float positions[kMaxSegments + 1];
+  float coords[kMaxSegments + 1];
+};
+
+// Splits [0, length) into segments at the `div_count` divs, the same way the
+// region colors are laid out. Returns false if the divs are not pairs of
+// increasing positions within the length.
+static bool SplitAxis(const int32_t* divs, const int32_t div_count,
+                      const int32_t length, AxisLattice* out_lattice) {
+  if (div_count % 2 != 0) {
+    return false;
+  }
+
+  AxisLattice& lattice = *out_lattice;
+  lattice.source_edges[0] = 0;
+  auto add_segment = [&](const int32_t end, const bool stretch) {
+    lattice.stretch[lattice.count++] = stretch;
+    lattice.source_edges[lattice.count] = end;
+  };
+
+  int32_t next_start = 0;
+  for (int32_t i = 0; i < div_count; i += 2) {
+    const int32_t start = divs[i];
+    const int32_t end = divs[i + 1];
+    if (start < next_start || end < start || end > length) {
+      return false;
+    }
+    if (start != next_start) {
+      add_segment(start, false);
+    }
+    add_segment(end, true);
+    next_start = end;
+  }
+  if (next_start != length) {
+    add_segment(length, false);
+  }
+  return true;
+}
+
+// Places the edges of the segments of an axis `length` pixels long over
+// [dst_start, dst_end) the way NinePatchLayoutEngine does: fixed segments keep
+// their length and stretch segments share the rest, or, without enough room or
+// stretch segments, the fixed segments share all of it. Each edge is offset
+// from dst_start by the running total of the shares rounded to the nearest
+// pixel, half up, and the last edge is dst_end.
+static void LayoutAxis(const int32_t length, const float dst_start,
+                       const float dst_end, AxisLattice* lattice) {
+  int64_t fixed_length = 0;
+  int64_t stretch_length = 0;
+  for (int32_t k = 0; k < lattice->count; k++) {
+    const int32_t segment_length =
+        lattice->source_edges[k + 1] - lattice->source_edges[k];
+    (lattice->stretch[k] ? stretch_length : fixed_length) += segment_length;
+  }
+
+  // The shares are exact in double precision for whole-pixel destinations, so
+  // their edges match NinePatchLayoutEngine's integer ones.
+  const double space =
+      dst_end > dst_start ? (double)dst_end - (double)dst_start : 0.0;
+  const bool stretches = stretch_length > 0 && space >= fixed_length;
+  const double shared_space = stretches ? space - fixed_length : space;
+  const int64_t shared_length = stretches ? stretch_length : fixed_length;
+
+  const float texel = length > 0 ? 1.0f / length : 0.0f;
+  int64_t fixed_consumed = 0;
+  int64_t stretch_consumed = 0;
+  for (int32_t k = 0; k <= lattice->count; k++) {
+    const int64_t consumed = stretches ? stretch_consumed : fixed_consumed;
+    double offset =
+        shared_length > 0
+            ? std::floor(shared_space * consumed / shared_length + 0.5)
+            : 0.0;
+    if (stretches) {
+      offset += fixed_consumed;
+    }
+    lattice->positions[k] =
+        static_cast<float>(dst_start + std::min(offset, space));
+    lattice->coords[k] = lattice->source_edges[k] * texel;
+    if (k < lattice->count) {
+      (lattice->stretch[k] ? stretch_consumed : fixed_consumed) +=
+          lattice->source_edges[k + 1] - lattice->source_edges[k];
+    }
+  }
+  // A destination of fractional size ends between pixels.
+  if (fixed_length + stretch_length > 0) {
+    lattice->positions[lattice->count] = static_cast<float>(dst_start + space);
+  }
+}
+
+void GetNinePatchMeshCapacity(const Res_png_9patch& chunk,
+                              int32_t* out_vertex_count,
+                              int32_t* out_index_count) {
+  const int32_t cols = chunk.numXDivs + 1;
+  const int32_t rows = chunk.numYDivs + 1;
+  *out_vertex_count = (cols + 1) * (rows + 1);
+  *out_index_count = cols * rows * 6;
+}
+
+bool BuildNinePatchMesh(const NinePatchMeshRequest& request,
+                        NinePatchMeshBuffers* buffers,
+                        NinePatchMeshRange* out_range, std::string* out_err) {
+  if (request.chunk == nullptr) {
+    *out_err = "missing 9-patch chunk";
+    return false;
+  }
+  const Res_png_9patch& chunk = *request.chunk;
+
+  AxisLattice cols;
+  AxisLattice rows;
+  if (!SplitAxis(chunk.getXDivs(), chunk.numXDivs, request.width, &cols)) {
+    *out_err = "9-patch xDivs do not fit the image width";
+    return false;
+  }
+  if (!SplitAxis(chunk.getYDivs(), chunk.numYDivs, request.height, &rows)) {
+    *out_err = "9-patch yDivs do not fit the image height";
+    return false;
+  }
+  LayoutAxis(request.width, request.dst.left, request.dst.right, &cols);
+  LayoutAxis(request.height, request.dst.top, request.dst.bottom, &rows);
+
+  // The hints are only used if there is one per patch.
+  const uint32_t* colors = chunk.numColors == cols.count * rows.count
+                               ? chunk.getColors()
+                               : nullptr;
+  auto is_drawn = [&](const int32_t i, const int32_t j) {
+    return cols.positions[i + 1] > cols.positions[i] &&
+           rows.positions[j + 1] > rows.positions[j] &&
+           (colors == nullptr || colors[j * cols.count + i] !=
+                                     Res_png_9patch::TRANSPARENT_COLOR);
+  };
+
+  int32_t index_count = 0;
+  for (int32_t j = 0; j < rows.count; j++) {
+    for (int32_t i = 0; i < cols.count; i++) {
+      index_count += is_drawn(i, j) ? 6 : 0;
+    }
+  }
+  // An empty mesh needs no vertices.
+  const int32_t stride = cols.count + 1;
+  const int32_t vertex_count = index_count > 0 ? stride * (rows.count + 1) : 0;
+  if (buffers->vertex_capacity - buffers->vertex_count < vertex_count ||
+      buffers->index_capacity - buffers->index_count < index_count) {
+    *out_err = "9-patch mesh buffers are too small";
+    return false;
+  }
+
+  const int32_t first_vertex = buffers->vertex_count;
+  const int32_t first_index = buffers->index_count;
+  if (vertex_count > 0) {
+    for (int32_t j = 0; j <= rows.count; j++) {
+      const int32_t row_start = first_vertex + j * stride;
+      for (int32_t i = 0; i < stride; i++) {
+        buffers->x[row_start + i] = cols.positions[i];
+        buffers->u[row_start + i] = cols.coords[i];
+        buffers->y[row_start + i] = rows.positions[j];
+        buffers->v[row_start + i] = rows.coords[j];
+      }
+    }
+
+    uint32_t* cursor = buffers->indices + first_index;
+    for (int32_t j = 0; j < rows.count; j++) {
+      for (int32_t i = 0; i < cols.count; i++) {
+        if (!is_drawn(i, j)) {
+          continue;
+        }
+        const uint32_t top_left =
+            static_cast<uint32_t>(first_vertex + j * stride + i);
+        const uint32_t bottom_left = top_left + stride;
+        *cursor++ = top_left;
+        *cursor++ = top_left + 1;
+        *cursor++ = bottom_left;
+        *cursor++ = bottom_left;
+        *cursor++ = top_left + 1;
+        *cursor++ = bottom_left + 1;
+      }
+    }
+  }
+
+  buffers->vertex_count += vertex_count;
+  buffers->index_count += index_count;
+  out_range->first_vertex = first_vertex;
+  out_range->vertex_count = vertex_count;
+  out_range->first_index = first_index;
+  out_range->index_count = index_count;
+  return true;
+}
+
+bool BuildNinePatchMeshes(const NinePatchMeshRequest* requests,
+                          const size_t count, NinePatchMeshBuffers* buffers,
+                          NinePatchMeshRange* out_ranges,
+                          std::string* out_err) {
+  for (size_t i = 0; i < count; i++) {
+    std::string err;
+    if (!BuildNinePatchMesh(requests[i], buffers, &out_ranges[i], &err)) {
+      *out_err = "9-patch mesh " + std::to_string(i) + ": " + err;
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace aapt
@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AAPT_COMPILE_NINEPATCH_MESH_H
+#define AAPT_COMPILE_NINEPATCH_MESH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace android {
+struct Res_png_9patch;
+}  // namespace android
+
+namespace aapt {
+
+/**
+ * A destination rectangle, in the coordinates of the compositor.
+ */
+struct NinePatchMeshRect {
+  float left = 0.0f;
+  float top = 0.0f;
+  float right = 0.0f;
+  float bottom = 0.0f;
+};
+
+/**
+ * A 9-patch to build a mesh for: its chunk, in device byte order (see
+ * Res_png_9patch::fileToDevice()), the size of its image without the 1px
+ * border, and where to draw it.
+ */
+struct NinePatchMeshRequest {
+  const android::Res_png_9patch* chunk = nullptr;
+  int32_t width = 0;
+  int32_t height = 0;
+  NinePatchMeshRect dst;
+};
+
+/**
+ * Caller-provided buffers meshes are appended to, as a struct of arrays: the
+ * position (x, y) and texture coordinates (u, v) of vertex i are x[i], y[i],
+ * u[i] and v[i]. Texture coordinates are normalized to the image without its
+ * border. Every 3 indices make a triangle.
+ *
+ * vertex_count and index_count are the number of entries used so far, and are
+ * advanced by each mesh.
+ */
+struct NinePatchMeshBuffers {
+  float* x = nullptr;
+  float* y = nullptr;
+  float* u = nullptr;
+  float* v = nullptr;
+  int32_t vertex_capacity = 0;
+  int32_t vertex_count = 0;
+
+  uint32_t* indices = nullptr;
+  int32_t index_capacity = 0;
+  int32_t index_count = 0;
+};
+
+/**
+ * The part of NinePatchMeshBuffers holding one mesh.
+ */
+struct NinePatchMeshRange {
+  int32_t first_vertex = 0;
+  int32_t vertex_count = 0;
+  int32_t first_index = 0;
+  int32_t index_count = 0;
+};
+
+/**
+ * Sets the largest number of vertices and indices the mesh of `chunk` can
+ * take, for sizing the buffers.
+ */
+void GetNinePatchMeshCapacity(const android::Res_png_9patch& chunk,
+                              int32_t* out_vertex_count,
+                              int32_t* out_index_count);
+
+/**
+ * Appends to `buffers` the mesh drawing the 9-patch of `request`.
+ *
+ * The mesh is the lattice of the chunk's divs: a grid of vertices at the edges
+ * of the fixed and stretch segments, and two triangles per patch. The edges are
+ * laid out as NinePatchLayoutEngine lays them out, a whole number of pixels
+ * from dst.left and dst.top with the same rounding, so for a destination of
+ * whole pixels they are the edges NinePatchRenderer draws and the regions of
+ * NinePatchRegion.h cover. Only the last edge of a destination of fractional
+ * size is not. Patches whose color hint is TRANSPARENT_COLOR, and patches
+ * squeezed to nothing, get no triangles. Indices count from the start of the
+ * buffers, so meshes appended one after another can be drawn in one call.
+ *
+ * Returns false and sets `out_err`, writing nothing, if the divs do not fit
+ * the image or the buffers do not have room for the mesh.
+ */
+bool BuildNinePatchMesh(const NinePatchMeshRequest& request,
+                        NinePatchMeshBuffers* buffers,
+                        NinePatchMeshRange* out_range, std::string* out_err);
+
+/**
+ * Appends the meshes of `count` requests to `buffers`, in order, and sets
+ * out_ranges[i] to the range of the mesh of requests[i]. Stops at the first
+ * request that fails, keeping the meshes before it, and returns false with
+ * `out_err` naming the request.
+ */
+bool BuildNinePatchMeshes(const NinePatchMeshRequest* requests,
+                          const size_t count, NinePatchMeshBuffers* buffers,
+                          NinePatchMeshRange* out_ranges,
+                          std::string* out_err);
+
+}  // namespace aapt
+
+#endif /* AAPT_COMPILE_NINEPATCH_MESH_H */
@@ -0,0 +1,249 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "NinePatchMinimizer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+#include <vector>
+
+#include "JenkinsHash.h"
+
+using android::JenkinsHashMixBytes;
+
+namespace aapt {
+
+/**
+ * The lines (rows or columns) of one axis of the source image that make up
+ * the minimized image, borders included.
+ */
+struct AxisPlan {
+  // The source line of each line of the minimized image.
+  std::vector<int32_t> lines;
+
+  // The source line of each pixel of the far border (the bottom row for the
+  // columns, the right column for the rows), which keeps the pixels at the
+  // same distance from both edges as in the source.
+  std::vector<int32_t> border_lines;
+};
+
+// Splits the stretch regions into runs of identical lines, and appends the
+// length of each run, in order. `equal(a, b)` compares the lines at indices
+// `a` and `b`, which exclude the 1px border.
+template <typename Equal>
+static void FindRuns(const std::vector<Range>& stretch_regions, Equal equal,
+                     std::vector<int32_t>* out_runs) {
+  for (const Range& region : stretch_regions) {
+    int32_t run_start = region.start;
+    for (int32_t i = region.start + 1; i <= region.end; i++) {
+      if (i == region.end || !equal(run_start, i)) {
+        out_runs->push_back(i - run_start);
+        run_start = i;
+      }
+    }
+  }
+}
+
+// Returns the largest factor every run can be divided by that leaves more than
+// `keep_start + keep_end` lines, out of `length`.
+static int32_t ChooseFactor(const std::vector<int32_t>& runs,
+                            const int32_t length, const int32_t keep_start,
+                            const int32_t keep_end) {
+  int32_t divisor = 0;
+  int32_t stretch_length = 0;
+  for (const int32_t run : runs) {
+    divisor = std::gcd(divisor, run);
+    stretch_length += run;
+  }
+
+  for (int32_t factor = divisor; factor > 1; factor--) {
+    if (divisor % factor == 0 &&
+        length - stretch_length + stretch_length / factor >
+            keep_start + keep_end) {
+      return factor;
+    }
+  }
+  return 1;
+}
+
+// Keeps the first 1 / `factor` lines of every run. `length` excludes the
+// border, and `keep_end` is the number of lines of the far border, counting
+// from the end, that hold its last padding or layout bounds pixel.
+static void PlanAxis(const std::vector<Range>& stretch_regions,
+                     const std::vector<int32_t>& runs, const int32_t factor,
+                     const int32_t length, const int32_t keep_end,
+                     AxisPlan* out_plan) {
+  std::vector<int32_t>& lines = out_plan->lines;
+  lines.push_back(0);
+  int32_t i = 0;
+  auto run = runs.begin();
+  for (const Range& region : stretch_regions) {
+    for (; i < region.start; i++) {
+      lines.push_back(1 + i);
+    }
+    while (i < region.end) {
+      for (int32_t j = 0; j < *run / factor; j++) {
+        lines.push_back(1 + i + j);
+      }
+      i += *run++;
+    }
+  }
+  for (; i < length; i++) {
+    lines.push_back(1 + i);
+  }
+  lines.push_back(1 + length);
+
+  // The far border keeps its first pixels, which hold the start insets, and
+  // its last `keep_end` pixels, which hold the end insets. The pixels between
+  // them all have the same color.
+  const int32_t new_length = static_cast<int32_t>(lines.size()) - 2;
+  const int32_t removed = length - new_length;
+  std::vector<int32_t>& border_lines = out_plan->border_lines;
+  border_lines.push_back(0);
+  for (int32_t j = 0; j < new_length; j++) {
+    border_lines.push_back(1 + (j < new_length - keep_end ? j : j + removed));
+  }
+  border_lines.push_back(1 + length);
+}
+
+// Copies the pixels chosen by the plans into `out_image`.
+static void BuildImage(uint8_t** rows, const int32_t width,
+                       const int32_t bytes_per_pixel, const AxisPlan& col_plan,
+                       const AxisPlan& row_plan, Image* out_image) {
+  const int32_t new_width = static_cast<int32_t>(col_plan.lines.size());
+  const int32_t new_height = static_cast<int32_t>(row_plan.lines.size());
+  const size_t row_bytes = new_width * bytes_per_pixel;
+  out_image->width = new_width;
+  out_image->height = new_height;
+  out_image->data.reset(new uint8_t[row_bytes * new_height]);
+  out_image->rows.reset(new uint8_t*[new_height]);
+
+  for (int32_t y = 0; y < new_height; y++) {
+    uint8_t* dst = out_image->data.get() + y * row_bytes;
+    out_image->rows[y] = dst;
+
+    const bool is_bottom = y == new_height - 1;
+    const uint8_t* src = rows[row_plan.lines[y]];
+    const std::vector<int32_t>& cols =
+        is_bottom ? col_plan.border_lines : col_plan.lines;
+    for (int32_t x = 0; x < new_width - 1; x++) {
+      memcpy(dst + x * bytes_per_pixel, src + cols[x] * bytes_per_pixel,
+             bytes_per_pixel);
+    }
+    memcpy(dst + (new_width - 1) * bytes_per_pixel,
+           rows[row_plan.border_lines[y]] + (width - 1) * bytes_per_pixel,
+           bytes_per_pixel);
+  }
+}
+
+std::unique_ptr<NinePatch> MinimizeNinePatch(uint8_t** rows,
+                                             const int32_t width,
+                                             const int32_t height,
+                                             const NinePatchOptions& options,
+                                             Image* out_image,
+                                             std::string* out_err) {
+  std::unique_ptr<NinePatch> source =
+      NinePatch::Create(rows, width, height, options, out_err);
+  if (!source) {
+    return {};
+  }
+
+  const int32_t bpp = GetBytesPerPixel(options.pixel_format);
+  const int32_t content_width = width - 2;
+  const int32_t content_height = height - 2;
+
+  // Hash every column in one pass over the rows, so that only columns with
+  // equal hashes are compared pixel by pixel.
+  std::vector<uint32_t> col_hashes(content_width, 0);
+  for (int32_t y = 1; y <= content_height; y++) {
+    for (int32_t x = 0; x < content_width; x++) {
+      col_hashes[x] =
+          JenkinsHashMixBytes(col_hashes[x], rows[y] + (1 + x) * bpp, bpp);
+    }
+  }
+  auto cols_equal = [&](int32_t a, int32_t b) {
+    if (col_hashes[a] != col_hashes[b]) {
+      return false;
+    }
+    for (int32_t y = 1; y <= content_height; y++) {
+      if (memcmp(rows[y] + (1 + a) * bpp, rows[y] + (1 + b) * bpp, bpp) != 0) {
+        return false;
+      }
+    }
+    return true;
+  };
+
+  std::vector<uint32_t> row_hashes(content_height);
+  for (int32_t y = 0; y < content_height; y++) {
+    row_hashes[y] =
+        JenkinsHashMixBytes(0, rows[1 + y] + bpp, content_width * bpp);
+  }
+  auto rows_equal = [&](int32_t a, int32_t b) {
+    return row_hashes[a] == row_hashes[b] &&
+           memcmp(rows[1 + a] + bpp, rows[1 + b] + bpp, content_width * bpp) ==
+               0;
+  };
+
+  std::vector<int32_t> col_runs;
+  std::vector<int32_t> row_runs;
+  FindRuns(source->horizontal_stretch_regions, cols_equal, &col_runs);
+  FindRuns(source->vertical_stretch_regions, rows_equal, &row_runs);
+
+  const int32_t keep_left =
+      std::max(source->padding.left, source->layout_bounds.left);
+  const int32_t keep_right =
+      std::max(source->padding.right, source->layout_bounds.right);
+  const int32_t keep_top =
+      std::max(source->padding.top, source->layout_bounds.top);
+  const int32_t keep_bottom =
+      std::max(source->padding.bottom, source->layout_bounds.bottom);
+
+  AxisPlan col_plan;
+  AxisPlan row_plan;
+  PlanAxis(source->horizontal_stretch_regions, col_runs,
+           ChooseFactor(col_runs, content_width, keep_left, keep_right),
+           content_width, keep_right, &col_plan);
+  PlanAxis(source->vertical_stretch_regions, row_runs,
+           ChooseFactor(row_runs, content_height, keep_top, keep_bottom),
+           content_height, keep_bottom, &row_plan);
+  BuildImage(rows, width, bpp, col_plan, row_plan, out_image);
+
+  // A minimized image that fails to analyze falls back to the source below,
+  // so its error is not reported.
+  std::string minimized_err;
+  std::unique_ptr<NinePatch> minimized =
+      NinePatch::Create(out_image->rows.get(), out_image->width,
+                        out_image->height, options, &minimized_err);
+  if (minimized && minimized->padding == source->padding &&
+      minimized->layout_bounds == source->layout_bounds) {
+    return minimized;
+  }
+
+  // The borders could not keep the insets, e.g. because a single layout
+  // bounds run ends at the far edge, which makes its inset depend on the
+  // length. Keep the image as is.
+  AxisPlan identity_cols;
+  AxisPlan identity_rows;
+  PlanAxis(source->horizontal_stretch_regions, col_runs, 1, content_width,
+           keep_right, &identity_cols);
+  PlanAxis(source->vertical_stretch_regions, row_runs, 1, content_height,
+           keep_bottom, &identity_rows);
+  BuildImage(rows, width, bpp, identity_cols, identity_rows, out_image);
+  return source;
+}
+
+}  // namespace aapt
@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AAPT_COMPILE_NINEPATCH_MINIMIZER_H
+#define AAPT_COMPILE_NINEPATCH_MINIMIZER_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "image.h"
+
+namespace aapt {
+
+/**
+ * Shrinks the stretch regions of a 9-patch whose rows or columns repeat, so
+ * that the decoded bitmap is smaller but renders the same when stretched.
+ *
+ * Within each stretch region, the columns are split into runs of identical
+ * columns (found by hashing each column, and confirmed by comparing the
+ * pixels). Since the stretchable space is shared between the stretch regions
+ * in proportion to their lengths, every run along an axis is shortened by the
+ * same factor: the largest common divisor of their lengths. Rows are handled
+ * the same way. With a factor of 1, for example when some run is a single
+ * column, the axis is left as is.
+ *
+ * The padding and layout bounds are insets from the edges that do not stretch,
+ * so the bottom and right borders are rewritten to keep them. An axis is not
+ * shortened past the point where its padding could no longer be encoded.
+ *
+ * `out_image` receives the minimized image, with its 1px border, in
+ * options.pixel_format. Returns its analysis, or nullptr and sets `out_err` if
+ * the input is not a valid 9-patch. The outline is computed from the minimized
+ * image.
+ */
+std::unique_ptr<NinePatch> MinimizeNinePatch(uint8_t** rows,
+                                             const int32_t width,
+                                             const int32_t height,
+                                             const NinePatchOptions& options,
+                                             Image* out_image,
+                                             std::string* out_err);
+
+}  // namespace aapt
+
+#endif /* AAPT_COMPILE_NINEPATCH_MINIMIZER_H */
@@ -0,0 +1,162 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "NinePatchRegion.h"
+
+#include <memory>
+
+#include "9patch.h"
+#include "NinePatchLayout.h"
+
+using android::Res_png_9patch;
+
+namespace aapt {
+
+// Appends to `out_rects` the union of the patches of `layouts` (of a single
+// query) for which `in_region(col, row)` is true, offset by (`left`, `top`),
+// in y-x bands.
+template <typename InRegion>
+static void CollectRegion(const NinePatchLayouts& layouts, const int32_t left,
+                          const int32_t top, InRegion in_region,
+                          std::vector<Rect>* out_rects) {
+  const int32_t col_count = layouts.col_edge_count - 1;
+  const int32_t row_count = layouts.row_edge_count - 1;
+
+  // The first rectangle of the last band, or out_rects->size() if there is
+  // none.
+  size_t band_start = out_rects->size();
+  std::vector<Rect> spans;
+  for (int32_t j = 0; j < row_count; j++) {
+    const int32_t band_top = top + layouts.row_edges[j];
+    const int32_t band_bottom = top + layouts.row_edges[j + 1];
+    if (band_top >= band_bottom) {
+      continue;
+    }
+
+    spans.clear();
+    for (int32_t i = 0; i < col_count; i++) {
+      const int32_t span_left = left + layouts.col_edges[i];
+      const int32_t span_right = left + layouts.col_edges[i + 1];
+      if (span_left >= span_right || !in_region(i, j)) {
+        continue;
+      }
+      if (!spans.empty() && spans.back().right == span_left) {
+        spans.back().right = span_right;
+      } else {
+        spans.push_back(Rect(span_left, band_top, span_right, band_bottom));
+      }
+    }
+    if (spans.empty()) {
+      band_start = out_rects->size();
+      continue;
+    }
+
+    // Extend the last band down instead if it ends here with the same columns.
+    const size_t band_size = out_rects->size() - band_start;
+    bool same_columns = band_size == spans.size() &&
+                        (*out_rects)[band_start].bottom == band_top;
+    for (size_t k = 0; same_columns && k < band_size; k++) {
+      const Rect& rect = (*out_rects)[band_start + k];
+      same_columns = rect.left == spans[k].left && rect.right == spans[k].right;
+    }
+    if (same_columns) {
+      for (size_t k = band_start; k < out_rects->size(); k++) {
+        (*out_rects)[k].bottom = band_bottom;
+      }
+      continue;
+    }
+    band_start = out_rects->size();
+    out_rects->insert(out_rects->end(), spans.begin(), spans.end());
+  }
+}
+
+// Lays out the patches of the `width` x `height` image of `chunk` drawn into
+// `dst`. Returns false and sets `out_err` if the divs do not fit the image.
+static bool LayoutPatches(const Res_png_9patch& chunk, const int32_t width,
+                          const int32_t height, const Rect& dst,
+                          NinePatchLayouts* out_layouts,
+                          std::string* out_err) {
+  std::unique_ptr<NinePatchLayoutEngine> engine =
+      NinePatchLayoutEngine::Create(chunk, width, height, Bounds(), out_err);
+  if (!engine) {
+    return false;
+  }
+
+  const int32_t dst_width = dst.right - dst.left;
+  const int32_t dst_height = dst.bottom - dst.top;
+  engine->Layout(&dst_width, &dst_height, 1, out_layouts);
+  return true;
+}
+
+bool GetNinePatchTransparentRegion(const Res_png_9patch& chunk,
+                                   const int32_t width, const int32_t height,
+                                   const Rect& dst,
+                                   std::vector<Rect>* out_rects,
+                                   std::string* out_err) {
+  out_rects->clear();
+  NinePatchLayouts layouts;
+  if (!LayoutPatches(chunk, width, height, dst, &layouts, out_err)) {
+    return false;
+  }
+  const int32_t col_count = layouts.col_edge_count - 1;
+  if (chunk.numColors != col_count * (layouts.row_edge_count - 1)) {
+    return true;
+  }
+
+  const uint32_t* colors = chunk.getColors();
+  CollectRegion(layouts, dst.left, dst.top,
+                [&](const int32_t col, const int32_t row) {
+                  return colors[row * col_count + col] ==
+                         Res_png_9patch::TRANSPARENT_COLOR;
+                },
+                out_rects);
+  return true;
+}
+
+bool GetNinePatchOpaqueRegion(const Res_png_9patch& chunk,
+                              const uint8_t* opacities,
+                              const size_t opacity_count, const int32_t width,
+                              const int32_t height, const Rect& dst,
+                              std::vector<Rect>* out_rects,
+                              std::string* out_err) {
+  out_rects->clear();
+  NinePatchLayouts layouts;
+  if (!LayoutPatches(chunk, width, height, dst, &layouts, out_err)) {
+    return false;
+  }
+  const int32_t col_count = layouts.col_edge_count - 1;
+  const size_t patch_count = col_count * (layouts.row_edge_count - 1);
+
+  if (opacities != nullptr && opacity_count == patch_count) {
+    CollectRegion(layouts, dst.left, dst.top,
+                  [&](const int32_t col, const int32_t row) {
+                    return opacities[row * col_count + col] ==
+                           static_cast<uint8_t>(RegionOpacity::kOpaque);
+                  },
+                  out_rects);
+  } else if (chunk.numColors == patch_count) {
+    // NO_COLOR and TRANSPARENT_COLOR both have a zero alpha.
+    const uint32_t* colors = chunk.getColors();
+    CollectRegion(layouts, dst.left, dst.top,
+                  [&](const int32_t col, const int32_t row) {
+                    return (colors[row * col_count + col] >> 24) == 0xff;
+                  },
+                  out_rects);
+  }
+  return true;
+}
+
+}  // namespace aapt
@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AAPT_COMPILE_NINEPATCH_REGION_H
+#define AAPT_COMPILE_NINEPATCH_REGION_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "image.h"
+
+namespace android {
+struct Res_png_9patch;
+}  // namespace android
+
+namespace aapt {
+
+/**
+ * Computes the area covered by the TRANSPARENT_COLOR patches of the `width` x
+ * `height` image of `chunk` drawn into `dst`, for the compositor to skip. The
+ * chunk must be in device byte order (see Res_png_9patch::fileToDevice()).
+ *
+ * The patches are laid out as NinePatchLayoutEngine does. The area is
+ * returned in `out_rects` as disjoint rectangles in y-x bands, like a Skia
+ * region: sorted from top to bottom and left to right, the rectangles of a
+ * band share their top and bottom, touching rectangles of a band are merged,
+ * and touching bands with the same columns are merged. `out_rects` is empty if
+ * the chunk does not have one color per patch.
+ *
+ * Returns false and sets `out_err` if the divs do not fit the image.
+ */
+bool GetNinePatchTransparentRegion(const android::Res_png_9patch& chunk,
+                                   const int32_t width, const int32_t height,
+                                   const Rect& dst,
+                                   std::vector<Rect>* out_rects,
+                                   std::string* out_err);
+
+/**
+ * Computes the area covered by the opaque patches of the `width` x `height`
+ * image of `chunk` drawn into `dst`, which the compositor can draw without
+ * blending and cull what is underneath. The chunk must be in device byte
+ * order.
+ *
+ * `opacities` holds the `opacity_count` RegionOpacity bytes serialized by
+ * NinePatch::SerializeRegionOpacities(). If it is null or does not have one
+ * byte per patch, only the patches of an opaque solid color are known to be
+ * opaque. The area is returned in `out_rects` in the same y-x bands as
+ * GetNinePatchTransparentRegion().
+ *
+ * Drawn with filtering, the pixels along the edge between an opaque patch and
+ * a translucent one are blended; callers that filter should inset the
+ * rectangles by a pixel where they do not touch the edge of `dst`.
+ *
+ * Returns false and sets `out_err` if the divs do not fit the image.
+ */
+bool GetNinePatchOpaqueRegion(const android::Res_png_9patch& chunk,
+                              const uint8_t* opacities,
+                              const size_t opacity_count, const int32_t width,
+                              const int32_t height, const Rect& dst,
+                              std::vector<Rect>* out_rects,
+                              std::string* out_err);
+
+}  // namespace aapt
+
+#endif /* AAPT_COMPILE_NINEPATCH_REGION_H */
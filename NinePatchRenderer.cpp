@@ -0,0 +1,221 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "NinePatchRenderer.h"
+
+#include <cstring>
+
+#include "9patch.h"
+#include "NinePatchSimd.h"
+
+using android::Res_png_9patch;
+
+namespace aapt {
+
+using Segment = NinePatchRenderer::Segment;
+
+// Splits [0, length) into segments at the `count` divs, the same way the
+// region colors are laid out: a fixed segment is only added between two stretch
+// segments that do not touch. Returns false if the divs are not pairs of
+// increasing positions within the length.
+static bool SplitDivs(const int32_t* divs, const int32_t count,
+                      const int32_t length,
+                      std::vector<Segment>* out_segments) {
+  if (count % 2 != 0) {
+    return false;
+  }
+
+  int32_t next_start = 0;
+  for (int32_t i = 0; i < count; i += 2) {
+    const int32_t start = divs[i];
+    const int32_t end = divs[i + 1];
+    if (start < next_start || end < start || end > length) {
+      return false;
+    }
+    if (start != next_start) {
+      out_segments->push_back(Segment{next_start, start, false});
+    }
+    out_segments->push_back(Segment{start, end, true});
+    next_start = end;
+  }
+  if (next_start != length) {
+    out_segments->push_back(Segment{next_start, length, false});
+  }
+  return true;
+}
+
+// Lays out the segments of one axis over `length` destination pixels. Appends
+// the source pixel of each destination pixel to `out_sources`, and the
+// destination end of each segment to `out_ends`.
+static void LayoutAxis(const std::vector<Segment>& segments,
+                       const int32_t length, std::vector<int32_t>* out_sources,
+                       std::vector<int32_t>* out_ends) {
+  int64_t fixed_length = 0;
+  int64_t stretch_length = 0;
+  for (const Segment& segment : segments) {
+    (segment.stretch ? stretch_length : fixed_length) +=
+        segment.end - segment.start;
+  }
+
+  // Either the stretch segments share what the fixed segments leave, or the
+  // fixed segments share all of it. The running total of the shares is
+  // rounded to the nearest pixel, half up, as the framework rounds the edges
+  // of its lattice, so that they add up to exactly `space`.
+  const bool stretches = stretch_length > 0 && length >= fixed_length;
+  const int64_t space = stretches ? length - fixed_length : length;
+  const int64_t shared_length = stretches ? stretch_length : fixed_length;
+  int64_t consumed = 0;
+  for (const Segment& segment : segments) {
+    const int32_t source_length = segment.end - segment.start;
+    int32_t dst_length = 0;
+    if (segment.stretch == stretches && shared_length > 0) {
+      const int64_t before =
+          (2 * space * consumed + shared_length) / (2 * shared_length);
+      consumed += source_length;
+      dst_length = static_cast<int32_t>(
+          (2 * space * consumed + shared_length) / (2 * shared_length) -
+          before);
+    } else if (stretches) {
+      dst_length = source_length;
+    }
+
+    for (int32_t d = 0; d < dst_length; d++) {
+      out_sources->push_back(
+          segment.start +
+          static_cast<int32_t>((2 * (int64_t)d + 1) * source_length /
+                               (2 * (int64_t)dst_length)));
+    }
+    out_ends->push_back(static_cast<int32_t>(out_sources->size()));
+  }
+}
+
+// Sets `count` RGBA_8888 pixels to the packed 0xAARRGGBB `color`.
+static void FillPixels(uint8_t* pixels, const uint32_t color,
+                       const int32_t count) {
+  const uint8_t pixel[4] = {
+      static_cast<uint8_t>(color >> 16), static_cast<uint8_t>(color >> 8),
+      static_cast<uint8_t>(color), static_cast<uint8_t>(color >> 24)};
+  for (int32_t i = 0; i < count; i++) {
+    memcpy(pixels + i * 4, pixel, 4);
+  }
+}
+
+/**
+ * The destination columns of one region of a band of rows, if it is drawn.
+ */
+struct RenderSpan {
+  int32_t start;
+  int32_t end;
+
+  // The region color, or NO_COLOR if it is sampled.
+  uint32_t color;
+
+  // True if the region keeps the width of its source columns, which can then
+  // be copied as they are.
+  bool unscaled;
+};
+
+std::unique_ptr<NinePatchRenderer> NinePatchRenderer::Create(
+    const Res_png_9patch& chunk, const int32_t width, const int32_t height,
+    std::string* out_err) {
+  std::unique_ptr<NinePatchRenderer> renderer(new NinePatchRenderer());
+  if (!SplitDivs(chunk.getXDivs(), chunk.numXDivs, width,
+                 &renderer->col_segments_)) {
+    *out_err = "9-patch xDivs do not fit the image width";
+    return {};
+  }
+  if (!SplitDivs(chunk.getYDivs(), chunk.numYDivs, height,
+                 &renderer->row_segments_)) {
+    *out_err = "9-patch yDivs do not fit the image height";
+    return {};
+  }
+
+  const size_t region_count =
+      renderer->col_segments_.size() * renderer->row_segments_.size();
+  if (chunk.numColors == region_count) {
+    const uint32_t* colors = chunk.getColors();
+    renderer->colors_.assign(colors, colors + region_count);
+  }
+  return renderer;
+}
+
+void NinePatchRenderer::Render(uint8_t** rows, const int32_t dst_width,
+                               const int32_t dst_height,
+                               uint8_t** out_rows) const {
+  std::vector<int32_t> source_cols;
+  std::vector<int32_t> col_ends;
+  std::vector<int32_t> source_rows;
+  std::vector<int32_t> row_ends;
+  LayoutAxis(col_segments_, dst_width, &source_cols, &col_ends);
+  LayoutAxis(row_segments_, dst_height, &source_rows, &row_ends);
+
+  const simd::Kernels& kernels = simd::ActiveKernels();
+  std::vector<RenderSpan> spans;
+  int32_t band_start = 0;
+  for (size_t j = 0; j < row_segments_.size(); j++) {
+    const int32_t band_end = row_ends[j];
+
+    spans.clear();
+    bool sampled = false;
+    int32_t col_start = 0;
+    for (size_t i = 0; i < col_segments_.size(); i++) {
+      const int32_t col_end = col_ends[i];
+      const uint32_t color =
+          colors_.empty() ? static_cast<uint32_t>(Res_png_9patch::NO_COLOR)
+                          : colors_[j * col_segments_.size() + i];
+      if (col_end > col_start && color != Res_png_9patch::TRANSPARENT_COLOR) {
+        const Segment& segment = col_segments_[i];
+        spans.push_back(RenderSpan{
+            col_start, col_end, color,
+            col_end - col_start == segment.end - segment.start});
+        sampled |= color == Res_png_9patch::NO_COLOR;
+      }
+      col_start = col_end;
+    }
+
+    for (int32_t y = band_start; y < band_end; y++) {
+      uint8_t* dst = out_rows[y];
+
+      // A row that reads the same source row as the one above, or no source
+      // row at all, is the same as the row above.
+      if (y > band_start &&
+          (!sampled || source_rows[y] == source_rows[y - 1])) {
+        for (const RenderSpan& span : spans) {
+          memcpy(dst + span.start * 4, out_rows[y - 1] + span.start * 4,
+                 (span.end - span.start) * 4);
+        }
+        continue;
+      }
+
+      const uint8_t* src = rows[source_rows[y]];
+      for (const RenderSpan& span : spans) {
+        uint8_t* cursor = dst + span.start * 4;
+        const int32_t count = span.end - span.start;
+        if (span.color != Res_png_9patch::NO_COLOR) {
+          FillPixels(cursor, span.color, count);
+        } else if (span.unscaled) {
+          memcpy(cursor, src + source_cols[span.start] * 4, count * 4);
+        } else {
+          kernels.gather_pixels(cursor, src, source_cols.data() + span.start,
+                                count);
+        }
+      }
+    }
+    band_start = band_end;
+  }
+}
+
+}  // namespace aapt
@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AAPT_COMPILE_NINEPATCH_RENDERER_H
+#define AAPT_COMPILE_NINEPATCH_RENDERER_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "macros.h"
+
+namespace android {
+struct Res_png_9patch;
+}  // namespace android
+
+namespace aapt {
+
+/**
+ * Draws an RGBA_8888 image stretched to any size by its Res_png_9patch chunk,
+ * on the CPU.
+ *
+ * Each axis is split at the divs of the chunk into fixed and stretch segments.
+ * Fixed segments keep their length, and stretch segments share the remaining
+ * space in proportion to their lengths. If there is not enough space for the
+ * fixed segments, or there is no stretch segment, the fixed segments are
+ * scaled to fit instead. Every destination pixel takes the color of the
+ * nearest source pixel.
+ *
+ * The colors of the chunk are used as hints: regions of a solid color are
+ * filled with it without reading the source, and TRANSPARENT_COLOR regions are
+ * not written at all, as when drawing over the destination. In the other
+ * regions, a source row is stretched horizontally with the SIMD gather
+ * kernel, and the following destination rows that sample the same source row
+ * are copied from it.
+ */
+class NinePatchRenderer {
+ public:
+  /**
+   * A fixed or stretch segment of one axis, in source pixels.
+   */
+  struct Segment {
+    int32_t start;
+    int32_t end;
+    bool stretch;
+  };
+
+  /**
+   * Prepares to render the `width` x `height` image of `chunk`, which must be
+   * in device byte order (see Res_png_9patch::fileToDevice()). The divs are
+   * relative to the image without the 1px border. If the chunk does not have
+   * one color per region, every region is sampled. Returns nullptr and sets
+   * `out_err` if the divs do not fit the image.
+   */
+  static std::unique_ptr<NinePatchRenderer> Create(
+      const android::Res_png_9patch& chunk, const int32_t width,
+      const int32_t height, std::string* out_err);
+
+  /**
+   * Renders the image `rows`, without the 1px border, into the rows of the
+   * `dst_width` x `dst_height` image `out_rows`.
+   */
+  void Render(uint8_t** rows, const int32_t dst_width,
+              const int32_t dst_height, uint8_t** out_rows) const;
+
+ private:
+  explicit NinePatchRenderer() = default;
+
+  std::vector<Segment> col_segments_;
+  std::vector<Segment> row_segments_;
+
+  // One color per region, row by row, or empty if the chunk has no hints.
+  std::vector<uint32_t> colors_;
+
+  DISALLOW_COPY_AND_ASSIGN(NinePatchRenderer);
+};
+
+}  // namespace aapt
+
+#endif /* AAPT_COMPILE_NINEPATCH_RENDERER_H */
@@ -0,0 +1,285 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "NinePatchRescaler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include "NinePatchSimd.h"
+
+namespace aapt {
+
+/**
+ * Maps positions along one axis of the content, excluding the border, from
+ * the source to the target. The axis is split into segments at the edges of
+ * the stretch regions; segment k spans [source_edges[k], source_edges[k + 1])
+ * and becomes [target_edges[k], target_edges[k + 1]).
+ */
+class AxisMap {
+ public:
+  explicit AxisMap(const std::vector<Range>& stretch_regions,
+                   const int32_t length, const double scale) {
+    source_edges_.push_back(0);
+    for (const Range& range : stretch_regions) {
+      source_edges_.push_back(range.start);
+      source_edges_.push_back(range.end);
+    }
+    source_edges_.push_back(length);
+
+    // Non-empty segments keep at least one pixel.
+    target_edges_.push_back(0);
+    for (size_t k = 1; k < source_edges_.size(); k++) {
+      const int32_t previous = target_edges_.back();
+      int32_t edge =
+          static_cast<int32_t>(std::lround(source_edges_[k] * scale));
+      if (source_edges_[k] > source_edges_[k - 1]) {
+        edge = std::max(edge, previous + 1);
+      } else {
+        edge = previous;
+      }
+      target_edges_.push_back(edge);
+    }
+  }
+
+  int32_t source_length() const { return source_edges_.back(); }
+
+  int32_t target_length() const { return target_edges_.back(); }
+
+  /**
+   * Returns the target position of source position `pos`, in [0, length],
+   * by scaling it within its segment.
+   */
+  int32_t Map(const int32_t pos) const {
+    for (size_t k = 0; k + 1 < source_edges_.size(); k++) {
+      const int32_t start = source_edges_[k];
+      const int32_t end = source_edges_[k + 1];
+      if (pos <= end && end > start) {
+        const int64_t offset = (int64_t)std::max(pos - start, 0) *
+                               (target_edges_[k + 1] - target_edges_[k]);
+        return target_edges_[k] +
+               static_cast<int32_t>((2 * offset + (end - start)) /
+                                    (2 * (end - start)));
+      }
+    }
+    return target_edges_.back();
+  }
+
+  /**
+   * Appends, for each target pixel, the source pixels it covers and their
+   * weights, which add up to 1. Target pixel i uses the taps in
+   * [offsets[i], offsets[i + 1]).
+   */
+  void BuildTaps(std::vector<int32_t>* out_offsets,
+                 std::vector<int32_t>* out_sources,
+                 std::vector<float>* out_weights) const {
+    out_offsets->push_back(0);
+    for (size_t k = 0; k + 1 < source_edges_.size(); k++) {
+      const int32_t source_start = source_edges_[k];
+      const int32_t target_start = target_edges_[k];
+      const int32_t target_count = target_edges_[k + 1] - target_start;
+      if (target_count == 0) {
+        continue;
+      }
+
+      // In units of 1 / (source_count * target_count) of the segment, target
+      // pixel t covers [t * source_count, (t + 1) * source_count) and source
+      // pixel s covers [s * target_count, (s + 1) * target_count), so the
+      // coverage is exact and never reaches past the segment.
+      const int64_t source_count = source_edges_[k + 1] - source_start;
+      for (int32_t t = 0; t < target_count; t++) {
+        const int64_t begin = t * source_count;
+        const int64_t end = begin + source_count;
+        for (int64_t s = begin / target_count; s * target_count < end; s++) {
+          const int64_t covered = std::min(end, (s + 1) * target_count) -
+                                  std::max(begin, s * target_count);
+          if (covered > 0) {
+            out_sources->push_back(source_start + static_cast<int32_t>(s));
+            out_weights->push_back(
+                static_cast<float>((double)covered / source_count));
+          }
+        }
+        out_offsets->push_back(static_cast<int32_t>(out_sources->size()));
+      }
+    }
+  }
+
+ private:
+  std::vector<int32_t> source_edges_;
+  std::vector<int32_t> target_edges_;
+
+  DISALLOW_COPY_AND_ASSIGN(AxisMap);
+};
+
+// Rewrites the content of a border line, `length` pixels long excluding the
+// corners, moving the ends of each run of one color to their mapped position.
+// `get(i)` and `set(i, pixel)` access the source and target pixels, with i
+// excluding the corner. Runs keep at least one pixel while there is room.
+template <typename GetFn, typename SetFn>
+static void ScaleBorderLine(const AxisMap& map, GetFn get, SetFn set) {
+  const int32_t length = map.source_length();
+  const int32_t target_length = map.target_length();
+  int32_t target_start = 0;
+  int32_t run_start = 0;
+  for (int32_t i = 1; i <= length; i++) {
+    if (i < length && memcmp(get(i), get(run_start), 4) == 0) {
+      continue;
+    }
+    int32_t target_end = std::max(map.Map(i), target_start + 1);
+    target_end = i == length ? target_length
+                             : std::min(target_end, target_length);
+    for (int32_t t = target_start; t < target_end; t++) {
+      set(t, get(run_start));
+    }
+    target_start = std::max(target_start, target_end);
+    run_start = i;
+  }
+}
+
+// Converts `count` RGBA_8888 pixels to premultiplied floats in [0, 255].
+static void ToPremultipliedFloats(const uint8_t* pixels, const int32_t count,
+                                  float* out) {
+  for (int32_t i = 0; i < count; i++) {
+    const float alpha = pixels[i * 4 + 3];
+    const float factor = alpha / 255.0f;
+    out[i * 4 + 0] = pixels[i * 4 + 0] * factor;
+    out[i * 4 + 1] = pixels[i * 4 + 1] * factor;
+    out[i * 4 + 2] = pixels[i * 4 + 2] * factor;
+    out[i * 4 + 3] = alpha;
+  }
+}
+
+static inline uint8_t ToChannel(const float value) {
+  return static_cast<uint8_t>(std::min(255.0f, std::max(0.0f, value)) + 0.5f);
+}
+
+std::unique_ptr<NinePatch> RescaleNinePatch(uint8_t** rows,
+                                            const int32_t width,
+                                            const int32_t height,
+                                            const NinePatch& nine_patch,
+                                            const float scale,
+                                            Image* out_image,
+                                            std::string* out_err) {
+  if (!(scale > 0.0f) || width < 3 || height < 3) {
+    *out_err = "invalid 9-patch scale";
+    return {};
+  }
+
+  const AxisMap col_map(nine_patch.horizontal_stretch_regions, width - 2,
+                        scale);
+  const AxisMap row_map(nine_patch.vertical_stretch_regions, height - 2,
+                        scale);
+  std::vector<int32_t> col_offsets;
+  std::vector<int32_t> col_sources;
+  std::vector<float> col_weights;
+  col_map.BuildTaps(&col_offsets, &col_sources, &col_weights);
+  std::vector<int32_t> row_offsets;
+  std::vector<int32_t> row_sources;
+  std::vector<float> row_weights;
+  row_map.BuildTaps(&row_offsets, &row_sources, &row_weights);
+
+  const int32_t source_width = width - 2;
+  const int32_t target_width = col_map.target_length();
+  const int32_t target_height = row_map.target_length();
+  const int32_t new_width = target_width + 2;
+  const int32_t new_height = target_height + 2;
+  out_image->width = new_width;
+  out_image->height = new_height;
+  out_image->data.reset(new uint8_t[(size_t)new_width * new_height * 4]);
+  out_image->rows.reset(new uint8_t*[new_height]);
+  for (int32_t y = 0; y < new_height; y++) {
+    out_image->rows[y] = out_image->data.get() + (size_t)y * new_width * 4;
+  }
+  uint8_t** target = out_image->rows.get();
+
+  // The top border, with the corners.
+  memcpy(target[0], rows[0], 4);
+  memcpy(target[0] + (new_width - 1) * 4, rows[0] + (width - 1) * 4, 4);
+  ScaleBorderLine(
+      col_map, [&](int32_t x) { return rows[0] + (1 + x) * 4; },
+      [&](int32_t x, const uint8_t* pixel) {
+        memcpy(target[0] + (1 + x) * 4, pixel, 4);
+      });
+
+  // The content, and the left and right borders. `source_row` holds the
+  // premultiplied source row `converted_row`, and `sum` the weighted sum of
+  // the source rows covered by the current target row.
+  const simd::Kernels& kernels = simd::ActiveKernels();
+  std::vector<float> source_row(source_width * 4);
+  std::vector<float> sum(source_width * 4);
+  int32_t converted_row = -1;
+  for (int32_t ty = 0; ty < target_height; ty++) {
+    std::fill(sum.begin(), sum.end(), 0.0f);
+    for (int32_t tap = row_offsets[ty]; tap < row_offsets[ty + 1]; tap++) {
+      if (row_sources[tap] != converted_row) {
+        converted_row = row_sources[tap];
+        ToPremultipliedFloats(rows[1 + converted_row] + 4, source_width,
+                              source_row.data());
+      }
+      kernels.weighted_add(sum.data(), source_row.data(), row_weights[tap],
+                           source_width * 4);
+    }
+
+    uint8_t* dst = target[1 + ty] + 4;
+    for (int32_t tx = 0; tx < target_width; tx++) {
+      float pixel[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+      for (int32_t tap = col_offsets[tx]; tap < col_offsets[tx + 1]; tap++) {
+        const float* src = sum.data() + col_sources[tap] * 4;
+        const float weight = col_weights[tap];
+        for (int32_t c = 0; c < 4; c++) {
+          pixel[c] += weight * src[c];
+        }
+      }
+
+      const uint8_t alpha = ToChannel(pixel[3]);
+      if (alpha == 0) {
+        memset(dst + tx * 4, 0, 4);
+        continue;
+      }
+      const float unpremultiply = 255.0f / pixel[3];
+      for (int32_t c = 0; c < 3; c++) {
+        dst[tx * 4 + c] = ToChannel(pixel[c] * unpremultiply);
+      }
+      dst[tx * 4 + 3] = alpha;
+    }
+  }
+  ScaleBorderLine(
+      row_map, [&](int32_t y) { return rows[1 + y]; },
+      [&](int32_t y, const uint8_t* pixel) {
+        memcpy(target[1 + y], pixel, 4);
+      });
+  ScaleBorderLine(
+      row_map, [&](int32_t y) { return rows[1 + y] + (width - 1) * 4; },
+      [&](int32_t y, const uint8_t* pixel) {
+        memcpy(target[1 + y] + (new_width - 1) * 4, pixel, 4);
+      });
+
+  // The bottom border, with the corners.
+  uint8_t* bottom = target[new_height - 1];
+  memcpy(bottom, rows[height - 1], 4);
+  memcpy(bottom + (new_width - 1) * 4, rows[height - 1] + (width - 1) * 4, 4);
+  ScaleBorderLine(
+      col_map, [&](int32_t x) { return rows[height - 1] + (1 + x) * 4; },
+      [&](int32_t x, const uint8_t* pixel) {
+        memcpy(bottom + (1 + x) * 4, pixel, 4);
+      });
+
+  return NinePatch::Create(target, new_width, new_height, out_err);
+}
+
+}  // namespace aapt
@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AAPT_COMPILE_NINEPATCH_RESCALER_H
+#define AAPT_COMPILE_NINEPATCH_RESCALER_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "image.h"
+
+namespace aapt {
+
+/**
+ * Resamples a 9-patch to another density, e.g. with a `scale` of 0.75 to go
+ * from xhdpi to hdpi.
+ *
+ * Each axis of the content is split at the edges of the stretch regions into
+ * segments, whose edges are scaled and rounded. Every segment keeps at least
+ * one pixel, so the regions, and the indices of their colors, stay the same.
+ * The content is then area-averaged within each segment: a target pixel
+ * averages the source pixels it covers, weighted by how much it covers them,
+ * in premultiplied alpha. Since no average spans two segments, the edges of
+ * the stretch regions stay sharp and solid regions keep their exact color.
+ *
+ * The border is not averaged: the runs of each border line, e.g. the padding
+ * and layout bounds on the bottom border, are moved to the scaled positions of
+ * their ends, keeping their colors. The outline and region colors of the
+ * result are computed from the scaled image.
+ *
+ * The content of the source is read once, top to bottom: each row is
+ * converted to premultiplied floats once, and added with the SIMD kernels to
+ * the target rows it covers.
+ *
+ * `rows` is the RGBA_8888 source image, with its 1px border, and
+ * `nine_patch` its analysis. `out_image` receives the scaled image, with its
+ * border. Returns its analysis, or nullptr and sets `out_err` if `scale` is
+ * not positive or the scaled borders are not a valid 9-patch.
+ */
+std::unique_ptr<NinePatch> RescaleNinePatch(uint8_t** rows,
+                                            const int32_t width,
+                                            const int32_t height,
+                                            const NinePatch& nine_patch,
+                                            const float scale,
+                                            Image* out_image,
+                                            std::string* out_err);
+
+}  // namespace aapt
+
+#endif /* AAPT_COMPILE_NINEPATCH_RESCALER_H */
@@ -0,0 +1,517 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "NinePatchSimd.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+#include "image.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || \
+    defined(_M_IX86)
+#define NINEPATCH_SIMD_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+// GCC and Clang only emit instructions for the ISA the translation unit is
+// compiled for, unless a function opts into a wider one.
+#if defined(__GNUC__) || defined(__clang__)
+#define NINEPATCH_TARGET(isa) __attribute__((target(isa)))
+#else
+#define NINEPATCH_TARGET(isa)
+#endif
+
+namespace aapt {
+namespace simd {
+
+static int32_t FindRunEndScalar(const uint8_t* pixels, int32_t start,
+                                int32_t end, uint32_t mask, uint32_t value) {
+  for (int32_t idx = start; idx < end; idx++) {
+    if ((NinePatch::PackRGBA(pixels + idx * 4) & mask) != value) {
+      return idx;
+    }
+  }
+  return end;
+}
+
+static uint32_t MaxAlphaScalar(const uint8_t* pixels, int32_t start,
+                               int32_t end) {
+  uint32_t max_alpha = 0;
+  for (int32_t idx = start; idx < end && max_alpha != 0xff; idx++) {
+    max_alpha = std::max<uint32_t>(max_alpha, pixels[idx * 4 + 3]);
+  }
+  return max_alpha;
+}
+
+static int32_t FindAlphaScalar(const uint8_t* pixels, int32_t start,
+                               int32_t end, uint32_t alpha) {
+  for (int32_t idx = start; idx < end; idx++) {
+    if (pixels[idx * 4 + 3] >= alpha) {
+      return idx;
+    }
+  }
+  return end;
+}
+
+static int32_t FindLastAlphaScalar(const uint8_t* pixels, int32_t start,
+                                   int32_t end, uint32_t alpha) {
+  for (int32_t idx = end - 1; idx >= start; idx--) {
+    if (pixels[idx * 4 + 3] >= alpha) {
+      return idx;
+    }
+  }
+  return start - 1;
+}
+
+static void WeightedAddScalar(float* dst, const float* src, float weight,
+                              int32_t count) {
+  for (int32_t idx = 0; idx < count; idx++) {
+    const float product = weight * src[idx];
+    dst[idx] += product;
+  }
+}
+
+static void GatherPixelsScalar(uint8_t* dst, const uint8_t* pixels,
+                               const int32_t* indices, int32_t count) {
+  for (int32_t idx = 0; idx < count; idx++) {
+    memcpy(dst + idx * 4, pixels + indices[idx] * 4, 4);
+  }
+}
+
+static const Kernels kScalarKernels = {
+    Level::kScalar,
+    FindRunEndScalar,
+    MaxAlphaScalar,
+    FindAlphaScalar,
+    FindLastAlphaScalar,
+    WeightedAddScalar,
+    GatherPixelsScalar,
+};
+
+#if defined(NINEPATCH_SIMD_X86)
+
+// x86 is little-endian, so an RGBA_8888 pixel loaded as a 32-bit lane is
+// 0xAABBGGRR. Converts a packed 0xAARRGGBB color to that layout (and back).
+static inline uint32_t SwapRedBlue(uint32_t color) {
+  return (color & 0xff00ff00u) | ((color >> 16) & 0xffu) |
+         ((color & 0xffu) << 16);
+}
+
+static inline int32_t CountTrailingZeros(uint32_t bits) {
+#if defined(_MSC_VER)
+  unsigned long index;
+  _BitScanForward(&index, bits);
+  return static_cast<int32_t>(index);
+#else
+  return __builtin_ctz(bits);
+#endif
+}
+
+// Processes 8 pixels per step.
+NINEPATCH_TARGET("sse2")
+static int32_t FindRunEndSse2(const uint8_t* pixels, int32_t start,
+                              int32_t end, uint32_t mask, uint32_t value) {
+  const __m128i vmask = _mm_set1_epi32(static_cast<int>(SwapRedBlue(mask)));
+  const __m128i vvalue = _mm_set1_epi32(static_cast<int>(SwapRedBlue(value)));
+  int32_t idx = start;
+  for (; idx + 8 <= end; idx += 8) {
+    const uint8_t* cursor = pixels + idx * 4;
+    const __m128i lo =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(cursor));
+    const __m128i hi =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(cursor + 16));
+    const __m128i eq_lo = _mm_cmpeq_epi32(_mm_and_si128(lo, vmask), vvalue);
+    const __m128i eq_hi = _mm_cmpeq_epi32(_mm_and_si128(hi, vmask), vvalue);
+    const uint32_t bits =
+        static_cast<uint32_t>(_mm_movemask_ps(_mm_castsi128_ps(eq_lo))) |
+        (static_cast<uint32_t>(_mm_movemask_ps(_mm_castsi128_ps(eq_hi))) << 4);
+    if (bits != 0xffu) {
+      return idx + CountTrailingZeros(~bits);
+    }
+  }
+  return FindRunEndScalar(pixels, idx, end, mask, value);
+}
+
+static inline int32_t HighestSetBit(uint32_t bits) {
+#if defined(_MSC_VER)
+  unsigned long index;
+  _BitScanReverse(&index, bits);
+  return static_cast<int32_t>(index);
+#else
+  return 31 - __builtin_clz(bits);
+#endif
+}
+
+// The alpha kernels compare whole vectors of bytes against a vector holding
+// the alpha in byte 3 of each 32-bit lane and 0 in the color bytes, so only the
+// alpha bytes can differ.
+
+// Returns one bit per pixel of `pixels`, set if its alpha is at least the
+// alpha in `threshold`.
+NINEPATCH_TARGET("sse2")
+static inline uint32_t AlphaAtLeastSse2(__m128i pixels, __m128i threshold) {
+  const __m128i at_least =
+      _mm_cmpeq_epi8(_mm_max_epu8(pixels, threshold), pixels);
+  return static_cast<uint32_t>(_mm_movemask_ps(_mm_castsi128_ps(at_least)));
+}
+
+// Returns the largest alpha held by the lanes of `alphas`.
+NINEPATCH_TARGET("sse2")
+static inline uint32_t ReduceMaxAlphaSse2(__m128i alphas) {
+  alphas = _mm_max_epu8(alphas, _mm_srli_si128(alphas, 8));
+  alphas = _mm_max_epu8(alphas, _mm_srli_si128(alphas, 4));
+  return static_cast<uint32_t>(_mm_cvtsi128_si32(alphas)) >> 24;
+}
+
+// Processes 16 pixels per step.
+NINEPATCH_TARGET("sse2")
+static uint32_t MaxAlphaSse2(const uint8_t* pixels, int32_t start,
+                             int32_t end) {
+  const __m128i alpha_mask = _mm_set1_epi32(static_cast<int>(0xff000000u));
+  __m128i vmax = _mm_setzero_si128();
+  int32_t idx = start;
+  for (; idx + 16 <= end; idx += 16) {
+    const __m128i* cursor = reinterpret_cast<const __m128i*>(pixels + idx * 4);
+    const __m128i a = _mm_max_epu8(_mm_loadu_si128(cursor),
+                                   _mm_loadu_si128(cursor + 1));
+    const __m128i b = _mm_max_epu8(_mm_loadu_si128(cursor + 2),
+                                   _mm_loadu_si128(cursor + 3));
+    vmax = _mm_max_epu8(vmax, _mm_and_si128(_mm_max_epu8(a, b), alpha_mask));
+    if (_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(vmax, alpha_mask))) !=
+        0) {
+      return 0xff;
+    }
+  }
+  return std::max(ReduceMaxAlphaSse2(vmax), MaxAlphaScalar(pixels, idx, end));
+}
+
+// Processes 8 pixels per step.
+NINEPATCH_TARGET("sse2")
+static int32_t FindAlphaSse2(const uint8_t* pixels, int32_t start,
+                             int32_t end, uint32_t alpha) {
+  const __m128i threshold = _mm_set1_epi32(static_cast<int>(alpha << 24));
+  int32_t idx = start;
+  for (; idx + 8 <= end; idx += 8) {
+    const __m128i* cursor = reinterpret_cast<const __m128i*>(pixels + idx * 4);
+    const uint32_t bits =
+        AlphaAtLeastSse2(_mm_loadu_si128(cursor), threshold) |
+        (AlphaAtLeastSse2(_mm_loadu_si128(cursor + 1), threshold) << 4);
+    if (bits != 0) {
+      return idx + CountTrailingZeros(bits);
+    }
+  }
+  return FindAlphaScalar(pixels, idx, end, alpha);
+}
+
+// Processes 8 pixels per step.
+NINEPATCH_TARGET("sse2")
+static int32_t FindLastAlphaSse2(const uint8_t* pixels, int32_t start,
+                                 int32_t end, uint32_t alpha) {
+  const __m128i threshold = _mm_set1_epi32(static_cast<int>(alpha << 24));
+  int32_t idx = end;
+  for (; idx - 8 >= start; idx -= 8) {
+    const __m128i* cursor =
+        reinterpret_cast<const __m128i*>(pixels + (idx - 8) * 4);
+    const uint32_t bits =
+        AlphaAtLeastSse2(_mm_loadu_si128(cursor), threshold) |
+        (AlphaAtLeastSse2(_mm_loadu_si128(cursor + 1), threshold) << 4);
+    if (bits != 0) {
+      return idx - 8 + HighestSetBit(bits);
+    }
+  }
+  return FindLastAlphaScalar(pixels, start, idx, alpha);
+}
+
+// Processes 8 floats per step.
+NINEPATCH_TARGET("sse2")
+static void WeightedAddSse2(float* dst, const float* src, float weight,
+                            int32_t count) {
+  const __m128 vweight = _mm_set1_ps(weight);
+  int32_t idx = 0;
+  for (; idx + 8 <= count; idx += 8) {
+    const __m128 lo = _mm_mul_ps(vweight, _mm_loadu_ps(src + idx));
+    const __m128 hi = _mm_mul_ps(vweight, _mm_loadu_ps(src + idx + 4));
+    _mm_storeu_ps(dst + idx, _mm_add_ps(_mm_loadu_ps(dst + idx), lo));
+    _mm_storeu_ps(dst + idx + 4, _mm_add_ps(_mm_loadu_ps(dst + idx + 4), hi));
+  }
+  WeightedAddScalar(dst + idx, src + idx, weight, count - idx);
+}
+
+static inline int LoadPixel(const uint8_t* pixels, int32_t idx) {
+  int pixel;
+  memcpy(&pixel, pixels + idx * 4, 4);
+  return pixel;
+}
+
+// SSE2 has no gather, but assembling 4 pixels in a register and storing them
+// at once still beats 4 separate stores. Processes 8 pixels per step.
+NINEPATCH_TARGET("sse2")
+static void GatherPixelsSse2(uint8_t* dst, const uint8_t* pixels,
+                             const int32_t* indices, int32_t count) {
+  int32_t idx = 0;
+  for (; idx + 8 <= count; idx += 8) {
+    const int32_t* at = indices + idx;
+    const __m128i lo =
+        _mm_set_epi32(LoadPixel(pixels, at[3]), LoadPixel(pixels, at[2]),
+                      LoadPixel(pixels, at[1]), LoadPixel(pixels, at[0]));
+    const __m128i hi =
+        _mm_set_epi32(LoadPixel(pixels, at[7]), LoadPixel(pixels, at[6]),
+                      LoadPixel(pixels, at[5]), LoadPixel(pixels, at[4]));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + idx * 4), lo);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + idx * 4 + 16), hi);
+  }
+  GatherPixelsScalar(dst + idx * 4, pixels, indices + idx, count - idx);
+}
+
+static const Kernels kSse2Kernels = {
+    Level::kSse2,
+    FindRunEndSse2,
+    MaxAlphaSse2,
+    FindAlphaSse2,
+    FindLastAlphaSse2,
+    WeightedAddSse2,
+    GatherPixelsSse2,
+};
+
+// Processes 16 pixels per step.
+NINEPATCH_TARGET("avx2")
+static int32_t FindRunEndAvx2(const uint8_t* pixels, int32_t start,
+                              int32_t end, uint32_t mask, uint32_t value) {
+  const __m256i vmask =
+      _mm256_set1_epi32(static_cast<int>(SwapRedBlue(mask)));
+  const __m256i vvalue =
+      _mm256_set1_epi32(static_cast<int>(SwapRedBlue(value)));
+  int32_t idx = start;
+  for (; idx + 16 <= end; idx += 16) {
+    const uint8_t* cursor = pixels + idx * 4;
+    const __m256i lo =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(cursor));
+    const __m256i hi =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(cursor + 32));
+    const __m256i eq_lo =
+        _mm256_cmpeq_epi32(_mm256_and_si256(lo, vmask), vvalue);
+    const __m256i eq_hi =
+        _mm256_cmpeq_epi32(_mm256_and_si256(hi, vmask), vvalue);
+    const uint32_t bits =
+        static_cast<uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(eq_lo))) |
+        (static_cast<uint32_t>(
+             _mm256_movemask_ps(_mm256_castsi256_ps(eq_hi)))
+         << 8);
+    if (bits != 0xffffu) {
+      return idx + CountTrailingZeros(~bits);
+    }
+  }
+  return FindRunEndSse2(pixels, idx, end, mask, value);
+}
+
+NINEPATCH_TARGET("avx2")
+static inline uint32_t AlphaAtLeastAvx2(__m256i pixels, __m256i threshold) {
+  const __m256i at_least =
+      _mm256_cmpeq_epi8(_mm256_max_epu8(pixels, threshold), pixels);
+  return static_cast<uint32_t>(
+      _mm256_movemask_ps(_mm256_castsi256_ps(at_least)));
+}
+
+// Processes 32 pixels per step.
+NINEPATCH_TARGET("avx2")
+static uint32_t MaxAlphaAvx2(const uint8_t* pixels, int32_t start,
+                             int32_t end) {
+  const __m256i alpha_mask =
+      _mm256_set1_epi32(static_cast<int>(0xff000000u));
+  __m256i vmax = _mm256_setzero_si256();
+  int32_t idx = start;
+  for (; idx + 32 <= end; idx += 32) {
+    const __m256i* cursor = reinterpret_cast<const __m256i*>(pixels + idx * 4);
+    const __m256i a = _mm256_max_epu8(_mm256_loadu_si256(cursor),
+                                      _mm256_loadu_si256(cursor + 1));
+    const __m256i b = _mm256_max_epu8(_mm256_loadu_si256(cursor + 2),
+                                      _mm256_loadu_si256(cursor + 3));
+    vmax = _mm256_max_epu8(vmax,
+                           _mm256_and_si256(_mm256_max_epu8(a, b), alpha_mask));
+    if (_mm256_movemask_ps(_mm256_castsi256_ps(
+            _mm256_cmpeq_epi32(vmax, alpha_mask))) != 0) {
+      return 0xff;
+    }
+  }
+  const __m128i halves = _mm_max_epu8(_mm256_castsi256_si128(vmax),
+                                      _mm256_extracti128_si256(vmax, 1));
+  return std::max(ReduceMaxAlphaSse2(halves), MaxAlphaSse2(pixels, idx, end));
+}
+
+// Processes 16 pixels per step.
+NINEPATCH_TARGET("avx2")
+static int32_t FindAlphaAvx2(const uint8_t* pixels, int32_t start,
+                             int32_t end, uint32_t alpha) {
+  const __m256i threshold = _mm256_set1_epi32(static_cast<int>(alpha << 24));
+  int32_t idx = start;
+  for (; idx + 16 <= end; idx += 16) {
+    const __m256i* cursor = reinterpret_cast<const __m256i*>(pixels + idx * 4);
+    const uint32_t bits =
+        AlphaAtLeastAvx2(_mm256_loadu_si256(cursor), threshold) |
+        (AlphaAtLeastAvx2(_mm256_loadu_si256(cursor + 1), threshold) << 8);
+    if (bits != 0) {
+      return idx + CountTrailingZeros(bits);
+    }
+  }
+  return FindAlphaSse2(pixels, idx, end, alpha);
+}
+
+// Processes 16 pixels per step.
+NINEPATCH_TARGET("avx2")
+static int32_t FindLastAlphaAvx2(const uint8_t* pixels, int32_t start,
+                                 int32_t end, uint32_t alpha) {
+  const __m256i threshold = _mm256_set1_epi32(static_cast<int>(alpha << 24));
+  int32_t idx = end;
+  for (; idx - 16 >= start; idx -= 16) {
+    const __m256i* cursor =
+        reinterpret_cast<const __m256i*>(pixels + (idx - 16) * 4);
+    const uint32_t bits =
+        AlphaAtLeastAvx2(_mm256_loadu_si256(cursor), threshold) |
+        (AlphaAtLeastAvx2(_mm256_loadu_si256(cursor + 1), threshold) << 8);
+    if (bits != 0) {
+      return idx - 16 + HighestSetBit(bits);
+    }
+  }
+  return FindLastAlphaSse2(pixels, start, idx, alpha);
+}
+
+// Processes 16 floats per step. Uses a separate multiply and add rather than
+// FMA, which rounds once and would not match the other levels.
+NINEPATCH_TARGET("avx2")
+static void WeightedAddAvx2(float* dst, const float* src, float weight,
+                            int32_t count) {
+  const __m256 vweight = _mm256_set1_ps(weight);
+  int32_t idx = 0;
+  for (; idx + 16 <= count; idx += 16) {
+    const __m256 lo = _mm256_mul_ps(vweight, _mm256_loadu_ps(src + idx));
+    const __m256 hi = _mm256_mul_ps(vweight, _mm256_loadu_ps(src + idx + 8));
+    _mm256_storeu_ps(dst + idx,
+                     _mm256_add_ps(_mm256_loadu_ps(dst + idx), lo));
+    _mm256_storeu_ps(dst + idx + 8,
+                     _mm256_add_ps(_mm256_loadu_ps(dst + idx + 8), hi));
+  }
+  WeightedAddSse2(dst + idx, src + idx, weight, count - idx);
+}
+
+// Processes 16 pixels per step.
+NINEPATCH_TARGET("avx2")
+static void GatherPixelsAvx2(uint8_t* dst, const uint8_t* pixels,
+                             const int32_t* indices, int32_t count) {
+  const int* src = reinterpret_cast<const int*>(pixels);
+  int32_t idx = 0;
+  for (; idx + 16 <= count; idx += 16) {
+    const __m256i* at = reinterpret_cast<const __m256i*>(indices + idx);
+    const __m256i lo =
+        _mm256_i32gather_epi32(src, _mm256_loadu_si256(at), 4);
+    const __m256i hi =
+        _mm256_i32gather_epi32(src, _mm256_loadu_si256(at + 1), 4);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + idx * 4), lo);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + idx * 4 + 32), hi);
+  }
+  GatherPixelsSse2(dst + idx * 4, pixels, indices + idx, count - idx);
+}
+
+static const Kernels kAvx2Kernels = {
+    Level::kAvx2,
+    FindRunEndAvx2,
+    MaxAlphaAvx2,
+    FindAlphaAvx2,
+    FindLastAlphaAvx2,
+    WeightedAddAvx2,
+    GatherPixelsAvx2,
+};
+
+static bool CpuSupportsSse2() {
+#if defined(_M_X64) || defined(__x86_64__)
+  return true;
+#elif defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 1);
+  return (info[3] & (1 << 26)) != 0;
+#else
+  return __builtin_cpu_supports("sse2");
+#endif
+}
+
+static bool CpuSupportsAvx2() {
+#if defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 1);
+  const bool os_saves_ymm = (info[2] & (1 << 27)) != 0 &&
+                            (_xgetbv(0) & 0x6) == 0x6;
+  if (!os_saves_ymm) {
+    return false;
+  }
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+#else
+  return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif  // NINEPATCH_SIMD_X86
+
+Level DetectLevel() {
+#if defined(NINEPATCH_SIMD_X86)
+  static const Level level = CpuSupportsAvx2()
+                                 ? Level::kAvx2
+                                 : CpuSupportsSse2() ? Level::kSse2
+                                                     : Level::kScalar;
+  return level;
+#else
+  return Level::kScalar;
+#endif
+}
+
+const Kernels& GetKernels(Level level) {
+  if (level > DetectLevel()) {
+    level = DetectLevel();
+  }
+
+  switch (level) {
+#if defined(NINEPATCH_SIMD_X86)
+    case Level::kAvx2:
+      return kAvx2Kernels;
+    case Level::kSse2:
+      return kSse2Kernels;
+#endif
+    default:
+      return kScalarKernels;
+  }
+}
+
+static std::atomic<const Kernels*> g_active_kernels{nullptr};
+
+const Kernels& ActiveKernels() {
+  const Kernels* kernels = g_active_kernels.load(std::memory_order_relaxed);
+  if (kernels == nullptr) {
+    kernels = &GetKernels(DetectLevel());
+    g_active_kernels.store(kernels, std::memory_order_relaxed);
+  }
+  return *kernels;
+}
+
+void SetActiveLevel(Level level) {
+  g_active_kernels.store(&GetKernels(level), std::memory_order_relaxed);
+}
+
+}  // namespace simd
+}  // namespace aapt
@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AAPT_COMPILE_NINEPATCH_SIMD_H
+#define AAPT_COMPILE_NINEPATCH_SIMD_H
+
+#include <cstdint>
+
+namespace aapt {
+namespace simd {
+
+/**
+ * Instruction set levels the 9-patch pixel kernels are compiled for.
+ * Levels are ordered: a CPU that supports a level supports all lower ones.
+ */
+enum class Level {
+  kScalar = 0,
+  kSse2,
+  kAvx2,
+};
+
+/**
+ * Table of pixel kernels for one instruction set level. All kernels operate on
+ * contiguous runs of RGBA_8888 pixels and produce results identical to the
+ * scalar implementation.
+ *
+ * Masks and values are given in the packed 0xAARRGGBB format returned by
+ * NinePatch::PackRGBA().
+ */
+struct Kernels {
+  Level level;
+
+  /**
+   * Returns the index of the first pixel in [start, end) whose packed color,
+   * ANDed with `mask`, is not equal to `value`. Returns `end` if every pixel
+   * in the range matches.
+   */
+  int32_t (*find_run_end)(const uint8_t* pixels, int32_t start, int32_t end,
+                          uint32_t mask, uint32_t value);
+
+  /**
+   * Returns the largest alpha value of the pixels in [start, end), or 0 if the
+   * range is empty. Stops reading as soon as an alpha of 0xff is found.
+   */
+  uint32_t (*max_alpha)(const uint8_t* pixels, int32_t start, int32_t end);
+
+  /**
+   * Returns the index of the first pixel in [start, end) whose alpha is at
+   * least `alpha`, or `end` if there is none.
+   */
+  int32_t (*find_alpha)(const uint8_t* pixels, int32_t start, int32_t end,
+                        uint32_t alpha);
+
+  /**
+   * Returns the index of the last pixel in [start, end) whose alpha is at
+   * least `alpha`, or `start - 1` if there is none. Scans from `end`
+   * backwards.
+   */
+  int32_t (*find_last_alpha)(const uint8_t* pixels, int32_t start,
+                             int32_t end, uint32_t alpha);
+
+  /**
+   * Adds `weight` * src[i] to dst[i] for i in [0, count). Every element is
+   * rounded as a separate multiply and add, so all levels agree exactly.
+   */
+  void (*weighted_add)(float* dst, const float* src, float weight,
+                       int32_t count);
+
+  /**
+   * Copies pixel indices[i] of `pixels` to pixel i of `dst`, for i in
+   * [0, count).
+   */
+  void (*gather_pixels)(uint8_t* dst, const uint8_t* pixels,
+                        const int32_t* indices, int32_t count);
+};
+
+/**
+ * Returns the highest level supported by the running CPU.
+ */
+Level DetectLevel();
+
+/**
+ * Returns the kernels for `level`. If the running CPU does not support
+ * `level`, the kernels for DetectLevel() are returned instead.
+ */
+const Kernels& GetKernels(Level level);
+
+/**
+ * Returns the kernels used by the 9-patch analyzer. These are selected once
+ * from DetectLevel(), unless overridden with SetActiveLevel().
+ */
+const Kernels& ActiveKernels();
+
+/**
+ * Overrides the kernels used by the 9-patch analyzer. Intended for tests and
+ * benchmarks comparing the different implementations.
+ */
+void SetActiveLevel(Level level);
+
+}  // namespace simd
+}  // namespace aapt
+
+#endif /* AAPT_COMPILE_NINEPATCH_SIMD_H */
@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "NinePatchStageHistograms.h"
+
+#include <algorithm>
+#include <cmath>
+#include <ostream>
+
+namespace aapt {
+
+const char* GetStageName(const NinePatchStage stage) {
+  switch (stage) {
+    case NinePatchStage::kGatherColumns:
+      return "gather_columns";
+    case NinePatchStage::kBorderScan:
+      return "border_scan";
+    case NinePatchStage::kPopulateBounds:
+      return "populate_bounds";
+    case NinePatchStage::kRegionColors:
+      return "region_colors";
+    case NinePatchStage::kOutline:
+      return "outline";
+    case NinePatchStage::kOutlineRadius:
+      return "outline_radius";
+    case NinePatchStage::kSinglePassSweep:
+      return "single_pass_sweep";
+  }
+  return "unknown";
+}
+
+// Returns the bucket counting a stage that took `ns`: the number of
+// significant bits of `ns`.
+static int32_t GetBucket(uint64_t ns) {
+  int32_t bucket = 0;
+  while (ns != 0 && bucket < NinePatchStageHistograms::kBucketCount - 1) {
+    ns >>= 1;
+    bucket++;
+  }
+  return bucket;
+}
+
+uint64_t NinePatchStageHistograms::Histogram::QuantileNs(
+    const double q) const {
+  if (count == 0) {
+    return 0;
+  }
+  const uint64_t rank = std::max<uint64_t>(
+      1, static_cast<uint64_t>(std::ceil(q * static_cast<double>(count))));
+  uint64_t seen = 0;
+  for (int32_t i = 0; i < kBucketCount - 1; i++) {
+    seen += buckets[i];
+    if (seen >= rank) {
+      return std::min(((uint64_t)1 << i) - 1, max_ns);
+    }
+  }
+  return max_ns;
+}
+
+void NinePatchStageHistograms::OnStage(const NinePatchStageStats& stats) {
+  const uint64_t ns = static_cast<uint64_t>(std::max<int64_t>(
+      0, stats.nanoseconds));
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  Histogram& histogram = histograms_[static_cast<int32_t>(stats.stage)];
+  histogram.count++;
+  histogram.total_ns += ns;
+  histogram.max_ns = std::max(histogram.max_ns, ns);
+  histogram.total_pixels += stats.pixels;
+  histogram.total_allocations += stats.allocations;
+  histogram.total_allocated_bytes += stats.allocated_bytes;
+  histogram.buckets[GetBucket(ns)]++;
+}
+
+NinePatchStageHistograms::Histogram NinePatchStageHistograms::Get(
+    const NinePatchStage stage) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return histograms_[static_cast<int32_t>(stage)];
+}
+
+void NinePatchStageHistograms::Clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (Histogram& histogram : histograms_) {
+    histogram = Histogram();
+  }
+}
+
+::std::ostream& operator<<(::std::ostream& out,
+                           const NinePatchStageHistograms& histograms) {
+  for (int32_t i = 0; i < kNinePatchStageCount; i++) {
+    const NinePatchStage stage = static_cast<NinePatchStage>(i);
+    const NinePatchStageHistograms::Histogram histogram =
+        histograms.Get(stage);
+    if (histogram.count == 0) {
+      continue;
+    }
+    out << GetStageName(stage) << ": count=" << histogram.count
+        << " mean_ns=" << histogram.total_ns / histogram.count
+        << " p50_ns<=" << histogram.QuantileNs(0.5)
+        << " p99_ns<=" << histogram.QuantileNs(0.99)
+        << " max_ns=" << histogram.max_ns
+        << " pixels=" << histogram.total_pixels / histogram.count
+        << " allocations=" << histogram.total_allocations / histogram.count
+        << " allocated_bytes="
+        << histogram.total_allocated_bytes / histogram.count << "\n";
+  }
+  return out;
+}
+
+}  // namespace aapt
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AAPT_COMPILE_NINEPATCH_STAGE_HISTOGRAMS_H
+#define AAPT_COMPILE_NINEPATCH_STAGE_HISTOGRAMS_H
+
+#include <cstdint>
+#include <iosfwd>
+#include <mutex>
+
+#include "image.h"
+#include "macros.h"
+
+namespace aapt {
+
+/**
+ * Returns a short lowercase name for `stage`, e.g. "border_scan".
+ */
+const char* GetStageName(const NinePatchStage stage);
+
+/**
+ * Aggregates the stage measurements of any number of analyses, e.g. a whole
+ * NinePatch::CreateBatch(), into one histogram of wall times per stage. Safe
+ * to share between threads.
+ */
+class NinePatchStageHistograms : public NinePatchInstrumentation {
+ public:
+  /**
+   * Number of buckets of a histogram. Bucket 0 counts the stages that took no
+   * measurable time, and bucket i > 0 those that took [2^(i-1), 2^i) ns. The
+   * last bucket also counts everything longer.
+   */
+  static constexpr int32_t kBucketCount = 40;
+
+  struct Histogram {
+    uint64_t count = 0;
+    uint64_t total_ns = 0;
+    uint64_t max_ns = 0;
+    uint64_t total_pixels = 0;
+    uint64_t total_allocations = 0;
+    uint64_t total_allocated_bytes = 0;
+    uint64_t buckets[kBucketCount] = {};
+
+    /**
+     * Returns an upper bound of the `q` quantile of the wall times, for q in
+     * [0, 1]: the end of the bucket holding it, or max_ns if lower.
+     */
+    uint64_t QuantileNs(const double q) const;
+  };
+
+  explicit NinePatchStageHistograms() = default;
+
+  void OnStage(const NinePatchStageStats& stats) override;
+
+  /**
+   * Returns a copy of the histogram of `stage`.
+   */
+  Histogram Get(const NinePatchStage stage) const;
+
+  void Clear();
+
+ private:
+  mutable std::mutex mutex_;
+  Histogram histograms_[kNinePatchStageCount];
+
+  DISALLOW_COPY_AND_ASSIGN(NinePatchStageHistograms);
+};
+
+/**
+ * Prints one line per stage that was reported: the count, mean, median, 99th
+ * percentile and maximum time, and the mean pixels and allocations.
+ */
+::std::ostream& operator<<(::std::ostream& out,
+                           const NinePatchStageHistograms& histograms);
+
+}  // namespace aapt
+
+#endif /* AAPT_COMPILE_NINEPATCH_STAGE_HISTOGRAMS_H */
@@ -19,6 +19,7 @@
 
 #include <cstdint>
 #include <memory>
+#include <memory_resource>
 #include <string>
 #include <vector>
 
@@ -107,6 +108,317 @@ inline bool operator==(const Bounds& left, const Bounds& right) {
          left.right == right.right && left.bottom == right.bottom;
 }
 
+/**
+ * A rectangle of pixels, covering [left, right) horizontally and [top, bottom)
+ * vertically.
+ */
+struct Rect {
+  int32_t left = 0;
+  int32_t top = 0;
+  int32_t right = 0;
+  int32_t bottom = 0;
+
+  explicit Rect() = default;
+  inline explicit Rect(int32_t l, int32_t t, int32_t r, int32_t b)
+      : left(l), top(t), right(r), bottom(b) {}
+
+  bool empty() const { return left >= right || top >= bottom; }
+};
+
+inline bool operator==(const Rect& left, const Rect& right) {
+  return left.left == right.left && left.top == right.top &&
+         left.right == right.right && left.bottom == right.bottom;
+}
+
+/**
+ * Reasons an image is not a valid 9-patch.
+ */
+enum class NinePatchErrorCode {
+  kOk = 0,
+
+  // The image is smaller than 3x3.
+  kImageTooSmall,
+
+  // The top-left pixel is neither opaque white nor transparent.
+  kInvalidCornerColor,
+
+  // A border pixel is neither black, red nor the neutral color.
+  kInvalidColor,
+
+  // The top or left border has a red pixel.
+  kUnexpectedOpticalBounds,
+
+  // The bottom or right border has more than one black run.
+  kTooManyPaddingSections,
+
+  // The bottom or right border has more than two red runs.
+  kTooManyLayoutBoundsSections,
+
+  // A red run on the bottom or right border does not touch either end.
+  kLayoutBoundsNotAtEdge,
+
+  // The stretch regions split the image into more regions than the 9-patch
+  // chunk can hold.
+  kTooManyRegions,
+};
+
+/**
+ * The 1px borders of a 9-patch image.
+ */
+enum class NinePatchEdge {
+  kNone = 0,
+  kTop,
+  kLeft,
+  kBottom,
+  kRight,
+};
+
+/**
+ * The outcome of analyzing or validating a 9-patch image.
+ */
+struct NinePatchStatus {
+  NinePatchErrorCode code = NinePatchErrorCode::kOk;
+
+  /**
+   * The border the error was found on, or kNone.
+   */
+  NinePatchEdge edge = NinePatchEdge::kNone;
+
+  /**
+   * The offending pixel along `edge`, counting the 1px border: its x
+   * coordinate on the top and bottom borders, its y coordinate on the left and
+   * right borders. -1 if the error is not about a single pixel.
+   */
+  int32_t position = -1;
+
+  bool ok() const { return code == NinePatchErrorCode::kOk; }
+
+  /**
+   * Formats the error message NinePatch::Create() reports for this status.
+   */
+  std::string Message() const;
+};
+
+/**
+ * Layouts of the pixels NinePatch::Create can analyze without converting them
+ * to RGBA_8888 first.
+ */
+enum class PixelFormat {
+  // 4 bytes per pixel, in R, G, B, A order. Not premultiplied.
+  kRGBA_8888 = 0,
+
+  // 4 bytes per pixel, in B, G, R, A order. Not premultiplied.
+  kBGRA_8888,
+
+  // 4 bytes per pixel, in R, G, B, A order, with the color channels
+  // premultiplied by alpha.
+  kRGBA_8888_Premul,
+
+  // 8 bytes per pixel: native-endian half floats in R, G, B, A order. Not
+  // premultiplied. Channels are clamped to [0, 1].
+  kRGBA_F16,
+
+  // 1 byte per pixel holding only the alpha. The color is black, so opaque
+  // pixels mark stretch regions and padding, and transparent pixels are
+  // neutral.
+  kA8,
+};
+
+/**
+ * How much of what is drawn under a region of a 9-patch shows through it.
+ */
+enum class RegionOpacity : uint8_t {
+  // Every pixel of the region is fully transparent.
+  kTransparent = 0,
+
+  // Some pixel of the region is neither fully transparent nor fully opaque,
+  // or the region mixes both.
+  kTranslucent = 1,
+
+  // Every pixel of the region is fully opaque, so the compositor can draw it
+  // without blending and cull what is underneath.
+  kOpaque = 2,
+};
+
+/**
+ * Returns the size of one pixel in `format`, in bytes.
+ */
+inline int32_t GetBytesPerPixel(PixelFormat format) {
+  switch (format) {
+    case PixelFormat::kRGBA_F16:
+      return 8;
+    case PixelFormat::kA8:
+      return 1;
+    default:
+      return 4;
+  }
+}
+
+/**
+ * Stages of the analysis done by NinePatch::Create, as reported to a
+ * NinePatchInstrumentation.
+ */
+enum class NinePatchStage {
+  // Copies the left and right borders and the center column into contiguous
+  // buffers.
+  kGatherColumns = 0,
+
+  // Scans the borders into stretch regions, padding and layout bounds. Covers
+  // kPopulateBounds.
+  kBorderScan,
+
+  // Turns the ranges found on the bottom or right border into padding and
+  // layout bounds.
+  kPopulateBounds,
+
+  kRegionColors,
+
+  // Finds the outline and its alpha.
+  kOutline,
+
+  kOutlineRadius,
+
+  // The sweep of options.single_pass, which gathers the columns and computes
+  // the region colors.
+  kSinglePassSweep,
+};
+
+/**
+ * Number of NinePatchStage values.
+ */
+constexpr int32_t kNinePatchStageCount = 7;
+
+/**
+ * Measurements of one stage of one analysis.
+ */
+struct NinePatchStageStats {
+  NinePatchStage stage;
+
+  // Wall time spent in the stage.
+  int64_t nanoseconds = 0;
+
+  // Number of pixels the stage covers. Stages that stop at the first pixel
+  // proving the result may read fewer.
+  int64_t pixels = 0;
+
+  // Allocations from the temporary memory resource made during the stage, and
+  // their total size.
+  int64_t allocations = 0;
+  int64_t allocated_bytes = 0;
+};
+
+/**
+ * Receives the measurements of each stage of NinePatch::Create and
+ * NinePatch::Analyze, set through NinePatchOptions::instrumentation.
+ * NinePatchBuilder, Update() and Validate() report nothing.
+ */
+class NinePatchInstrumentation {
+ public:
+  virtual ~NinePatchInstrumentation() = default;
+
+  /**
+   * Called on the analyzing thread as each stage ends, so implementations used
+   * with CreateBatch() must be thread-safe. A stage can be reported more than
+   * once per analysis, e.g. kBorderScan for the top border and for the other
+   * borders in single_pass mode, and is not reported if an earlier stage
+   * found the image invalid.
+   */
+  virtual void OnStage(const NinePatchStageStats& stats) = 0;
+};
+
+/**
+ * Options controlling how NinePatch::Create reads and analyzes an image. Apart
+ * from pixel_format, tight_outline and region_opacity, none of them change the
+ * resulting NinePatch.
+ */
+struct NinePatchOptions {
+  /**
+   * Format of the pixels passed to NinePatch::Create. Pixels are converted to
+   * unpremultiplied 0xAARRGGBB colors as they are read, so the 9-patch colors
+   * (opaque black, opaque red, opaque white and transparent) have the same
+   * meaning in every format.
+   */
+  PixelFormat pixel_format = PixelFormat::kRGBA_8888;
+
+  /**
+   * Collects the borders, region colors and outline samples in a single
+   * top-to-bottom sweep over the image instead of one pass per feature.
+   * Saves memory bandwidth on images that do not fit in the cache.
+   */
+  bool single_pass = false;
+
+  /**
+   * Number of threads computing the region colors, each over its own band of
+   * rows. 0 or 1 computes them on the calling thread. Not used in single_pass
+   * mode.
+   */
+  int32_t region_color_threads = 1;
+
+  /**
+   * Images with fewer pixels than this compute the region colors on the
+   * calling thread regardless of region_color_threads, since starting the
+   * threads would cost more than it saves.
+   */
+  int64_t parallel_min_pixels = 1024 * 1024;
+
+  /**
+   * Computes the outline as the bounding box of the pixels holding the
+   * largest alpha value anywhere inside the border, and outline_alpha as that
+   * value, instead of sampling the center row and column. Off-center and
+   * irregular shapes get a tight outline, for one more read of the image (none
+   * in single_pass mode). NinePatchBuilder ignores it.
+   */
+  bool tight_outline = false;
+
+  /**
+   * Classifies every region as transparent, translucent or opaque into
+   * region_opacities, in the same pass as the region colors. A region that is
+   * not a solid color is then read until a pixel that is not opaque rather
+   * than until its first mismatch, which costs more on images with opaque
+   * content.
+   */
+  bool region_opacity = false;
+
+  /**
+   * Resource the temporary buffers of the analysis are allocated from, e.g. a
+   * std::pmr::monotonic_buffer_resource over an arena reused across calls. The
+   * default resource is used if null. The threads computing region colors in
+   * parallel allocate from the global heap, so the resource need not be
+   * thread-safe.
+   */
+  std::pmr::memory_resource* memory_resource = nullptr;
+
+  /**
+   * Number of threads NinePatch::CreateBatch() analyzes images on. 0 uses one
+   * thread per hardware thread.
+   */
+  int32_t batch_threads = 0;
+
+  /**
+   * Receives per-stage measurements of the analysis if not null. The analysis
+   * is compiled a second time with the measurements, so leaving this null
+   * runs exactly the uninstrumented code.
+   */
+  NinePatchInstrumentation* instrumentation = nullptr;
+};
+
+/**
+ * An image to analyze with NinePatch::CreateBatch(), given either as a table
+ * of row pointers, or as the top-left pixel at (x, y) in a buffer of rows
+ * `stride_bytes` apart. `rows` is used if not null.
+ */
+struct ImageRef {
+  uint8_t** rows = nullptr;
+  const uint8_t* base = nullptr;
+  size_t stride_bytes = 0;
+  int32_t x = 0;
+  int32_t y = 0;
+  int32_t width = 0;
+  int32_t height = 0;
+};
+
+struct NinePatchResult;
+
 /**
  * Contains 9-patch data from a source image. All measurements exclude the 1px
  * border of the
@@ -114,10 +426,129 @@ inline bool operator==(const Bounds& left, const Bounds& right) {
  */
 class NinePatch {
  public:
+  /**
+   * An empty 9-patch, to be filled by Analyze().
+   */
+  explicit NinePatch() = default;
+
+  /**
+   * Analyzes the `width` x `height` 9-patch whose rows are pointed to by
+   * `rows`. Pixels are RGBA_8888 unless options.pixel_format says otherwise.
+   */
+  static std::unique_ptr<NinePatch> Create(uint8_t** rows, const int32_t width,
+                                           const int32_t height,
+                                           std::string* err_out);
+
   static std::unique_ptr<NinePatch> Create(uint8_t** rows, const int32_t width,
                                            const int32_t height,
+                                           const NinePatchOptions& options,
+                                           std::string* err_out);
+
+  /**
+   * Analyzes the `width` x `height` 9-patch whose top-left pixel is at (x, y)
+   * in a buffer of rows, each starting `stride_bytes` after the previous one.
+   * The 9-patch can be analyzed in place, e.g. inside an atlas or a mapped
+   * file, without building a table of row pointers. Pixels are RGBA_8888
+   * unless options.pixel_format says otherwise.
+   */
+  static std::unique_ptr<NinePatch> Create(const uint8_t* base,
+                                           const size_t stride_bytes,
+                                           const int32_t x, const int32_t y,
+                                           const int32_t width,
+                                           const int32_t height,
+                                           std::string* err_out);
+
+  static std::unique_ptr<NinePatch> Create(const uint8_t* base,
+                                           const size_t stride_bytes,
+                                           const int32_t x, const int32_t y,
+                                           const int32_t width,
+                                           const int32_t height,
+                                           const NinePatchOptions& options,
                                            std::string* err_out);
 
+  /**
+   * Same as Create(), but analyzes the image into an existing `nine_patch`,
+   * replacing its contents. Returns false and sets `err_out` if the image is
+   * not a valid 9-patch, in which case the contents are unspecified.
+   *
+   * The vectors of `nine_patch` keep their capacity, so reusing one NinePatch
+   * across calls, with options.memory_resource serving the temporary buffers,
+   * lets a successful analysis run without global heap allocations. If
+   * `out_bytes_used` is not null, it is set to the number of bytes allocated
+   * from options.memory_resource.
+   */
+  static bool Analyze(uint8_t** rows, const int32_t width, const int32_t height,
+                      const NinePatchOptions& options, NinePatch* nine_patch,
+                      size_t* out_bytes_used, std::string* err_out);
+
+  static bool Analyze(const uint8_t* base, const size_t stride_bytes,
+                      const int32_t x, const int32_t y, const int32_t width,
+                      const int32_t height, const NinePatchOptions& options,
+                      NinePatch* nine_patch, size_t* out_bytes_used,
+                      std::string* err_out);
+
+  /**
+   * Checks whether the image is a valid 9-patch, without computing the region
+   * colors or the outline, so only the borders are scanned. The status matches
+   * the error Create() would report, but no message text is built.
+   * options.single_pass and the region color options do not apply.
+   */
+  static NinePatchStatus Validate(uint8_t** rows, const int32_t width,
+                                  const int32_t height);
+
+  static NinePatchStatus Validate(uint8_t** rows, const int32_t width,
+                                  const int32_t height,
+                                  const NinePatchOptions& options);
+
+  static NinePatchStatus Validate(const uint8_t* base,
+                                  const size_t stride_bytes, const int32_t x,
+                                  const int32_t y, const int32_t width,
+                                  const int32_t height,
+                                  const NinePatchOptions& options);
+
+  /**
+   * Returns the result of Create() on an image whose pixels changed only
+   * within `dirty`, given the result `prev` of analyzing it before the change
+   * with the same options. Only the work the change can affect is redone:
+   *
+   * - A change touching the top or left border moves the stretch regions, so
+   *   the image is analyzed in full.
+   * - A change touching the bottom or right border rescans the borders.
+   * - The region colors are recomputed for the regions intersecting `dirty`.
+   * - The outline is recomputed if `dirty` intersects the lines it was
+   *   sampled from (any content pixel for options.tight_outline).
+   *
+   * `dirty` is in image coordinates, including the border, and is clipped to
+   * the image.
+   */
+  static std::unique_ptr<NinePatch> Update(const NinePatch& prev,
+                                           uint8_t** rows, const int32_t width,
+                                           const int32_t height,
+                                           const Rect& dirty,
+                                           std::string* err_out);
+
+  static std::unique_ptr<NinePatch> Update(const NinePatch& prev,
+                                           uint8_t** rows, const int32_t width,
+                                           const int32_t height,
+                                           const Rect& dirty,
+                                           const NinePatchOptions& options,
+                                           std::string* err_out);
+
+  /**
+   * Analyzes the `count` images in `images` on options.batch_threads threads
+   * and returns one result per image, in the same order. Each result is the
+   * same as Create() on the image alone.
+   *
+   * Each thread starts with an equal share of the images and takes them in
+   * order; a thread that runs out steals the second half of the largest share
+   * left, so uneven image sizes do not leave threads idle. Each thread
+   * allocates the temporary buffers of its analyses from its own pool, which
+   * keeps them across images; options.memory_resource is not used.
+   */
+  static std::vector<NinePatchResult> CreateBatch(
+      const ImageRef* images, const size_t count,
+      const NinePatchOptions& options);
+
   /**
    * Packs the RGBA_8888 data pointed to by pixel into a uint32_t
    * with format 0xAARRGGBB (the way 9-patch expects it).
@@ -176,11 +607,17 @@ class NinePatch {
    */
   std::vector<uint32_t> region_colors;
 
+  /**
+   * The opacity of each region, in the same order as region_colors, if the
+   * NinePatch was analyzed with options.region_opacity. Empty otherwise.
+   */
+  std::vector<RegionOpacity> region_opacities;
+
   /**
    * Returns serialized data containing the original basic 9-patch meta data.
-   * Optical layout bounds and round rect outline data must be serialized
-   * separately using SerializeOpticalLayoutBounds() and
-   * SerializeRoundedRectOutline().
+   * Optical layout bounds, round rect outline and region opacity data must be
+   * serialized separately using SerializeOpticalLayoutBounds(),
+   * SerializeRoundedRectOutline() and SerializeRegionOpacities().
    */
   std::unique_ptr<uint8_t[]> SerializeBase(size_t* out_len) const;
 
@@ -194,12 +631,80 @@ class NinePatch {
    */
   std::unique_ptr<uint8_t[]> SerializeRoundedRectOutline(size_t* out_len) const;
 
- private:
-  explicit NinePatch() = default;
+  /**
+   * Serializes the region opacities, as an optional extension to the base
+   * data: one RegionOpacity byte per region, in region_colors order. Empty if
+   * the opacities were not computed.
+   */
+  std::unique_ptr<uint8_t[]> SerializeRegionOpacities(size_t* out_len) const;
 
+ private:
   DISALLOW_COPY_AND_ASSIGN(NinePatch);
 };
 
+/**
+ * The result of analyzing one image of NinePatch::CreateBatch(): the NinePatch,
+ * or nullptr and the error if the image is not a valid 9-patch.
+ */
+struct NinePatchResult {
+  std::unique_ptr<NinePatch> nine_patch;
+  std::string error;
+};
+
+/**
+ * Builds a NinePatch from rows added one at a time from top to bottom, e.g. as
+ * a decoder produces them, so the whole image never needs to be in memory.
+ * The result, including any error, is the same as NinePatch::Create() on the
+ * complete image.
+ *
+ * The borders, region colors and center row are tracked in O(width + height)
+ * state. The outline samples of the rows above the center row depend on the
+ * outline found on the center row, so the alpha of those rows is kept until
+ * the center row is added, and then reduced to the samples. The peak memory is
+ * therefore O(width * height / 2): one byte per pixel of the top half of the
+ * image, an eighth of the size of the image in RGBA_8888.
+ */
+class NinePatchBuilder {
+ public:
+  explicit NinePatchBuilder(const int32_t width, const int32_t height);
+
+  explicit NinePatchBuilder(const int32_t width, const int32_t height,
+                            const NinePatchOptions& options);
+
+  ~NinePatchBuilder();
+
+  /**
+   * Adds the next row of `width` pixels in options.pixel_format. Returns false
+   * and sets `out_err` as soon as the image is known not to be a valid
+   * 9-patch; the remaining rows need not be added then.
+   */
+  bool AddRow(const uint8_t* row, std::string* out_err);
+
+  /**
+   * Returns the NinePatch once all `height` rows were added, or nullptr and
+   * sets `out_err` if the image is not a valid 9-patch. Can only be called
+   * once.
+   */
+  std::unique_ptr<NinePatch> Finish(std::string* out_err);
+
+  class Analysis;
+
+ private:
+  // Records `err` as the result of all further calls.
+  bool Fail(const std::string& err, std::string* out_err);
+
+  const int32_t width_;
+  const int32_t height_;
+  const NinePatchOptions options_;
+  int32_t next_row_ = 0;
+  bool failed_ = false;
+  std::string error_;
+  std::unique_ptr<NinePatch> nine_patch_;
+  std::unique_ptr<Analysis> analysis_;
+
+  DISALLOW_COPY_AND_ASSIGN(NinePatchBuilder);
+};
+
 ::std::ostream& operator<<(::std::ostream& out, const Range& range);
 ::std::ostream& operator<<(::std::ostream& out, const Bounds& bounds);
 ::std::ostream& operator<<(::std::ostream& out, const NinePatch& nine_patch);
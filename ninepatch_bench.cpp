@@ -0,0 +1,679 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Measures the throughput of each stage of 9-patch processing on a synthetic
+// corpus, and prints the results as JSON:
+//
+//   ninepatch_bench [--min-time-ms=N] [--filter=SUBSTRING] [--out=FILE]
+//
+// Each result is named "<scenario>/<stage>". ns_per_op is the mean time of one
+// call of the stage. ns_per_pixel and mb_per_s are relative to the pixels of
+// the source image, including its border, for every stage, so that the stages
+// of a scenario can be compared with each other. validate_virtual makes the
+// border checks of validate through a virtual validator, as they were made
+// before the validators became compile-time policies. The create_batch results
+// analyze a corpus of 256 images of mixed sizes on a growing number of
+// threads.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "9patch.h"
+#include "NinePatchLayout.h"
+#include "NinePatchMesh.h"
+#include "NinePatchRenderer.h"
+#include "NinePatchRescaler.h"
+#include "NinePatchSimd.h"
+#include "image.h"
+
+namespace aapt {
+
+/**
+ * Shape of the opaque part of the content, which decides the outline.
+ */
+enum class OutlineShape {
+  // Every content pixel is opaque.
+  kOpaque,
+
+  // A rounded rectangle inset from the border, on a transparent background.
+  kRoundedRect,
+
+  // A translucent rectangle off the center, so that the sampled outline and
+  // the tight outline differ.
+  kOffset,
+};
+
+/**
+ * Parameters of a generated 9-patch. The same spec always generates the same
+ * pixels.
+ */
+struct CorpusSpec {
+  int32_t width;
+  int32_t height;
+
+  // Stretch regions on each axis, at most 5 so that the region count stays
+  // within what the chunk can hold.
+  int32_t stretch_regions;
+
+  // Number of colors in the content, which is filled with 4x4 tiles of
+  // colors picked at random. 1 makes every region a solid color.
+  int32_t colors;
+
+  // Whether the border is white instead of transparent where it is not black.
+  bool white_neutral;
+
+  OutlineShape outline;
+  uint32_t seed;
+};
+
+struct CorpusImage {
+  int32_t width;
+  int32_t height;
+  std::vector<uint8_t> data;
+  std::vector<uint8_t*> rows;
+};
+
+static void SetPixel(CorpusImage* image, int32_t x, int32_t y,
+                     uint32_t rgba) {
+  uint8_t* pixel = image->rows[y] + x * 4;
+  pixel[0] = static_cast<uint8_t>(rgba >> 24);
+  pixel[1] = static_cast<uint8_t>(rgba >> 16);
+  pixel[2] = static_cast<uint8_t>(rgba >> 8);
+  pixel[3] = static_cast<uint8_t>(rgba);
+}
+
+// Returns the alpha of content pixel (x, y), excluding the border, for
+// `shape`.
+static uint32_t ShapeAlpha(OutlineShape shape, int32_t x, int32_t y,
+                           int32_t width, int32_t height) {
+  switch (shape) {
+    case OutlineShape::kOpaque:
+      return 0xff;
+
+    case OutlineShape::kRoundedRect: {
+      const int32_t inset = std::min(width, height) / 10;
+      const int32_t radius = std::min(width, height) / 6;
+      const int32_t left = inset + radius;
+      const int32_t top = inset + radius;
+      const int32_t right = width - 1 - inset - radius;
+      const int32_t bottom = height - 1 - inset - radius;
+      if (x < inset || y < inset || x >= width - inset || y >= height - inset) {
+        return 0;
+      }
+      const int32_t dx = x < left ? left - x : (x > right ? x - right : 0);
+      const int32_t dy = y < top ? top - y : (y > bottom ? y - bottom : 0);
+      return dx * dx + dy * dy <= radius * radius ? 0xff : 0;
+    }
+
+    case OutlineShape::kOffset:
+      return x >= width / 8 && x < width * 5 / 8 && y >= height / 8 &&
+                     y < height * 5 / 8
+                 ? 0xb3
+                 : 0;
+  }
+  return 0;
+}
+
+// Draws `runs` black runs spread evenly over a border of `length` pixels,
+// between its corners.
+template <typename SetFn>
+static void DrawRuns(int32_t length, int32_t runs, SetFn set) {
+  const int32_t content = length - 2;
+  for (int32_t i = 0; i < runs; i++) {
+    const int32_t start = content * (2 * i + 1) / (2 * runs + 1);
+    const int32_t end = content * (2 * i + 2) / (2 * runs + 1);
+    for (int32_t p = start; p < std::max(end, start + 1); p++) {
+      set(1 + p);
+    }
+  }
+}
+
+static CorpusImage GenerateNinePatch(const CorpusSpec& spec) {
+  // The raw engine output is specified by the standard, unlike the
+  // distributions, so the corpus is the same with every standard library.
+  std::mt19937 rng(spec.seed);
+  CorpusImage image;
+  image.width = spec.width;
+  image.height = spec.height;
+  image.data.resize(static_cast<size_t>(spec.width) * spec.height * 4);
+  for (int32_t y = 0; y < spec.height; y++) {
+    image.rows.push_back(image.data.data() +
+                         static_cast<size_t>(y) * spec.width * 4);
+  }
+
+  std::vector<uint32_t> palette;
+  for (int32_t i = 0; i < spec.colors; i++) {
+    palette.push_back(rng() & 0xffffff00u);
+  }
+
+  const int32_t content_width = spec.width - 2;
+  const int32_t content_height = spec.height - 2;
+  const int32_t tiles_across = (content_width + 3) / 4;
+  std::vector<uint32_t> tile_colors(
+      static_cast<size_t>(tiles_across) * ((content_height + 3) / 4));
+  for (uint32_t& color : tile_colors) {
+    color = palette[rng() % palette.size()];
+  }
+  for (int32_t y = 0; y < content_height; y++) {
+    for (int32_t x = 0; x < content_width; x++) {
+      const uint32_t alpha =
+          ShapeAlpha(spec.outline, x, y, content_width, content_height);
+      const uint32_t color = tile_colors[(y / 4) * tiles_across + x / 4];
+      SetPixel(&image, 1 + x, 1 + y, alpha == 0 ? 0 : color | alpha);
+    }
+  }
+
+  const uint32_t neutral = spec.white_neutral ? 0xffffffffu : 0;
+  const uint32_t black = 0x000000ffu;
+  for (int32_t x = 0; x < spec.width; x++) {
+    SetPixel(&image, x, 0, neutral);
+    SetPixel(&image, x, spec.height - 1, neutral);
+  }
+  for (int32_t y = 0; y < spec.height; y++) {
+    SetPixel(&image, 0, y, neutral);
+    SetPixel(&image, spec.width - 1, y, neutral);
+  }
+  DrawRuns(spec.width, spec.stretch_regions,
+           [&](int32_t x) { SetPixel(&image, x, 0, black); });
+  DrawRuns(spec.height, spec.stretch_regions,
+           [&](int32_t y) { SetPixel(&image, 0, y, black); });
+  DrawRuns(spec.width, 1,
+           [&](int32_t x) { SetPixel(&image, x, spec.height - 1, black); });
+  DrawRuns(spec.height, 1,
+           [&](int32_t y) { SetPixel(&image, spec.width - 1, y, black); });
+  return image;
+}
+
+struct Scenario {
+  const char* name;
+  CorpusSpec spec;
+};
+
+static const Scenario kScenarios[] = {
+    {"icon_48", {48, 48, 1, 1, false, OutlineShape::kRoundedRect, 1}},
+    {"button_200x72", {200, 72, 2, 2, false, OutlineShape::kRoundedRect, 2}},
+    {"panel_512_white", {512, 512, 3, 1, true, OutlineShape::kOpaque, 3}},
+    {"complex_512", {512, 512, 5, 16, false, OutlineShape::kOffset, 4}},
+    {"large_2048", {2048, 2048, 2, 4, false, OutlineShape::kRoundedRect, 5}},
+};
+
+struct Result {
+  std::string name;
+  int64_t pixels;
+  int64_t iterations;
+  double ns_per_op;
+  double ns_per_pixel;
+  double mb_per_s;
+};
+
+struct BenchConfig {
+  double min_time_ms = 200.0;
+  std::string filter;
+};
+
+// Runs `fn` until at least min_time_ms have passed, and records the mean time
+// per call against `pixels` pixels of `bytes_per_pixel` bytes.
+static void Measure(const BenchConfig& config, const std::string& name,
+                    int64_t pixels, int32_t bytes_per_pixel,
+                    const std::function<void()>& fn,
+                    std::vector<Result>* out_results) {
+  if (name.find(config.filter) == std::string::npos) {
+    return;
+  }
+
+  using Clock = std::chrono::steady_clock;
+  // Warm up the caches and the memory allocator.
+  fn();
+  int64_t iterations = 0;
+  const Clock::time_point start = Clock::now();
+  double elapsed_ns = 0.0;
+  do {
+    fn();
+    iterations++;
+    elapsed_ns =
+        std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+  } while (elapsed_ns < config.min_time_ms * 1e6);
+
+  const double ns_per_call = elapsed_ns / iterations;
+  out_results->push_back(
+      Result{name, pixels, iterations, ns_per_call, ns_per_call / pixels,
+             (double)pixels * bytes_per_pixel / ns_per_call * 1e3});
+  fprintf(stderr, "%-44s %10.3f ns/px %10.1f MB/s\n", name.c_str(),
+          out_results->back().ns_per_pixel, out_results->back().mb_per_s);
+}
+
+static const char* GetLevelName(simd::Level level) {
+  switch (level) {
+    case simd::Level::kScalar:
+      return "scalar";
+    case simd::Level::kSse2:
+      return "sse2";
+    case simd::Level::kAvx2:
+      return "avx2";
+  }
+  return "unknown";
+}
+
+// Keeps results alive, so the compiler cannot drop the work producing them.
+static volatile size_t g_sink;
+
+// The border check as it was made before the neutral color validators became
+// compile-time policies: a validator chosen at run time from the top-left
+// pixel, called through its vtable for every border pixel. This is a copy of
+// the removed code, so that validate_virtual can be compared with validate.
+class VirtualColorValidator {
+ public:
+  virtual ~VirtualColorValidator() = default;
+
+  virtual bool IsNeutralColor(uint32_t color) const = 0;
+
+  bool IsValidColor(uint32_t color) const {
+    switch (color) {
+      case 0xff000000u:
+      case 0xffff0000u:
+        return true;
+    }
+    return IsNeutralColor(color);
+  }
+};
+
+class VirtualTransparentValidator : public VirtualColorValidator {
+ public:
+  bool IsNeutralColor(uint32_t color) const override {
+    return (color >> 24) == 0;
+  }
+};
+
+class VirtualWhiteValidator : public VirtualColorValidator {
+ public:
+  bool IsNeutralColor(uint32_t color) const override {
+    return color == 0xffffffffu;
+  }
+};
+
+// Walks a border line of `length` pixels, whose colors are returned by
+// `get_color`, and records the ranges of black and red pixels.
+template <typename GetColor>
+static bool FillRangesVirtual(const int32_t length, GetColor get_color,
+                              const VirtualColorValidator* color_validator,
+                              std::vector<Range>* primary_ranges,
+                              std::vector<Range>* secondary_ranges) {
+  uint32_t last_color = 0xffffffffu;
+  for (int32_t idx = 1; idx < length - 1; idx++) {
+    const uint32_t color = get_color(idx);
+    if (!color_validator->IsValidColor(color)) {
+      return false;
+    }
+
+    if (color != last_color) {
+      if (last_color == 0xff000000u) {
+        primary_ranges->back().end = idx - 1;
+      } else if (last_color == 0xffff0000u) {
+        secondary_ranges->back().end = idx - 1;
+      }
+
+      if (color == 0xff000000u) {
+        primary_ranges->push_back(Range(idx - 1, length - 2));
+      } else if (color == 0xffff0000u) {
+        secondary_ranges->push_back(Range(idx - 1, length - 2));
+      }
+      last_color = color;
+    }
+  }
+  return true;
+}
+
+// Checks the four borders of `image` with a virtual validator. Returns the
+// number of ranges found, or 0 at the first invalid color.
+static size_t ScanBordersVirtual(const CorpusImage& image) {
+  std::unique_ptr<VirtualColorValidator> validator;
+  if (image.rows[0][3] == 0) {
+    validator.reset(new VirtualTransparentValidator());
+  } else {
+    validator.reset(new VirtualWhiteValidator());
+  }
+
+  const int32_t width = image.width;
+  const int32_t height = image.height;
+  const uint8_t* const* rows = image.rows.data();
+  std::vector<Range> primary_ranges;
+  std::vector<Range> secondary_ranges;
+  size_t range_count = 0;
+  for (int32_t y : {0, height - 1}) {
+    primary_ranges.clear();
+    secondary_ranges.clear();
+    if (!FillRangesVirtual(
+            width,
+            [&](int32_t idx) { return NinePatch::PackRGBA(rows[y] + idx * 4); },
+            validator.get(), &primary_ranges, &secondary_ranges)) {
+      return 0;
+    }
+    range_count += primary_ranges.size() + secondary_ranges.size();
+  }
+  for (int32_t x : {0, width - 1}) {
+    primary_ranges.clear();
+    secondary_ranges.clear();
+    if (!FillRangesVirtual(
+            height,
+            [&](int32_t idx) { return NinePatch::PackRGBA(rows[idx] + x * 4); },
+            validator.get(), &primary_ranges, &secondary_ranges)) {
+      return 0;
+    }
+    range_count += primary_ranges.size() + secondary_ranges.size();
+  }
+  return range_count;
+}
+
+static void RunScenario(const BenchConfig& config, const Scenario& scenario,
+                        std::vector<Result>* out_results) {
+  CorpusImage image = GenerateNinePatch(scenario.spec);
+  const int64_t pixels = (int64_t)image.width * image.height;
+  const std::string prefix = std::string(scenario.name) + "/";
+
+  std::string err;
+  std::unique_ptr<NinePatch> nine_patch =
+      NinePatch::Create(image.rows.data(), image.width, image.height, &err);
+  if (!nine_patch) {
+    fprintf(stderr, "%s: %s\n", scenario.name, err.c_str());
+    exit(1);
+  }
+
+  auto create = [&](const NinePatchOptions& options) {
+    return [&image, options]() {
+      std::string err;
+      std::unique_ptr<NinePatch> result = NinePatch::Create(
+          image.rows.data(), image.width, image.height, options, &err);
+      g_sink = result->region_colors.size();
+    };
+  };
+
+  // Compares the kernels by running the whole analysis with each of them.
+  const simd::Level active_level = simd::ActiveKernels().level;
+  for (int level = 0; level <= static_cast<int>(simd::DetectLevel());
+       level++) {
+    simd::SetActiveLevel(static_cast<simd::Level>(level));
+    Measure(config,
+            prefix + "create/" + GetLevelName(static_cast<simd::Level>(level)),
+            pixels, 4, create(NinePatchOptions()), out_results);
+  }
+  simd::SetActiveLevel(active_level);
+
+  NinePatchOptions single_pass;
+  single_pass.single_pass = true;
+  Measure(config, prefix + "create_single_pass", pixels, 4,
+          create(single_pass), out_results);
+
+  NinePatchOptions tight_outline;
+  tight_outline.tight_outline = true;
+  Measure(config, prefix + "create_tight_outline", pixels, 4,
+          create(tight_outline), out_results);
+
+  NinePatchOptions region_opacity;
+  region_opacity.region_opacity = true;
+  Measure(config, prefix + "create_region_opacity", pixels, 4,
+          create(region_opacity), out_results);
+
+  Measure(config, prefix + "validate", pixels, 4,
+          [&]() {
+            g_sink = static_cast<size_t>(
+                NinePatch::Validate(image.rows.data(), image.width,
+                                    image.height)
+                    .code);
+          },
+          out_results);
+  Measure(config, prefix + "validate_virtual", pixels, 4,
+          [&]() { g_sink = ScanBordersVirtual(image); }, out_results);
+
+  // Rescaling is deterministic, so a spec the rescaler rejects is reported
+  // once here instead of being dereferenced in the timed loop.
+  {
+    Image scaled;
+    if (!RescaleNinePatch(image.rows.data(), image.width, image.height,
+                          *nine_patch, 0.75f, &scaled, &err)) {
+      fprintf(stderr, "%s: rescale: %s\n", scenario.name, err.c_str());
+      exit(1);
+    }
+  }
+  Measure(config, prefix + "rescale_0.75", pixels, 4,
+          [&]() {
+            Image scaled;
+            std::string err;
+            std::unique_ptr<NinePatch> result =
+                RescaleNinePatch(image.rows.data(), image.width, image.height,
+                                 *nine_patch, 0.75f, &scaled, &err);
+            g_sink = result->region_colors.size();
+          },
+          out_results);
+
+  size_t chunk_len;
+  std::unique_ptr<uint8_t[]> chunk = nine_patch->SerializeBase(&chunk_len);
+  android::Res_png_9patch* device_chunk =
+      android::Res_png_9patch::deserialize(chunk.get());
+  device_chunk->fileToDevice();
+  std::unique_ptr<NinePatchRenderer> renderer = NinePatchRenderer::Create(
+      *device_chunk, image.width - 2, image.height - 2, &err);
+  std::vector<uint8_t*> content;
+  for (int32_t y = 1; y < image.height - 1; y++) {
+    content.push_back(image.rows[y] + 4);
+  }
+  const int32_t dst_width = (image.width - 2) * 2;
+  const int32_t dst_height = (image.height - 2) * 2;
+  std::vector<uint8_t> dst((size_t)dst_width * dst_height * 4);
+  std::vector<uint8_t*> dst_rows;
+  for (int32_t y = 0; y < dst_height; y++) {
+    dst_rows.push_back(dst.data() + (size_t)y * dst_width * 4);
+  }
+  Measure(config, prefix + "render_2x", pixels, 4,
+          [&]() {
+            renderer->Render(content.data(), dst_width, dst_height,
+                             dst_rows.data());
+            g_sink = dst[0];
+          },
+          out_results);
+
+  // A frame of 1024 views sharing the chunk, at different sizes.
+  std::vector<NinePatchMeshRequest> requests(1024);
+  for (size_t i = 0; i < requests.size(); i++) {
+    requests[i].chunk = device_chunk;
+    requests[i].width = image.width - 2;
+    requests[i].height = image.height - 2;
+    requests[i].dst.left = static_cast<float>(i % 32) * 64.0f;
+    requests[i].dst.top = static_cast<float>(i / 32) * 64.0f;
+    requests[i].dst.right = requests[i].dst.left + image.width + i % 97;
+    requests[i].dst.bottom = requests[i].dst.top + image.height + i % 89;
+  }
+  int32_t mesh_vertices;
+  int32_t mesh_indices;
+  GetNinePatchMeshCapacity(*device_chunk, &mesh_vertices, &mesh_indices);
+  const size_t vertex_capacity = mesh_vertices * requests.size();
+  std::vector<float> mesh_xyuv(vertex_capacity * 4);
+  std::vector<uint32_t> indices(mesh_indices * requests.size());
+  std::vector<NinePatchMeshRange> ranges(requests.size());
+  Measure(config, prefix + "mesh_batch_1024", pixels, 4,
+          [&]() {
+            NinePatchMeshBuffers buffers;
+            buffers.x = mesh_xyuv.data();
+            buffers.y = buffers.x + vertex_capacity;
+            buffers.u = buffers.y + vertex_capacity;
+            buffers.v = buffers.u + vertex_capacity;
+            buffers.vertex_capacity = static_cast<int32_t>(vertex_capacity);
+            buffers.indices = indices.data();
+            buffers.index_capacity = static_cast<int32_t>(indices.size());
+            BuildNinePatchMeshes(requests.data(), requests.size(), &buffers,
+                                 ranges.data(), &err);
+            g_sink = buffers.index_count;
+          },
+          out_results);
+
+  std::unique_ptr<NinePatchLayoutEngine> layout_engine =
+      NinePatchLayoutEngine::Create(*device_chunk, image.width - 2,
+                                    image.height - 2,
+                                    nine_patch->layout_bounds, &err);
+  std::vector<int32_t> layout_widths;
+  std::vector<int32_t> layout_heights;
+  for (const NinePatchMeshRequest& request : requests) {
+    layout_widths.push_back(
+        static_cast<int32_t>(request.dst.right - request.dst.left));
+    layout_heights.push_back(
+        static_cast<int32_t>(request.dst.bottom - request.dst.top));
+  }
+  NinePatchLayouts layouts;
+  Measure(config, prefix + "layout_batch_1024", pixels, 4,
+          [&]() {
+            layout_engine->Layout(layout_widths.data(), layout_heights.data(),
+                                  layout_widths.size(), &layouts);
+            g_sink = layouts.col_edges.back();
+          },
+          out_results);
+
+  Measure(config, prefix + "serialize_base", pixels, 4,
+          [&]() {
+            size_t len;
+            std::unique_ptr<uint8_t[]> data = nine_patch->SerializeBase(&len);
+            g_sink = len;
+          },
+          out_results);
+
+  android::Res_png_9patch header;
+  header.numXDivs =
+      static_cast<uint8_t>(nine_patch->horizontal_stretch_regions.size()) * 2;
+  header.numYDivs =
+      static_cast<uint8_t>(nine_patch->vertical_stretch_regions.size()) * 2;
+  header.numColors = static_cast<uint8_t>(nine_patch->region_colors.size());
+  std::vector<uint8_t> buffer(header.serializedSize());
+  Measure(config, prefix + "res_png_9patch_serialize", pixels, 4,
+          [&]() {
+            android::Res_png_9patch::serialize(
+                header,
+                (const int32_t*)nine_patch->horizontal_stretch_regions.data(),
+                (const int32_t*)nine_patch->vertical_stretch_regions.data(),
+                nine_patch->region_colors.data(), buffer.data());
+            g_sink = buffer[0];
+          },
+          out_results);
+}
+
+// Analyzes a mixed corpus with NinePatch::CreateBatch() on 1, 2, 4, ... threads
+// up to the hardware thread count.
+static void RunBatchScaling(const BenchConfig& config,
+                            std::vector<Result>* out_results) {
+  const std::string prefix = "corpus_256/create_batch/";
+  if (prefix.find(config.filter) == std::string::npos &&
+      config.filter.find(prefix) == std::string::npos) {
+    return;
+  }
+
+  std::vector<CorpusImage> corpus;
+  for (uint32_t i = 0; i < 256; i++) {
+    CorpusSpec spec = kScenarios[i % 4].spec;
+    spec.width += static_cast<int32_t>(i % 13) * 8;
+    spec.height += static_cast<int32_t>(i % 7) * 8;
+    spec.seed = 1000 + i;
+    corpus.push_back(GenerateNinePatch(spec));
+  }
+
+  int64_t pixels = 0;
+  std::vector<ImageRef> refs;
+  for (CorpusImage& image : corpus) {
+    ImageRef ref;
+    ref.rows = image.rows.data();
+    ref.width = image.width;
+    ref.height = image.height;
+    refs.push_back(ref);
+    pixels += (int64_t)image.width * image.height;
+  }
+
+  const int32_t max_threads =
+      std::max(1, static_cast<int32_t>(std::thread::hardware_concurrency()));
+  for (int32_t threads = 1;; threads = std::min(threads * 2, max_threads)) {
+    NinePatchOptions options;
+    options.batch_threads = threads;
+    Measure(config, prefix + "threads_" + std::to_string(threads),
+            pixels, 4,
+            [&]() {
+              g_sink = NinePatch::CreateBatch(refs.data(), refs.size(), options)
+                           .size();
+            },
+            out_results);
+    if (threads == max_threads) {
+      break;
+    }
+  }
+}
+
+static void WriteJson(const std::vector<Result>& results, FILE* out) {
+  fprintf(out, "{\n  \"benchmarks\": [\n");
+  for (size_t i = 0; i < results.size(); i++) {
+    const Result& result = results[i];
+    fprintf(out,
+            "    {\"name\": \"%s\", \"pixels\": %lld, \"iterations\": %lld, "
+            "\"ns_per_op\": %.1f, \"ns_per_pixel\": %.4f, "
+            "\"mb_per_s\": %.2f}%s\n",
+            result.name.c_str(), (long long)result.pixels,
+            (long long)result.iterations, result.ns_per_op, result.ns_per_pixel,
+            result.mb_per_s, i + 1 < results.size() ? "," : "");
+  }
+  fprintf(out, "  ]\n}\n");
+}
+
+}  // namespace aapt
+
+int main(int argc, char** argv) {
+  aapt::BenchConfig config;
+  const char* out_path = nullptr;
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    if (strncmp(arg, "--min-time-ms=", 14) == 0) {
+      config.min_time_ms = atof(arg + 14);
+    } else if (strncmp(arg, "--filter=", 9) == 0) {
+      config.filter = arg + 9;
+    } else if (strncmp(arg, "--out=", 6) == 0) {
+      out_path = arg + 6;
+    } else {
+      fprintf(stderr,
+              "usage: %s [--min-time-ms=N] [--filter=SUBSTRING] "
+              "[--out=FILE]\n",
+              argv[0]);
+      return 2;
+    }
+  }
+
+  std::vector<aapt::Result> results;
+  for (const aapt::Scenario& scenario : aapt::kScenarios) {
+    aapt::RunScenario(config, scenario, &results);
+  }
+  aapt::RunBatchScaling(config, &results);
+
+  FILE* out = out_path != nullptr ? fopen(out_path, "w") : stdout;
+  if (out == nullptr) {
+    fprintf(stderr, "cannot open %s\n", out_path);
+    return 1;
+  }
+  aapt::WriteJson(results, out);
+  if (out != stdout) {
+    fclose(out);
+  }
+  return 0;
+}